@@ -0,0 +1,74 @@
+#include "claim.hpp"
+
+#include <QFile>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "logger.hpp"
+
+WALLREEL_DECLARE_SENDER("CacheClaim")
+
+using namespace Qt::StringLiterals;
+
+namespace WallReel::Core::Cache {
+
+/// Retries flock() interrupted by a signal.
+static int lockFile(int fd, int operation) {
+    int ret;
+    do {
+        ret = ::flock(fd, operation);
+    } while (ret != 0 && errno == EINTR);
+    return ret;
+}
+
+Claim acquireClaim(const QString& path) {
+    Claim claim{.path = path};
+    const QByteArray encoded = QFile::encodeName(path);
+
+    while (true) {
+        const int fd = ::open(encoded.constData(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            WR_WARN(u"Cannot open claim %1: %2"_s.arg(path, QString::fromLocal8Bit(std::strerror(errno))));
+            return claim;
+        }
+
+        if (lockFile(fd, LOCK_EX | LOCK_NB) != 0) {
+            if (errno != EWOULDBLOCK) {
+                WR_WARN(u"Cannot lock claim %1: %2"_s.arg(path, QString::fromLocal8Bit(std::strerror(errno))));
+                ::close(fd);
+                return claim;
+            }
+            // Woken up by the kernel once the holder releases it or dies, no polling
+            claim.waited = true;
+            if (lockFile(fd, LOCK_EX) != 0) {
+                WR_WARN(u"Cannot lock claim %1: %2"_s.arg(path, QString::fromLocal8Bit(std::strerror(errno))));
+                ::close(fd);
+                return claim;
+            }
+        }
+
+        // The previous holder may have removed the file between our open() and flock()
+        struct stat held, current;
+        if (::fstat(fd, &held) == 0 && ::stat(encoded.constData(), &current) == 0 &&
+            held.st_dev == current.st_dev && held.st_ino == current.st_ino) {
+            claim.fd = fd;
+            return claim;
+        }
+        ::close(fd);
+    }
+}
+
+void releaseClaim(Claim& claim) {
+    if (!claim.isHeld())
+        return;
+    // Removed while still locked, so that whoever opens it next either finds it gone or locks a new one
+    ::unlink(QFile::encodeName(claim.path).constData());
+    ::close(claim.fd);
+    claim.fd = -1;
+}
+
+}  // namespace WallReel::Core::Cache
@@ -0,0 +1,39 @@
+#ifndef WALLREEL_CACHE_CLAIM_HPP
+#define WALLREEL_CACHE_CLAIM_HPP
+
+#include <QString>
+
+namespace WallReel::Core::Cache {
+
+/**
+ * @brief Exclusive claim of a process on generating a thumbnail, shared by all processes using a cache.
+ *
+ * @details An flock() on a lock file named after the key. Taking it needs no database write, and the
+ * kernel releases it as soon as the holder closes it or dies, so that a claim never has to expire.
+ * The file is removed by its holder on release, a claim taken on a file that has been removed in the
+ * meantime is taken again on a fresh one.
+ */
+struct Claim {
+    int fd = -1;  ///< Locked file descriptor, -1 if nothing is held
+    QString path;
+    bool waited = false;  ///< Whether another process held the claim first
+
+    bool isHeld() const { return fd >= 0; }
+};
+
+/**
+ * @brief Take the claim on a lock file, blocking until any other holder releases it.
+ *
+ * @param path Lock file, created if needed
+ * @return Claim Not held if the lock file cannot be used, the caller then goes ahead on its own
+ */
+Claim acquireClaim(const QString& path);
+
+/**
+ * @brief Remove the lock file and release the claim, does nothing if it is not held.
+ */
+void releaseClaim(Claim& claim);
+
+}  // namespace WallReel::Core::Cache
+
+#endif  // WALLREEL_CACHE_CLAIM_HPP
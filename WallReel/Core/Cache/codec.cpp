@@ -0,0 +1,392 @@
+#include "codec.hpp"
+
+#include <QBuffer>
+#include <QFile>
+#include <QImageReader>
+#include <algorithm>
+#include <cstring>
+
+#include "logger.hpp"
+
+WALLREEL_DECLARE_SENDER("CacheCodec")
+
+using namespace Qt::StringLiterals;
+
+namespace WallReel::Core::Cache {
+
+namespace {
+
+// Raw thumbnails: a fixed size header followed by the pixel data exactly as laid out in QImage.
+// The header is padded to 32 bytes so that the pixels stay aligned when the header is.
+constexpr char s_RawMagic[8]     = {'W', 'R', 'R', 'A', 'W', '0', '0', '1'};
+constexpr qint64 s_RawHeaderSize = 32;
+
+struct RawHeader {
+    char magic[8];
+    quint32 width;
+    quint32 height;
+    quint32 bytesPerLine;
+    quint32 format;
+    quint8 reserved[8];
+};
+static_assert(sizeof(RawHeader) == s_RawHeaderSize);
+
+// QOI, see https://qoiformat.org/qoi-specification.pdf
+constexpr char s_QoiMagic[4]     = {'q', 'o', 'i', 'f'};
+constexpr qint64 s_QoiHeaderSize = 14;
+constexpr uchar s_QoiPadding[8]  = {0, 0, 0, 0, 0, 0, 0, 1};
+constexpr uchar s_QoiOpIndex     = 0x00;
+constexpr uchar s_QoiOpDiff      = 0x40;
+constexpr uchar s_QoiOpLuma      = 0x80;
+constexpr uchar s_QoiOpRun       = 0xc0;
+constexpr uchar s_QoiOpRgb       = 0xfe;
+constexpr uchar s_QoiOpRgba      = 0xff;
+constexpr uchar s_QoiMask        = 0xc0;
+// Refuse anything larger than this many pixels, as the reference implementation does
+constexpr qint64 s_QoiMaxPixels = 400'000'000;
+
+// End markers of JPEG (EOI) and PNG (IEND chunk type), looked for within the last s_TrailerSearchSize bytes,
+// as some encoders append data after them
+constexpr char s_JpegMagic[3]        = {'\xff', '\xd8', '\xff'};
+constexpr char s_JpegEnd[2]          = {'\xff', '\xd9'};
+constexpr char s_PngMagic[8]         = {'\x89', 'P', 'N', 'G', '\r', '\n', '\x1a', '\n'};
+constexpr char s_PngEnd[4]           = {'I', 'E', 'N', 'D'};
+constexpr qint64 s_TrailerSearchSize = 4096;
+
+struct QoiPixel {
+    uchar r = 0, g = 0, b = 0, a = 0;
+
+    bool operator==(const QoiPixel&) const = default;
+
+    int hash() const { return (r * 3 + g * 5 + b * 7 + a * 11) % 64; }
+};
+
+void putBigEndian32(QByteArray& out, quint32 v) {
+    out.append(char(v >> 24));
+    out.append(char(v >> 16));
+    out.append(char(v >> 8));
+    out.append(char(v));
+}
+
+quint32 getBigEndian32(const uchar* p) {
+    return (quint32(p[0]) << 24) | (quint32(p[1]) << 16) | (quint32(p[2]) << 8) | quint32(p[3]);
+}
+
+QByteArray encodeJpeg(const QImage& image) {
+    QByteArray bytes;
+    QBuffer buffer(&bytes);
+    buffer.open(QIODevice::WriteOnly);
+    if (!image.save(&buffer, "JPEG", 85))
+        return {};
+    return bytes;
+}
+
+QByteArray encodeRaw(const QImage& source) {
+    const QImage image = source.format() == QImage::Format_ARGB32_Premultiplied
+                             ? source
+                             : source.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+
+    RawHeader header{};
+    std::memcpy(header.magic, s_RawMagic, sizeof(s_RawMagic));
+    header.width        = image.width();
+    header.height       = image.height();
+    header.bytesPerLine = image.bytesPerLine();
+    header.format       = image.format();
+
+    QByteArray bytes;
+    bytes.reserve(s_RawHeaderSize + image.sizeInBytes());
+    bytes.append(reinterpret_cast<const char*>(&header), s_RawHeaderSize);
+    bytes.append(reinterpret_cast<const char*>(image.constBits()), image.sizeInBytes());
+    return bytes;
+}
+
+QImage decodeRaw(const uchar* data, qint64 size, std::shared_ptr<const void> owner) {
+    if (size < s_RawHeaderSize)
+        return {};
+    RawHeader header;
+    std::memcpy(&header, data, s_RawHeaderSize);
+
+    const qint64 pixelBytes = qint64(header.bytesPerLine) * header.height;
+    if (header.width == 0 || header.height == 0 ||
+        header.format != QImage::Format_ARGB32_Premultiplied ||
+        header.bytesPerLine < header.width * 4 ||
+        size < s_RawHeaderSize + pixelBytes) {
+        WR_WARN(u"Malformed raw thumbnail (%1x%2, %3 byte(s))"_s.arg(header.width).arg(header.height).arg(size));
+        return {};
+    }
+
+    const uchar* pixels = data + s_RawHeaderSize;
+    const QImage view(pixels, header.width, header.height, header.bytesPerLine, QImage::Format_ARGB32_Premultiplied);
+    // QImage requires 32-bit aligned scanlines to work in place
+    if (!owner || reinterpret_cast<quintptr>(pixels) % 4 != 0)
+        return view.copy();
+
+    return QImage(
+        pixels,
+        header.width,
+        header.height,
+        header.bytesPerLine,
+        QImage::Format_ARGB32_Premultiplied,
+        [](void* info) { delete static_cast<std::shared_ptr<const void>*>(info); },
+        new std::shared_ptr<const void>(std::move(owner)));
+}
+
+QByteArray encodeQoi(const QImage& source) {
+    const QImage image = source.convertToFormat(QImage::Format_RGBA8888);
+    const int width    = image.width();
+    const int height   = image.height();
+
+    QByteArray bytes;
+    // Worst case is one RGBA op per pixel
+    bytes.reserve(s_QoiHeaderSize + qint64(width) * height * 5 + sizeof(s_QoiPadding));
+    bytes.append(s_QoiMagic, sizeof(s_QoiMagic));
+    putBigEndian32(bytes, width);
+    putBigEndian32(bytes, height);
+    bytes.append(char(image.hasAlphaChannel() ? 4 : 3));
+    bytes.append(char(0));  // sRGB with linear alpha
+
+    QoiPixel index[64] = {};
+    QoiPixel prev{0, 0, 0, 255};
+    int run = 0;
+
+    for (int y = 0; y < height; ++y) {
+        const uchar* line = image.constScanLine(y);
+        for (int x = 0; x < width; ++x) {
+            const QoiPixel px{line[x * 4], line[x * 4 + 1], line[x * 4 + 2], line[x * 4 + 3]};
+
+            if (px == prev) {
+                ++run;
+                if (run == 62 || (y == height - 1 && x == width - 1)) {
+                    bytes.append(char(s_QoiOpRun | (run - 1)));
+                    run = 0;
+                }
+                continue;
+            }
+
+            if (run > 0) {
+                bytes.append(char(s_QoiOpRun | (run - 1)));
+                run = 0;
+            }
+
+            const int hash = px.hash();
+            if (index[hash] == px) {
+                bytes.append(char(s_QoiOpIndex | hash));
+            } else {
+                index[hash] = px;
+                if (px.a == prev.a) {
+                    const signed char vr  = px.r - prev.r;
+                    const signed char vg  = px.g - prev.g;
+                    const signed char vb  = px.b - prev.b;
+                    const signed char vgr = vr - vg;
+                    const signed char vgb = vb - vg;
+
+                    if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+                        bytes.append(char(s_QoiOpDiff | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2)));
+                    } else if (vgr > -9 && vgr < 8 && vg > -33 && vg < 32 && vgb > -9 && vgb < 8) {
+                        bytes.append(char(s_QoiOpLuma | (vg + 32)));
+                        bytes.append(char((vgr + 8) << 4 | (vgb + 8)));
+                    } else {
+                        bytes.append(char(s_QoiOpRgb));
+                        bytes.append(char(px.r));
+                        bytes.append(char(px.g));
+                        bytes.append(char(px.b));
+                    }
+                } else {
+                    bytes.append(char(s_QoiOpRgba));
+                    bytes.append(char(px.r));
+                    bytes.append(char(px.g));
+                    bytes.append(char(px.b));
+                    bytes.append(char(px.a));
+                }
+            }
+            prev = px;
+        }
+    }
+
+    bytes.append(reinterpret_cast<const char*>(s_QoiPadding), sizeof(s_QoiPadding));
+    return bytes;
+}
+
+QImage decodeQoi(const uchar* data, qint64 size) {
+    if (size < s_QoiHeaderSize + qint64(sizeof(s_QoiPadding)))
+        return {};
+    const quint32 width  = getBigEndian32(data + 4);
+    const quint32 height = getBigEndian32(data + 8);
+    if (width == 0 || height == 0 || qint64(width) * height > s_QoiMaxPixels) {
+        WR_WARN(u"Malformed QOI thumbnail (%1x%2)"_s.arg(width).arg(height));
+        return {};
+    }
+
+    QImage image(width, height, QImage::Format_RGBA8888);
+    if (image.isNull())
+        return {};
+
+    const uchar* p   = data + s_QoiHeaderSize;
+    const uchar* end = data + size - sizeof(s_QoiPadding);
+
+    QoiPixel index[64] = {};
+    QoiPixel px{0, 0, 0, 255};
+    int run = 0;
+
+    for (quint32 y = 0; y < height; ++y) {
+        uchar* line = image.scanLine(y);
+        for (quint32 x = 0; x < width; ++x) {
+            if (run > 0) {
+                --run;
+            } else if (p < end) {
+                const uchar b1 = *p++;
+                if (b1 == s_QoiOpRgb) {
+                    if (end - p < 3)
+                        return {};
+                    px.r = *p++;
+                    px.g = *p++;
+                    px.b = *p++;
+                } else if (b1 == s_QoiOpRgba) {
+                    if (end - p < 4)
+                        return {};
+                    px.r = *p++;
+                    px.g = *p++;
+                    px.b = *p++;
+                    px.a = *p++;
+                } else if ((b1 & s_QoiMask) == s_QoiOpIndex) {
+                    px = index[b1];
+                } else if ((b1 & s_QoiMask) == s_QoiOpDiff) {
+                    px.r += ((b1 >> 4) & 0x03) - 2;
+                    px.g += ((b1 >> 2) & 0x03) - 2;
+                    px.b += (b1 & 0x03) - 2;
+                } else if ((b1 & s_QoiMask) == s_QoiOpLuma) {
+                    if (end - p < 1)
+                        return {};
+                    const uchar b2 = *p++;
+                    const int vg   = (b1 & 0x3f) - 32;
+                    px.r += vg - 8 + ((b2 >> 4) & 0x0f);
+                    px.g += vg;
+                    px.b += vg - 8 + (b2 & 0x0f);
+                } else {
+                    run = b1 & 0x3f;
+                }
+                index[px.hash()] = px;
+            }
+
+            line[x * 4]     = px.r;
+            line[x * 4 + 1] = px.g;
+            line[x * 4 + 2] = px.b;
+            line[x * 4 + 3] = px.a;
+        }
+    }
+    return image;
+}
+
+}  // namespace
+
+QString thumbnailSuffix(ThumbnailCodec codec) {
+    switch (codec) {
+        case ThumbnailCodec::Raw:
+            return u"raw"_s;
+        case ThumbnailCodec::Qoi:
+            return u"qoi"_s;
+        default:
+            return u"jpg"_s;
+    }
+}
+
+QString detectThumbnailSuffix(const QByteArray& data) {
+    const auto startsWith = [&](const char* magic, qsizetype length) {
+        return data.size() >= length && std::memcmp(data.constData(), magic, length) == 0;
+    };
+    if (startsWith(s_RawMagic, sizeof(s_RawMagic)))
+        return u"raw"_s;
+    if (startsWith(s_QoiMagic, sizeof(s_QoiMagic)))
+        return u"qoi"_s;
+    if (startsWith(s_JpegMagic, sizeof(s_JpegMagic)))
+        return u"jpg"_s;
+
+    QBuffer buffer;
+    buffer.setData(data);
+    buffer.open(QIODevice::ReadOnly);
+    return QString::fromLatin1(QImageReader::imageFormat(&buffer)).toLower();
+}
+
+int thumbnailAlignment(ThumbnailCodec codec) {
+    return codec == ThumbnailCodec::Raw ? 16 : 1;
+}
+
+int thumbnailAlignment(const QString& suffix) {
+    return suffix == thumbnailSuffix(ThumbnailCodec::Raw) ? thumbnailAlignment(ThumbnailCodec::Raw) : 1;
+}
+
+bool isNativeThumbnail(const QString& fileName) {
+    return !fileName.endsWith(".raw"_L1) && !fileName.endsWith(".qoi"_L1);
+}
+
+QByteArray encodeThumbnail(const QImage& image, ThumbnailCodec codec) {
+    switch (codec) {
+        case ThumbnailCodec::Raw:
+            return encodeRaw(image);
+        case ThumbnailCodec::Qoi:
+            return encodeQoi(image);
+        default:
+            return encodeJpeg(image);
+    }
+}
+
+QImage decodeThumbnail(const uchar* data, qint64 size, std::shared_ptr<const void> owner) {
+    if (!data || size <= 0)
+        return {};
+    if (size >= s_RawHeaderSize && std::memcmp(data, s_RawMagic, sizeof(s_RawMagic)) == 0)
+        return decodeRaw(data, size, std::move(owner));
+    if (size >= s_QoiHeaderSize && std::memcmp(data, s_QoiMagic, sizeof(s_QoiMagic)) == 0)
+        return decodeQoi(data, size);
+    return QImage::fromData(data, static_cast<int>(size));
+}
+
+QImage loadThumbnail(const QString& path) {
+    auto file = std::make_shared<QFile>(path);
+    if (!file->open(QIODevice::ReadOnly)) {
+        WR_WARN(u"Cannot open cached image %1: %2"_s.arg(path, file->errorString()));
+        return {};
+    }
+    const qint64 size = file->size();
+    if (uchar* data = size > 0 ? file->map(0, size) : nullptr)
+        return decodeThumbnail(data, size, std::move(file));
+
+    const QByteArray bytes = file->readAll();
+    return decodeThumbnail(reinterpret_cast<const uchar*>(bytes.constData()), bytes.size());
+}
+
+bool isCompleteThumbnail(const QString& path) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    const qint64 size = file.size();
+    if (size <= 0)
+        return false;
+
+    const QByteArray header = file.read(s_RawHeaderSize);
+    const auto startsWith   = [&](const char* magic, qsizetype length) {
+        return header.size() >= length && std::memcmp(header.constData(), magic, length) == 0;
+    };
+    const auto trailer = [&]() {
+        const qint64 length = std::min(size, s_TrailerSearchSize);
+        return file.seek(size - length) ? file.read(length) : QByteArray{};
+    };
+
+    if (startsWith(s_RawMagic, sizeof(s_RawMagic))) {
+        if (header.size() < s_RawHeaderSize)
+            return false;
+        RawHeader raw;
+        std::memcpy(&raw, header.constData(), s_RawHeaderSize);
+        return size >= s_RawHeaderSize + qint64(raw.bytesPerLine) * raw.height;
+    }
+    if (startsWith(s_QoiMagic, sizeof(s_QoiMagic))) {
+        return size >= s_QoiHeaderSize + qint64(sizeof(s_QoiPadding)) &&
+               trailer().endsWith(QByteArrayView(s_QoiPadding, sizeof(s_QoiPadding)));
+    }
+    if (startsWith(s_JpegMagic, sizeof(s_JpegMagic)))
+        return trailer().contains(QByteArrayView(s_JpegEnd, sizeof(s_JpegEnd)));
+    if (startsWith(s_PngMagic, sizeof(s_PngMagic)))
+        return trailer().contains(QByteArrayView(s_PngEnd, sizeof(s_PngEnd)));
+    return true;
+}
+
+}  // namespace WallReel::Core::Cache
@@ -0,0 +1,112 @@
+#ifndef WALLREEL_CACHE_CODEC_HPP
+#define WALLREEL_CACHE_CODEC_HPP
+
+#include <QByteArray>
+#include <QImage>
+#include <QString>
+#include <QStringList>
+#include <memory>
+
+namespace WallReel::Core::Cache {
+
+/**
+ * @brief How thumbnails are encoded on disk.
+ */
+enum class ThumbnailCodec : int {
+    Jpeg,  // "jpeg", lossy, smallest on disk, full decode on every load
+    Raw,   // "raw", uncompressed premultiplied ARGB32, mapped and used as is
+    Qoi,   // "qoi", lossless, decodes in a single cheap pass
+};
+
+inline const QStringList s_availableThumbnailCodecs = {"jpeg", "raw", "qoi"};
+
+inline QString thumbnailCodecToString(ThumbnailCodec codec) {
+    switch (codec) {
+        case ThumbnailCodec::Raw:
+            return "raw";
+        case ThumbnailCodec::Qoi:
+            return "qoi";
+        default:
+            return "jpeg";
+    }
+}
+
+inline ThumbnailCodec stringToThumbnailCodec(const QString& str) {
+    if (str.compare("raw", Qt::CaseInsensitive) == 0) {
+        return ThumbnailCodec::Raw;
+    } else if (str.compare("qoi", Qt::CaseInsensitive) == 0) {
+        return ThumbnailCodec::Qoi;
+    } else {
+        return ThumbnailCodec::Jpeg;  // default
+    }
+}
+
+/**
+ * @brief File suffix (without the dot) of loose thumbnails written with the given codec.
+ */
+QString thumbnailSuffix(ThumbnailCodec codec);
+
+/**
+ * @brief File suffix (without the dot) matching the content of an encoded thumbnail, e.g. of a packed one.
+ *
+ * @return QString Empty if the format is not recognized
+ */
+QString detectThumbnailSuffix(const QByteArray& data);
+
+/**
+ * @brief Required alignment of the encoded data, so that raw pixels can be used in place.
+ */
+int thumbnailAlignment(ThumbnailCodec codec);
+
+/**
+ * @brief Required alignment of encoded data stored under the given suffix, see thumbnailSuffix().
+ */
+int thumbnailAlignment(const QString& suffix);
+
+/**
+ * @brief Whether a cached file can be loaded by QML directly, or has to be served by ImageProvider.
+ *
+ * @param fileName File name (not path) of the cached thumbnail
+ */
+bool isNativeThumbnail(const QString& fileName);
+
+/**
+ * @brief Encode a thumbnail.
+ *
+ * @return QByteArray Empty on failure
+ */
+QByteArray encodeThumbnail(const QImage& image, ThumbnailCodec codec);
+
+/**
+ * @brief Decode a thumbnail written by encodeThumbnail(), or any format QImage can read.
+ *
+ * @details Raw thumbnails are not copied: the returned image points into data and keeps owner alive
+ * for as long as it (or any shallow copy of it) exists. Without an owner the pixels are copied.
+ *
+ * @param data Encoded bytes
+ * @param size Number of encoded bytes
+ * @param owner Whatever keeps data valid, e.g. the file data is mapped from
+ * @return QImage Null if the data cannot be decoded
+ */
+QImage decodeThumbnail(const uchar* data, qint64 size, std::shared_ptr<const void> owner = {});
+
+/**
+ * @brief Load a loose thumbnail file, mapping it instead of reading it where possible.
+ *
+ * @return QImage Null if the file cannot be read or decoded
+ */
+QImage loadThumbnail(const QString& path);
+
+/**
+ * @brief Cheap check whether a thumbnail file has been written completely, without decoding it.
+ *
+ * @details Compares the size declared in the header of raw thumbnails with the file size, and looks for
+ * the end markers of QOI, JPEG and PNG files. Files in other formats only have to be non-empty.
+ *
+ * @return bool false for empty and truncated files
+ */
+bool isCompleteThumbnail(const QString& path);
+
+}  // namespace WallReel::Core::Cache
+
+#endif  // WALLREEL_CACHE_CODEC_HPP
@@ -0,0 +1,83 @@
+#include "durability.hpp"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QTemporaryFile>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "logger.hpp"
+
+WALLREEL_DECLARE_SENDER("CacheDurability")
+
+using namespace Qt::StringLiterals;
+
+namespace WallReel::Core::Cache {
+
+namespace {
+
+// Temporary files are hidden, so that directory listings of the cache never see them,
+// and named after their target: ".<file name>.XXXXXX"
+constexpr qsizetype s_TemporarySuffixSize = 7;
+
+}  // namespace
+
+bool syncFile(QFileDevice& file) {
+    if (!file.flush() || ::fdatasync(file.handle()) != 0) {
+        WR_WARN(u"Failed to sync %1: %2"_s.arg(file.fileName(), QString::fromLocal8Bit(std::strerror(errno))));
+        return false;
+    }
+    return true;
+}
+
+bool syncDirectory(const QString& path) {
+    const int fd = ::open(QFile::encodeName(path).constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        WR_WARN(u"Failed to open directory %1 for syncing: %2"_s.arg(path, QString::fromLocal8Bit(std::strerror(errno))));
+        return false;
+    }
+    const bool ok = ::fsync(fd) == 0;
+    if (!ok)
+        WR_WARN(u"Failed to sync directory %1: %2"_s.arg(path, QString::fromLocal8Bit(std::strerror(errno))));
+    ::close(fd);
+    return ok;
+}
+
+bool isTemporaryFile(const QString& fileName) {
+    return fileName.startsWith(u'.') &&
+           fileName.size() > s_TemporarySuffixSize + 1 &&
+           fileName.at(fileName.size() - s_TemporarySuffixSize) == u'.';
+}
+
+bool writeFileAtomically(const QString& path, const QByteArray& data, Durability durability, QString* error) {
+    const QFileInfo target(path);
+    QTemporaryFile file(target.dir().filePath(u".%1.XXXXXX"_s.arg(target.fileName())));
+    const auto fail = [&](const QString& reason) {
+        if (error)
+            *error = reason;
+        return false;
+    };
+
+    if (!file.open())
+        return fail(file.errorString());
+    // QTemporaryFile is private to the owner, thumbnails are not
+    file.setPermissions(QFile::ReadOwner | QFile::WriteOwner | QFile::ReadGroup | QFile::ReadOther);
+    if (file.write(data) != data.size() || !file.flush())
+        return fail(file.errorString());
+    if (durability != Durability::Off && !syncFile(file))
+        return fail(u"sync failed"_s);
+
+    // Unlike QFile::rename(), rename(2) atomically replaces an existing file
+    if (::rename(QFile::encodeName(file.fileName()).constData(), QFile::encodeName(path).constData()) != 0)
+        return fail(QString::fromLocal8Bit(std::strerror(errno)));
+    // Renamed away, nothing left to remove
+    file.setAutoRemove(false);
+
+    if (durability == Durability::Full)
+        syncDirectory(target.absolutePath());
+    return true;
+}
+
+}  // namespace WallReel::Core::Cache
@@ -0,0 +1,83 @@
+#ifndef WALLREEL_CACHE_DURABILITY_HPP
+#define WALLREEL_CACHE_DURABILITY_HPP
+
+#include <QByteArray>
+#include <QFileDevice>
+#include <QString>
+#include <QStringList>
+
+namespace WallReel::Core::Cache {
+
+/**
+ * @brief How hard cache writes try to survive a crash or power loss.
+ *
+ * @details Thumbnails are always written to a temporary file and renamed into place, so that a killed
+ * process never leaves a partially written thumbnail behind. The levels only differ in what is flushed
+ * to the disk before the file becomes visible.
+ */
+enum class Durability : int {
+    Off,     // "off", nothing is synced, a power loss may leave empty or truncated thumbnails behind
+    Normal,  // "normal", thumbnails are synced before they are renamed into place and recorded
+    Full,    // "full", the cache directory and every database commit are synced as well
+};
+
+inline const QStringList s_availableDurabilities = {"off", "normal", "full"};
+
+inline QString durabilityToString(Durability durability) {
+    switch (durability) {
+        case Durability::Off:
+            return "off";
+        case Durability::Full:
+            return "full";
+        default:
+            return "normal";
+    }
+}
+
+inline Durability stringToDurability(const QString& str) {
+    if (str.compare("off", Qt::CaseInsensitive) == 0) {
+        return Durability::Off;
+    } else if (str.compare("full", Qt::CaseInsensitive) == 0) {
+        return Durability::Full;
+    } else {
+        return Durability::Normal;  // default
+    }
+}
+
+/**
+ * @brief The PRAGMA statement selecting the matching SQLite synchronous mode.
+ *        NORMAL is already crash safe in WAL mode, FULL also survives a power loss.
+ */
+inline QString synchronousPragma(Durability durability) {
+    return durability == Durability::Full ? "PRAGMA synchronous=FULL" : "PRAGMA synchronous=NORMAL";
+}
+
+/**
+ * @brief Flush the data of an open file to the disk.
+ */
+bool syncFile(QFileDevice& file);
+
+/**
+ * @brief Flush a directory to the disk, so that files created or renamed in it survive a power loss.
+ */
+bool syncDirectory(const QString& path);
+
+/**
+ * @brief Whether a file name belongs to a temporary file left behind by writeFileAtomically().
+ */
+bool isTemporaryFile(const QString& fileName);
+
+/**
+ * @brief Write a file through a temporary file next to it, renamed over path once complete.
+ *
+ * @param path Final path, replaced if it exists
+ * @param data
+ * @param durability What is synced before and after the rename
+ * @param error Set to the reason on failure
+ * @return bool Whether path now holds data, on failure path is left untouched
+ */
+bool writeFileAtomically(const QString& path, const QByteArray& data, Durability durability, QString* error = nullptr);
+
+}  // namespace WallReel::Core::Cache
+
+#endif  // WALLREEL_CACHE_DURABILITY_HPP
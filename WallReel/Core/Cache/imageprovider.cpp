@@ -0,0 +1,22 @@
+#include "imageprovider.hpp"
+
+#include "manager.hpp"
+
+namespace WallReel::Core::Cache {
+
+ImageProvider::ImageProvider(Manager& cacheMgr)
+    : QQuickImageProvider(QQuickImageProvider::Image),
+      m_cacheMgr(cacheMgr) {}
+
+QImage ImageProvider::requestImage(const QString& id, QSize* size, const QSize& requestedSize) {
+    bool ok       = false;
+    const Key key = stringToKey(id, &ok);
+    QImage image  = ok ? m_cacheMgr.loadImage(key) : QImage();
+    if (size)
+        *size = image.size();
+    if (!image.isNull() && requestedSize.isValid() && requestedSize != image.size())
+        image = image.scaled(requestedSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    return image;
+}
+
+}  // namespace WallReel::Core::Cache
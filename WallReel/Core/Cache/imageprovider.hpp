@@ -0,0 +1,30 @@
+#ifndef WALLREEL_CACHE_IMAGEPROVIDER_HPP
+#define WALLREEL_CACHE_IMAGEPROVIDER_HPP
+
+#include <QQuickImageProvider>
+
+namespace WallReel::Core::Cache {
+
+class Manager;
+
+/**
+ * @brief Serves thumbnails that do not live in a file of their own (e.g. pack segments) to QML
+ *
+ * @details Registered under s_ProviderId, urls look like image://wallreel/<cache key>,
+ * see Manager::imageUrl().
+ */
+class ImageProvider : public QQuickImageProvider {
+  public:
+    static constexpr const char* s_ProviderId = "wallreel";
+
+    explicit ImageProvider(Manager& cacheMgr);
+
+    QImage requestImage(const QString& id, QSize* size, const QSize& requestedSize) override;
+
+  private:
+    Manager& m_cacheMgr;
+};
+
+}  // namespace WallReel::Core::Cache
+
+#endif  // WALLREEL_CACHE_IMAGEPROVIDER_HPP
@@ -0,0 +1,136 @@
+#include "info.hpp"
+
+#include <QJsonArray>
+#include <limits>
+
+using namespace Qt::StringLiterals;
+
+namespace WallReel::Core::Cache {
+
+namespace {
+
+constexpr qint64 s_KiB  = 1024;
+constexpr qint64 s_Day  = 24 * 60 * 60;
+constexpr qint64 s_Last = std::numeric_limits<qint64>::max();
+
+QString formatBytes(qint64 bytes) {
+    if (bytes < s_KiB)
+        return u"%1 B"_s.arg(bytes);
+    if (bytes < s_KiB * s_KiB)
+        return u"%1 KiB"_s.arg(bytes / double(s_KiB), 0, 'f', 1);
+    if (bytes < s_KiB * s_KiB * s_KiB)
+        return u"%1 MiB"_s.arg(bytes / double(s_KiB * s_KiB), 0, 'f', 1);
+    return u"%1 GiB"_s.arg(bytes / double(s_KiB * s_KiB * s_KiB), 0, 'f', 2);
+}
+
+void count(QList<Info::Bucket>& buckets, qint64 value) {
+    for (auto& bucket : buckets) {
+        if (value < bucket.upperBound) {
+            ++bucket.count;
+            return;
+        }
+    }
+}
+
+QJsonArray bucketsToJson(const QList<Info::Bucket>& buckets) {
+    QJsonArray array;
+    for (const auto& bucket : buckets) {
+        array.append(QJsonObject{
+            {u"label"_s, bucket.label},
+            {u"count"_s, bucket.count},
+        });
+    }
+    return array;
+}
+
+}  // namespace
+
+Info::Info()
+    : sizes{
+          {u"< 16 KiB"_s, 16 * s_KiB},
+          {u"16-64 KiB"_s, 64 * s_KiB},
+          {u"64-256 KiB"_s, 256 * s_KiB},
+          {u"256 KiB-1 MiB"_s, 1024 * s_KiB},
+          {u">= 1 MiB"_s, s_Last},
+      },
+      ages{
+          {u"< 1 day"_s, s_Day},
+          {u"1-7 days"_s, 7 * s_Day},
+          {u"7-30 days"_s, 30 * s_Day},
+          {u"30-90 days"_s, 90 * s_Day},
+          {u">= 90 days"_s, s_Last},
+          {u"never"_s, s_Last},
+      } {}
+
+void Info::countSize(qint64 bytes) {
+    count(sizes, bytes);
+}
+
+void Info::countAge(qint64 seconds) {
+    if (seconds < 0) {
+        ++ages.last().count;
+        return;
+    }
+    count(ages, seconds);
+}
+
+QJsonObject Info::toJson() const {
+    return QJsonObject{
+        {u"directory"_s, directory},
+        {u"entries"_s, QJsonObject{
+                           {u"images"_s, imageEntries},
+                           {u"colors"_s, colorEntries},
+                           {u"settings"_s, settingEntries},
+                           {u"failed"_s, failedEntries},
+                       }},
+        {u"bytes"_s, QJsonObject{
+                         {u"total"_s, totalBytes},
+                         {u"thumbnails"_s, thumbnailBytes},
+                         {u"database"_s, databaseBytes},
+                     }},
+        {u"thumbnailFiles"_s, thumbnailFiles},
+        {u"staleRows"_s, staleRows},
+        {u"orphans"_s, QJsonObject{
+                           {u"files"_s, orphanFiles},
+                           {u"bytes"_s, orphanBytes},
+                       }},
+        {u"hitRatio"_s, QJsonObject{
+                            {u"wallpapers"_s, wallpapers},
+                            {u"hits"_s, hits},
+                            {u"ratio"_s, hitRatio()},
+                        }},
+        {u"thumbnailSizes"_s, bucketsToJson(sizes)},
+        {u"lastAccessed"_s, bucketsToJson(ages)},
+    };
+}
+
+QString Info::toText() const {
+    QString text;
+    text += u"Cache directory:     %1\n"_s.arg(directory);
+    text += u"Entries:             %1 image(s), %2 color(s), %3 setting(s), %4 failed image(s)\n"_s
+                .arg(imageEntries)
+                .arg(colorEntries)
+                .arg(settingEntries)
+                .arg(failedEntries);
+    text += u"Disk usage:          %1 in total, %2 in %3 thumbnail(s), %4 of database\n"_s
+                .arg(formatBytes(totalBytes), formatBytes(thumbnailBytes))
+                .arg(thumbnailFiles)
+                .arg(formatBytes(databaseBytes));
+    text += u"Stale rows:          %1\n"_s.arg(staleRows);
+    text += u"Orphaned files:      %1 (%2)\n"_s.arg(orphanFiles).arg(formatBytes(orphanBytes));
+    text += u"Estimated hit ratio: %1% (%2 of %3 wallpaper(s) cached)\n"_s
+                .arg(hitRatio() * 100, 0, 'f', 1)
+                .arg(hits)
+                .arg(wallpapers);
+
+    const auto appendBuckets = [&](const QString& title, const QList<Bucket>& buckets) {
+        text += u"\n%1:\n"_s.arg(title);
+        for (const auto& bucket : buckets)
+            text += u"  %1 %2\n"_s.arg(bucket.label, -16).arg(bucket.count);
+    };
+    appendBuckets(u"Thumbnail sizes"_s, sizes);
+    appendBuckets(u"Last accessed"_s, ages);
+    return text;
+}
+
+}  // namespace WallReel::Core::Cache
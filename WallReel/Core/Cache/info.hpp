@@ -0,0 +1,63 @@
+#ifndef WALLREEL_CACHE_INFO_HPP
+#define WALLREEL_CACHE_INFO_HPP
+
+#include <QJsonObject>
+#include <QList>
+#include <QString>
+
+namespace WallReel::Core::Cache {
+
+/**
+ * @brief Snapshot of the contents and health of the cache, see Manager::info().
+ */
+struct Info {
+    struct Bucket {
+        QString label;
+        qint64 upperBound;  ///< Exclusive, in bytes or seconds
+        qint64 count = 0;
+    };
+
+    QString directory;
+
+    qint64 imageEntries   = 0;
+    qint64 colorEntries   = 0;
+    qint64 settingEntries = 0;
+    qint64 failedEntries  = 0;
+
+    qint64 thumbnailFiles = 0;  ///< Distinct thumbnails, those shared between copies count once
+    qint64 thumbnailBytes = 0;  ///< Bytes of distinct thumbnails
+    qint64 databaseBytes  = 0;  ///< cache.db together with its WAL
+    qint64 totalBytes     = 0;  ///< Everything in the cache directory
+
+    qint64 staleRows   = 0;  ///< Rows whose file is missing
+    qint64 orphanFiles = 0;  ///< Loose thumbnails no row refers to
+    qint64 orphanBytes = 0;
+
+    qint64 wallpapers = 0;  ///< Wallpapers the hit ratio was estimated against
+    qint64 hits       = 0;  ///< Of which both thumbnail and color are cached under their current key
+
+    QList<Bucket> sizes;  ///< Distribution of thumbnail sizes
+    QList<Bucket> ages;   ///< Distribution of the time since images were last accessed, the last bucket is never
+
+    Info();
+
+    void countSize(qint64 bytes);
+
+    /**
+     * @param seconds Time since the last access, negative if never accessed
+     */
+    void countAge(qint64 seconds);
+
+    double hitRatio() const { return wallpapers > 0 ? double(hits) / wallpapers : 0.0; }
+
+    QJsonObject toJson() const;
+
+    /**
+     * @brief Human readable multi-line report
+     */
+    QString toText() const;
+};
+
+}  // namespace WallReel::Core::Cache
+
+#endif  // WALLREEL_CACHE_INFO_HPP
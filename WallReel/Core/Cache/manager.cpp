@@ -1,14 +1,31 @@
 #include "manager.hpp"
 
+#include <QCoreApplication>
 #include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
 #include <QFile>
 #include <QImage>
+#include <QLockFile>
 #include <QMutexLocker>
+#include <QReadLocker>
+#include <QSaveFile>
 #include <QSqlError>
 #include <QSqlQuery>
+#include <QSqlRecord>
 #include <QThread>
+#include <QUrl>
+#include <QWriteLocker>
 #include <QtConcurrent>
+#include <algorithm>
+#include <cerrno>
+#include <signal.h>
+#include <sys/stat.h>
 
+#include "claim.hpp"
+#include "codec.hpp"
+#include "imageprovider.hpp"
+#include "Utils/hash.hpp"
 #include "logger.hpp"
 
 WALLREEL_DECLARE_SENDER("CacheManager")
@@ -22,37 +39,193 @@ static QLatin1StringView settingKey(SettingsType type) {
         case SettingsType::LastSelectedPalette: return "last_selected_palette"_L1;
         case SettingsType::LastSortType: return "last_sort_type"_L1;
         case SettingsType::LastSortDescending: return "last_sort_descending"_L1;
+        case SettingsType::ThumbnailsVerifiedAt: return "thumbnails_verified_at"_L1;
     }
     Q_UNREACHABLE();
 }
 
-QString Manager::cacheKey(const QFileInfo& fileInfo, const QSize& imageSize) {
-    const QString raw = fileInfo.absoluteFilePath() +
-                        QString::number(fileInfo.lastModified().toMSecsSinceEpoch()) +
-                        u'x' + QString::number(imageSize.width()) +
-                        u'x' + QString::number(imageSize.height());
-    return QString::fromLatin1(
-        QCryptographicHash::hash(raw.toUtf8(), QCryptographicHash::Sha256).toHex());
+/// Reads the pack_segment, pack_offset, pack_length columns starting at pos.
+static PackLocation packLocation(const QSqlQuery& query, int pos) {
+    if (query.isNull(pos))
+        return {};
+    return {query.value(pos).toInt(),
+            query.value(pos + 1).toLongLong(),
+            query.value(pos + 2).toLongLong()};
 }
 
-Manager::Manager(const QDir& cacheDir, int maxEntries)
+/// Keys are stored as signed 64-bit integers.
+static QVariant keyValue(Key key) {
+    return static_cast<qint64>(key);
+}
+
+static Key keyAt(const QSqlQuery& query, int pos) {
+    return static_cast<Key>(query.value(pos).toLongLong());
+}
+
+/// Runs sql once per chunk of values, with its lowest placeholder replaced by the chunk as a comma separated list,
+/// and hands every row to onRow. The values are inlined instead of bound, no chunk runs into the limit on host parameters.
+static bool queryChunked(QSqlDatabase& db, const QString& sql, const QList<qint64>& values, qsizetype chunkSize,
+                         const std::function<void(const QSqlQuery&)>& onRow) {
+    for (qsizetype begin = 0; begin < values.size(); begin += chunkSize) {
+        QStringList chunk;
+        for (qsizetype i = begin; i < std::min(values.size(), begin + chunkSize); ++i)
+            chunk.append(QString::number(values[i]));
+        QSqlQuery query(db);
+        query.setForwardOnly(true);
+        if (!query.exec(sql.arg(chunk.join(u',')))) {
+            WR_WARN(u"Cache query failed: %1"_s.arg(query.lastError().text()));
+            return false;
+        }
+        while (query.next())
+            onRow(query);
+    }
+    return true;
+}
+
+/// Whether pid is a running instance of this program. Compares the process names as well,
+/// so that a crashed instance whose pid has been reused is not mistaken for a live one.
+static bool isInstanceAlive(qint64 pid) {
+    if (pid == QCoreApplication::applicationPid())
+        return true;
+    if (::kill(static_cast<pid_t>(pid), 0) != 0 && errno != EPERM)
+        return false;
+    QFile self(u"/proc/self/comm"_s), other(u"/proc/%1/comm"_s.arg(pid));
+    if (!self.open(QIODevice::ReadOnly) || !other.open(QIODevice::ReadOnly))
+        return true;
+    return self.readAll() == other.readAll();
+}
+
+/// Loose thumbnails are named after their key, see Manager::getImage().
+static bool isLooseThumbnail(const QString& fileName) {
+    bool ok = false;
+    if (fileName.indexOf(u'.') == 16)
+        stringToKey(fileName.left(16), &ok);
+    return ok;
+}
+
+Source Manager::identify(const QFileInfo& fileInfo, const QSize& imageSize) {
+    return identify(fileInfo, QList<QSize>{imageSize}).first();
+}
+
+QList<Source> Manager::identify(const QFileInfo& fileInfo, const QList<QSize>& imageSizes) {
+    Source source{.path = fileInfo.absoluteFilePath()};
+
+    // Device and inode stay the same when a file is renamed or moved within a file system,
+    // so do size and mtime, which change whenever the content does.
+    struct stat st;
+    quint64 device = 0, inode = 0;
+    if (::stat(QFile::encodeName(source.path).constData(), &st) == 0) {
+        device         = st.st_dev;
+        inode          = st.st_ino;
+        source.size    = st.st_size;
+        source.mtimeNs = qint64(st.st_mtim.tv_sec) * 1'000'000'000 + st.st_mtim.tv_nsec;
+    } else {
+        // Unreadable anyway, only has to be unique
+        inode = qHash(source.path);
+    }
+    // The dominant color hardly depends on the thumbnail size, it survives style changes
+    source.colorKey = Utils::hash64({device, inode, quint64(source.size), quint64(source.mtimeNs)});
+
+    QList<Source> sources;
+    sources.reserve(imageSizes.size());
+    for (const QSize& imageSize : imageSizes) {
+        source.thumbnailSize = imageSize;
+        source.key           = Utils::hash64({device,
+                                              inode,
+                                              quint64(source.size),
+                                              quint64(source.mtimeNs),
+                                              quint64(imageSize.width()),
+                                              quint64(imageSize.height())});
+        sources.append(source);
+    }
+    return sources;
+}
+
+quint64 Manager::fingerprint(const QString& path) const {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        WR_WARN(u"Cannot fingerprint %1: %2"_s.arg(path, file.errorString()));
+        return 0;
+    }
+    const qint64 size = file.size();
+
+    // Hash the size first, so that files only differing beyond the sampled ranges at least differ in size
+    quint64 hash    = Utils::hash64({quint64(size)});
+    const auto feed = [&](qint64 offset, qint64 length) {
+        if (uchar* data = file.map(offset, length)) {
+            hash = Utils::hashBytes(data, length, hash);
+            file.unmap(data);
+            return true;
+        }
+        // Not mappable (e.g. some network file systems)
+        if (!file.seek(offset))
+            return false;
+        const QByteArray bytes = file.read(length);
+        hash                   = Utils::hashBytes(bytes.constData(), bytes.size(), hash);
+        return bytes.size() == length;
+    };
+
+    bool ok;
+    if (m_options.fullContentHash || size <= 3 * s_FingerprintSampleSize) {
+        ok = size == 0 || feed(0, size);
+    } else {
+        ok = feed(0, s_FingerprintSampleSize) &&
+             feed((size - s_FingerprintSampleSize) / 2, s_FingerprintSampleSize) &&
+             feed(size - s_FingerprintSampleSize, s_FingerprintSampleSize);
+    }
+    if (!ok) {
+        WR_WARN(u"Failed to read %1 for fingerprinting"_s.arg(path));
+        return 0;
+    }
+    // 0 is reserved for unknown
+    return hash ? hash : 1;
+}
+
+Manager::Manager(const QDir& cacheDir, const Options& options)
     : m_cacheDir(cacheDir),
-      m_maxEntries(maxEntries),
+      m_options(options),
       m_dbPath(cacheDir.filePath(u"cache.db"_s)),
       m_connectionPrefix(u"WallReelCache:"_s +
                          QString::fromLatin1(QCryptographicHash::hash(
                                                  m_dbPath.toUtf8(),
                                                  QCryptographicHash::Md5)
-                                                 .toHex())) {
+                                                 .toHex())),
+      m_sessionStart(QDateTime::currentSecsSinceEpoch()) {
     WR_DEBUG(u"Initializing cache db: %1"_s.arg(m_dbPath));
+    // The shared layer is only read, and only if somebody has populated it
+    if (const QDir shared(m_options.sharedDir);
+        !m_options.sharedDir.isEmpty() && shared.exists(u"cache.db"_s) && shared != m_cacheDir) {
+        WR_DEBUG(u"Using shared cache %1"_s.arg(shared.absolutePath()));
+        m_sharedPack = std::make_unique<Pack>(shared, Durability::Off);
+    }
+
+    // Inspected as it is, without announcing this process or touching the schema
+    if (m_options.readOnly) {
+        m_pack = std::make_unique<Pack>(m_cacheDir, m_options.durability);
+        return;
+    }
+
     // Open a connection on the constructing thread so the schema is
     // guaranteed to exist before any worker thread first calls _db().
-    _db();
+    QSqlDatabase db = _db();
+    if (db.isOpen()) {
+        _setupTables(db);
+        // Announce this process, so that cleanup in other processes leaves what it uses alone
+        QSqlQuery q(db);
+        q.prepare(u"INSERT OR REPLACE INTO cache_sessions (pid, started_at) VALUES (:pid, :startedAt)"_s);
+        q.bindValue(u":pid"_s, QCoreApplication::applicationPid());
+        q.bindValue(u":startedAt"_s, m_sessionStart);
+        if (!q.exec())
+            WR_WARN(u"Failed to register cache session: %1"_s.arg(q.lastError().text()));
+    }
+    m_writer = std::make_unique<Writer>(m_dbPath, m_connectionPrefix + u":writer"_s, m_options.durability);
+    // Always available for reading, entries may have been packed in a previous run
+    m_pack = std::make_unique<Pack>(m_cacheDir, m_options.durability);
 }
 
 void Manager::evictOldEntries() {
-    if (m_maxEntries > 0)
-        m_cleanupFuture = QtConcurrent::run([this] { _runCleanup(); });
+    // Always run, thumbnails an interrupted run left behind are checked even without limits
+    m_cleanupFuture = QtConcurrent::run([this] { _runCleanup(); });
 }
 
 Manager::~Manager() {
@@ -61,6 +234,19 @@ Manager::~Manager() {
         WR_DEBUG(u"Waiting for cache cleanup to finish..."_s);
         m_cleanupFuture.waitForFinished();
     }
+    // Asynchronous requests still running write through m_writer
+    m_imageFlights.waitForPending();
+    m_colorFlights.waitForPending();
+
+    // Flush pending writes and stop the writer thread.
+    m_writer.reset();
+
+    if (QSqlDatabase db = _db(); db.isOpen() && !m_options.readOnly) {
+        QSqlQuery q(db);
+        q.prepare(u"DELETE FROM cache_sessions WHERE pid = :pid"_s);
+        q.bindValue(u":pid"_s, QCoreApplication::applicationPid());
+        q.exec();
+    }
 
     QSet<QString> names;
     {
@@ -71,14 +257,29 @@ Manager::~Manager() {
     for (const QString& connName : std::as_const(names)) {
         QSqlDatabase::removeDatabase(connName);
     }
+
+    // Readers without write access to the directory cannot use the WAL, leave a shared cache in rollback mode
+    if (m_options.shareable) {
+        const QString connName = m_connectionPrefix + u":shareable"_s;
+        {
+            QSqlDatabase db = QSqlDatabase::addDatabase(u"QSQLITE"_s, connName);
+            db.setDatabaseName(m_dbPath);
+            if (db.open() && !QSqlQuery(db).exec(u"PRAGMA journal_mode=DELETE"_s))
+                WR_WARN(u"Failed to switch %1 to rollback journal mode"_s.arg(m_dbPath));
+        }
+        QSqlDatabase::removeDatabase(connName);
+    }
 }
 
 void Manager::clearCache(Type type) {
+    m_writer->flush();
+
     QSqlDatabase db = _db();
     if (!db.isOpen())
         return;
 
     if ((type & Type::Image) != Type::None) {
+        QDir(m_cacheDir.filePath(s_QuarantineDir)).removeRecursively();
         int removed = 0;
         QSqlQuery selectQuery(db);
         if (selectQuery.exec(u"SELECT file_name FROM image_cache"_s)) {
@@ -88,11 +289,14 @@ void Manager::clearCache(Type type) {
             }
         }
         QSqlQuery(db).exec(u"DELETE FROM image_cache"_s);
+        m_imageFlights.clear();
         WR_INFO(u"Cleared %1 image cache file(s)"_s.arg(removed));
     }
 
     if ((type & Type::Color) != Type::None) {
         QSqlQuery(db).exec(u"DELETE FROM color_cache"_s);
+        QSqlQuery(db).exec(u"DELETE FROM palette_match"_s);
+        m_colorFlights.clear();
         WR_INFO(u"Cleared color cache"_s);
     }
 
@@ -100,18 +304,103 @@ void Manager::clearCache(Type type) {
         QSqlQuery(db).exec(u"DELETE FROM settings_cache"_s);
         WR_INFO(u"Cleared settings cache"_s);
     }
+
+    if ((type & Type::Failure) != Type::None) {
+        QSqlQuery(db).exec(u"DELETE FROM failed_cache"_s);
+        WR_INFO(u"Cleared records of images that failed to load"_s);
+    }
+}
+
+Colors Manager::getColor(const Source& source, const std::function<Colors()>& computeFunc) {
+    return m_colorFlights.run(source.colorKey, [&] { return _resolveColor(source, computeFunc); });
 }
 
-QColor Manager::getColor(const QString& key, const std::function<QColor()>& computeFunc) {
+QList<QColor> Manager::getPalette(Key colorKey, const std::function<QList<QColor>()>& computeFunc) {
     QSqlDatabase db = _db();
     if (db.isOpen()) {
         QSqlQuery query(db);
-        query.prepare(u"SELECT r, g, b, a FROM color_cache WHERE key = :key"_s);
-        query.bindValue(u":key"_s, key);
+        query.prepare(u"SELECT palette FROM color_cache WHERE key = :key AND palette IS NOT NULL"_s);
+        query.bindValue(u":key"_s, keyValue(colorKey));
+        if (query.exec() && query.next()) {
+            WR_DEBUG(u"Palette cache hit [%1]"_s.arg(keyToString(colorKey)));
+            return stringToPalette(query.value(0).toString());
+        }
+    }
+
+    WR_DEBUG(u"Palette cache miss [%1], computing"_s.arg(keyToString(colorKey)));
+    if (!computeFunc) {
+        WR_WARN(u"No compute function provided for palette cache miss [%1]"_s.arg(keyToString(colorKey)));
+        return {};
+    }
+    const QList<QColor> palette = computeFunc();
+    storePalette(colorKey, palette);
+    return palette;
+}
+
+void Manager::storePalette(Key colorKey, const QList<QColor>& palette) {
+    if (palette.isEmpty())
+        return;
+    m_writer->enqueue({.kind = Writer::Op::Kind::StorePalette, .key = colorKey, .palette = palette});
+}
+
+QHash<Key, QString> Manager::paletteMatches(quint64 paletteHash) {
+    QHash<Key, QString> result;
+    QSqlDatabase db = _db();
+    if (!db.isOpen())
+        return result;
+
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    query.prepare(u"SELECT color_key, color_name FROM palette_match WHERE palette_hash = :hash"_s);
+    query.bindValue(u":hash"_s, static_cast<qint64>(paletteHash));
+    if (!query.exec()) {
+        WR_WARN(u"Failed to load palette matches: %1"_s.arg(query.lastError().text()));
+        return result;
+    }
+    while (query.next())
+        result.insert(keyAt(query, 0), query.value(1).toString());
+    WR_DEBUG(u"Loaded %1 palette match(es) [%2]"_s.arg(result.size()).arg(keyToString(paletteHash)));
+    return result;
+}
+
+void Manager::storePaletteMatches(quint64 paletteHash, const QHash<Key, QString>& matches) {
+    for (auto it = matches.cbegin(); it != matches.cend(); ++it) {
+        m_writer->enqueue({.kind        = Writer::Op::Kind::InsertMatch,
+                           .key         = it.key(),
+                           .paletteHash = paletteHash,
+                           .colorName   = it.value()});
+    }
+}
+
+QFileInfo Manager::getImage(const Source& source, const std::function<Thumbnail()>& computeFunc) {
+    return m_imageFlights.run(source.key, [&] { return _resolveImage(source, computeFunc); });
+}
+
+QFuture<Colors> Manager::requestColor(const Source& source, std::function<Colors()> computeFunc) {
+    return m_colorFlights.runAsync(source.colorKey, [this, source, computeFunc = std::move(computeFunc)] {
+        return _resolveColor(source, computeFunc);
+    });
+}
+
+QFuture<QFileInfo> Manager::requestImage(const Source& source, std::function<Thumbnail()> computeFunc) {
+    return m_imageFlights.runAsync(source.key, [this, source, computeFunc = std::move(computeFunc)] {
+        return _resolveImage(source, computeFunc);
+    });
+}
+
+Colors Manager::_resolveColor(const Source& source, const std::function<Colors()>& computeFunc) {
+    const Key key   = source.colorKey;
+    QSqlDatabase db = _db();
+    if (db.isOpen()) {
+        QSqlQuery query(db);
+        query.prepare(u"SELECT r, g, b, a, palette FROM color_cache WHERE key = :key"_s);
+        query.bindValue(u":key"_s, keyValue(key));
 
         if (query.exec() && query.next()) {
-            WR_DEBUG(u"Color cache hit [%1]"_s.arg(key));
-            QColor result(
+            WR_DEBUG(u"Color cache hit [%1]"_s.arg(keyToString(key)));
+            Colors result;
+            result.palette  = stringToPalette(query.value(4).toString());
+            result.dominant = QColor(
                 query.value(0).toInt(),
                 query.value(1).toInt(),
                 query.value(2).toInt(),
@@ -120,117 +409,834 @@ QColor Manager::getColor(const QString& key, const std::function<QColor()>& comp
                 QMutexLocker lk(&m_hotKeysMutex);
                 m_hotColorKeys.insert(key);
             }
-            QSqlQuery touchQuery(db);
-            touchQuery.prepare(u"UPDATE color_cache SET last_accessed = CURRENT_TIMESTAMP WHERE key = :key"_s);
-            touchQuery.bindValue(u":key"_s, key);
-            touchQuery.exec();
+            m_writer->enqueue({.kind = Writer::Op::Kind::TouchColor, .key = key});
             return result;
         }
     }
 
-    WR_DEBUG(u"Color cache miss [%1], computing"_s.arg(key));
+    // Identical content cached under another path, or in the shared layer
+    const QStringList schemas = m_sharedPack ? QStringList{u"main"_s, s_SharedSchema} : QStringList{u"main"_s};
+    for (const QString& schema : schemas) {
+        if (source.fingerprint == 0 || !db.isOpen())
+            break;
+        // c.* because a shared cache written by an older version has no palette column
+        QSqlQuery query(db);
+        query.prepare(
+            u"SELECT c.* FROM %1.image_cache i JOIN %1.color_cache c ON c.key = i.color_key "
+            "WHERE i.fingerprint = :fingerprint LIMIT 1"_s.arg(schema));
+        query.bindValue(u":fingerprint"_s, static_cast<qint64>(source.fingerprint));
+        if (query.exec() && query.next()) {
+            WR_DEBUG(u"Color cache hit by content [%1] in %2"_s.arg(keyToString(key), schema));
+            Colors result;
+            result.dominant = QColor(
+                query.value(u"r"_s).toInt(),
+                query.value(u"g"_s).toInt(),
+                query.value(u"b"_s).toInt(),
+                query.value(u"a"_s).toInt());
+            if (const int palette = query.record().indexOf(u"palette"_s); palette >= 0)
+                result.palette = stringToPalette(query.value(palette).toString());
+            {
+                QMutexLocker lk(&m_hotKeysMutex);
+                m_hotColorKeys.insert(key);
+            }
+            m_writer->enqueue({.kind    = Writer::Op::Kind::InsertColor,
+                               .key     = key,
+                               .color   = result.dominant,
+                               .palette = result.palette});
+            return result;
+        }
+    }
+
+    WR_DEBUG(u"Color cache miss [%1], computing"_s.arg(keyToString(key)));
     if (!computeFunc) {
-        WR_WARN(u"No compute function provided for color cache miss [%1]"_s.arg(key));
-        return QColor();
+        WR_WARN(u"No compute function provided for color cache miss [%1]"_s.arg(keyToString(key)));
+        return {};
     }
 
-    const QColor color = computeFunc();
+    const Colors colors = computeFunc();
 
-    if (!color.isValid()) {
-        WR_WARN(u"ComputeFunc returned invalid color for key [%1]"_s.arg(key));
-        return color;
+    if (!colors.dominant.isValid()) {
+        WR_WARN(u"ComputeFunc returned invalid color for key [%1]"_s.arg(keyToString(key)));
+        return colors;
     }
 
-    if (db.isOpen()) {
-        QSqlQuery insertQuery(db);
-        insertQuery.prepare(
-            u"INSERT OR REPLACE INTO color_cache (key, r, g, b, a, last_accessed) "
-            "VALUES (:key, :r, :g, :b, :a, CURRENT_TIMESTAMP)"_s);
-        insertQuery.bindValue(u":key"_s, key);
-        insertQuery.bindValue(u":r"_s, color.red());
-        insertQuery.bindValue(u":g"_s, color.green());
-        insertQuery.bindValue(u":b"_s, color.blue());
-        insertQuery.bindValue(u":a"_s, color.alpha());
-        if (!insertQuery.exec())
-            WR_WARN(u"Failed to cache color [%1]: %2"_s
-                        .arg(key, insertQuery.lastError().text()));
-        else
-            WR_DEBUG(u"Color cached [%1]"_s.arg(key));
+    {
+        QMutexLocker lk(&m_hotKeysMutex);
+        m_hotColorKeys.insert(key);
+    }
+    // Stored along with the color, so that copies and later runs get the palette as well
+    m_writer->enqueue({.kind = Writer::Op::Kind::InsertColor, .key = key, .color = colors.dominant, .palette = colors.palette});
+    WR_DEBUG(u"Color queued for caching [%1]"_s.arg(keyToString(key)));
+
+    return colors;
+}
+
+QFileInfo Manager::_cachedImage(QSqlDatabase& db, Key key) {
+    QSqlQuery query(db);
+    query.prepare(
+        u"SELECT file_name, pack_segment, pack_offset, pack_length "
+        "FROM image_cache WHERE key = :key"_s);
+    query.bindValue(u":key"_s, keyValue(key));
+    if (!query.exec() || !query.next())
+        return QFileInfo{};
+
+    const QFileInfo cached(m_cacheDir.filePath(query.value(0).toString()));
+    if (!cached.exists()) {
+        // File was deleted externally — evict the stale DB record.
+        WR_WARN(u"Image cache stale, file missing [%1], evicting"_s.arg(keyToString(key)));
+        m_writer->enqueue({.kind = Writer::Op::Kind::DeleteImage, .key = key});
+        return QFileInfo{};
     }
 
-    return color;
+    WR_DEBUG(u"Image cache hit [%1] -> %2"_s
+                 .arg(keyToString(key), cached.absoluteFilePath()));
+    {
+        QMutexLocker lk(&m_hotKeysMutex);
+        m_hotImageKeys.insert(key);
+    }
+    if (const auto location = packLocation(query, 1); location.isValid()) {
+        QWriteLocker lk(&m_packIndexLock);
+        m_packIndex.insert(key, location);
+    }
+    m_writer->enqueue({.kind = Writer::Op::Kind::TouchImage, .key = key});
+    return cached;
 }
 
-QFileInfo Manager::getImage(const QString& key, const std::function<QImage()>& computeFunc) {
+QFileInfo Manager::_resolveImage(const Source& source, const std::function<Thumbnail()>& computeFunc) {
+    const Key key   = source.key;
     QSqlDatabase db = _db();
     if (db.isOpen()) {
-        QSqlQuery query(db);
-        query.prepare(u"SELECT file_name FROM image_cache WHERE key = :key"_s);
-        query.bindValue(u":key"_s, key);
+        if (const QFileInfo cached = _cachedImage(db, key); isResolved(cached))
+            return cached;
+    }
 
-        if (query.exec() && query.next()) {
-            const QFileInfo cached(m_cacheDir.filePath(query.value(0).toString()));
-            if (cached.exists()) {
-                WR_DEBUG(u"Image cache hit [%1] -> %2"_s
-                             .arg(key, cached.absoluteFilePath()));
+    // Identical content cached under another path, share its thumbnail
+    if (source.fingerprint != 0 && db.isOpen()) {
+        QSqlQuery query(db);
+        query.prepare(
+            u"SELECT file_name, pack_segment, pack_offset, pack_length, file_size FROM image_cache "
+            "WHERE fingerprint = :fingerprint AND width = :width AND height = :height"_s);
+        query.bindValue(u":fingerprint"_s, static_cast<qint64>(source.fingerprint));
+        query.bindValue(u":width"_s, source.thumbnailSize.width());
+        query.bindValue(u":height"_s, source.thumbnailSize.height());
+        if (query.exec()) {
+            while (query.next()) {
+                const QString fileName = query.value(0).toString();
+                const QFileInfo shared(m_cacheDir.filePath(fileName));
+                if (!shared.exists())
+                    continue;
+                WR_DEBUG(u"Image cache hit by content [%1] -> %2"_s
+                             .arg(keyToString(key), shared.absoluteFilePath()));
+                const PackLocation location = packLocation(query, 1);
+                if (location.isValid()) {
+                    QWriteLocker lk(&m_packIndexLock);
+                    m_packIndex.insert(key, location);
+                }
                 {
                     QMutexLocker lk(&m_hotKeysMutex);
                     m_hotImageKeys.insert(key);
                 }
-                QSqlQuery touchQuery(db);
-                touchQuery.prepare(u"UPDATE image_cache SET last_accessed = CURRENT_TIMESTAMP WHERE key = :key"_s);
-                touchQuery.bindValue(u":key"_s, key);
-                touchQuery.exec();
-                return cached;
+                m_writer->enqueue({.kind     = Writer::Op::Kind::InsertImage,
+                                   .key      = key,
+                                   .fileName = fileName,
+                                   .location = location,
+                                   .fileSize = query.value(4).toLongLong(),
+                                   .source   = source});
+                return shared;
             }
+        }
+    }
+
+    // Generated for everyone by an administrator, read from where it is instead of decoded or copied
+    if (source.fingerprint != 0 && m_sharedPack && db.isOpen()) {
+        if (const QFileInfo shared = _sharedImage(db, source); isResolved(shared))
+            return shared;
+    }
+
+    // Cached at a larger size before the style changed, scaling that down is far cheaper than decoding the source
+    if (db.isOpen()) {
+        if (const QFileInfo derived = _deriveImage(db, source); isResolved(derived))
+            return derived;
+    }
 
-            // File was deleted externally — evict the stale DB record.
-            WR_WARN(u"Image cache stale, file missing [%1], evicting"_s.arg(key));
-            QSqlQuery evict(db);
-            evict.prepare(u"DELETE FROM image_cache WHERE key = :key"_s);
-            evict.bindValue(u":key"_s, key);
-            evict.exec();
+    // Another process may be generating the same thumbnail, wait for it instead of doing the work twice
+    Claim claim;
+    if (db.isOpen()) {
+        claim = _claimImage(key);
+        if (claim.waited) {
+            // Released only once its row is committed
+            if (const QFileInfo cached = _cachedImage(db, key); isResolved(cached)) {
+                releaseClaim(claim);
+                return cached;
+            }
         }
     }
 
-    WR_DEBUG(u"Image cache miss [%1], computing"_s.arg(key));
+    const QFileInfo generated = _generateImage(source, computeFunc);
+    // Queued behind the row, so that waiting processes find the thumbnail once the claim is gone
+    if (claim.isHeld())
+        m_writer->enqueue({.kind = Writer::Op::Kind::ReleaseClaim, .key = key, .claim = claim});
+    return generated;
+}
+
+QFileInfo Manager::_generateImage(const Source& source, const std::function<Thumbnail()>& computeFunc) {
+    const Key key = source.key;
+    WR_DEBUG(u"Image cache miss [%1], computing"_s.arg(keyToString(key)));
     if (!computeFunc) {
-        WR_WARN(u"No compute function provided for image cache miss [%1]"_s.arg(key));
+        WR_WARN(u"No compute function provided for image cache miss [%1]"_s.arg(keyToString(key)));
+        return QFileInfo{};
+    }
+
+    const Thumbnail thumbnail = computeFunc();
+    if (thumbnail.image.isNull() && thumbnail.encoded.isEmpty()) {
+        WR_WARN(u"ComputeFunc returned null image for key [%1]"_s.arg(keyToString(key)));
+        return QFileInfo{};
+    }
+
+    // Sources of exactly the target size are stored as they are
+    const bool passthrough = !thumbnail.encoded.isEmpty();
+    const QByteArray bytes = passthrough ? thumbnail.encoded : encodeThumbnail(thumbnail.image, m_options.codec);
+    const QString suffix   = passthrough ? thumbnail.suffix : thumbnailSuffix(m_options.codec);
+    if (bytes.isEmpty()) {
+        WR_WARN(u"Failed to encode image [%1] as %2"_s.arg(keyToString(key), thumbnailCodecToString(m_options.codec)));
         return QFileInfo{};
     }
 
-    const QImage image = computeFunc();
-    if (image.isNull()) {
-        WR_WARN(u"ComputeFunc returned null image for key [%1]"_s.arg(key));
+    return _storeImage(source, bytes, suffix, passthrough ? 1 : thumbnailAlignment(m_options.codec));
+}
+
+QFileInfo Manager::_storeImage(const Source& source, const QByteArray& bytes, const QString& suffix, int alignment) {
+    const Key key = source.key;
+    QString fileName;
+    PackLocation location;
+    if (m_options.packThumbnails) {
+        location = m_pack->append(bytes, alignment);
+        if (!location.isValid()) {
+            WR_WARN(u"Failed to pack image [%1]"_s.arg(keyToString(key)));
+            return QFileInfo{};
+        }
+        fileName = Pack::segmentFileName(location.segment);
+        {
+            QWriteLocker lk(&m_packIndexLock);
+            m_packIndex.insert(key, location);
+        }
+        WR_DEBUG(u"Image packed [%1] -> %2+%3"_s.arg(keyToString(key), fileName).arg(location.offset));
+    } else {
+        fileName               = keyToString(key) + u'.' + suffix;
+        const QString filePath = m_cacheDir.filePath(fileName);
+        // Complete before it appears under its name, and before its row is queued
+        QString error;
+        if (!writeFileAtomically(filePath, bytes, m_options.durability, &error)) {
+            WR_WARN(u"Failed to save image to %1: %2"_s.arg(filePath, error));
+            return QFileInfo{};
+        }
+        WR_DEBUG(u"Image saved to %1"_s.arg(filePath));
+    }
+
+    {
+        QMutexLocker lock(&m_hotKeysMutex);
+        m_hotImageKeys.insert(key);
+    }
+    m_writer->enqueue({.kind     = Writer::Op::Kind::InsertImage,
+                       .key      = key,
+                       .fileName = fileName,
+                       .location = location,
+                       .fileSize = bytes.size(),
+                       .source   = source});
+
+    return QFileInfo(m_cacheDir.filePath(fileName));
+}
+
+QFileInfo Manager::_sharedImage(QSqlDatabase& db, const Source& source) {
+    QSqlQuery query(db);
+    query.prepare(
+        u"SELECT file_name, pack_segment, pack_offset, pack_length FROM %1.image_cache "
+        "WHERE fingerprint = :fingerprint AND width = :width AND height = :height"_s.arg(s_SharedSchema));
+    query.bindValue(u":fingerprint"_s, static_cast<qint64>(source.fingerprint));
+    query.bindValue(u":width"_s, source.thumbnailSize.width());
+    query.bindValue(u":height"_s, source.thumbnailSize.height());
+    if (!query.exec())
         return QFileInfo{};
+
+    while (query.next()) {
+        const QFileInfo shared = _serveShared(source.key, query.value(0).toString(), packLocation(query, 1));
+        if (!isResolved(shared))
+            continue;
+        WR_DEBUG(u"Image cache hit in shared cache [%1] -> %2"_s.arg(keyToString(source.key), shared.absoluteFilePath()));
+        return shared;
     }
+    return QFileInfo{};
+}
+
+QFileInfo Manager::_serveShared(Key key, const QString& fileName, const PackLocation& location) {
+    const QFileInfo shared(QDir(m_options.sharedDir).filePath(fileName));
+    if (!shared.exists())
+        return QFileInfo{};
+    // Nothing is written to this cache, loadImage() finds the thumbnail by the key it was found for
+    QWriteLocker lk(&m_packIndexLock);
+    m_sharedIndex.insert(key, {fileName, location});
+    return shared;
+}
 
-    const QString fileName = key + u".jpg"_s;
-    const QString filePath = m_cacheDir.filePath(fileName);
+QFileInfo Manager::_deriveImage(QSqlDatabase& db, const Source& source) {
+    const QSize target = source.thumbnailSize;
+    if (target.isEmpty())
+        return QFileInfo{};
 
-    if (!image.save(filePath, "JPEG", 85)) {
-        WR_WARN(u"Failed to save image to %1"_s.arg(filePath));
+    QSqlQuery query(db);
+    query.prepare(
+        u"SELECT key, width, height FROM image_cache "
+        "WHERE color_key = :colorKey AND width >= :width AND height >= :height "
+        "ORDER BY width * height"_s);
+    query.bindValue(u":colorKey"_s, keyValue(source.colorKey));
+    query.bindValue(u":width"_s, target.width());
+    query.bindValue(u":height"_s, target.height());
+    if (!query.exec())
         return QFileInfo{};
+
+    while (query.next()) {
+        // Thumbnails are cropped to their own aspect ratio, only one with the same ratio holds the whole target
+        const QSize size(query.value(1).toInt(), query.value(2).toInt());
+        const qint64 skew = qAbs(qint64(size.width()) * target.height() - qint64(size.height()) * target.width());
+        if (size == target || skew * s_DeriveAspectTolerance > qint64(size.width()) * target.height())
+            continue;
+
+        QImage image = loadImage(keyAt(query, 0));
+        if (image.isNull())
+            continue;
+        image = image.scaled(target, Qt::KeepAspectRatioByExpanding, Qt::SmoothTransformation);
+        if (image.size() != target)
+            image = image.copy((image.width() - target.width()) / 2, (image.height() - target.height()) / 2,
+                               target.width(), target.height());
+        if (image.format() != QImage::Format_ARGB32_Premultiplied)
+            image = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+
+        const QByteArray bytes = encodeThumbnail(image, m_options.codec);
+        if (bytes.isEmpty())
+            continue;
+        WR_DEBUG(u"Image [%1] derived from %2x%3 thumbnail [%4]"_s
+                     .arg(keyToString(source.key))
+                     .arg(size.width())
+                     .arg(size.height())
+                     .arg(keyToString(keyAt(query, 0))));
+        return _storeImage(source, bytes, thumbnailSuffix(m_options.codec), thumbnailAlignment(m_options.codec));
+    }
+    return QFileInfo{};
+}
+
+Claim Manager::_claimImage(Key key) {
+    const QDir claims(m_cacheDir.filePath(s_ClaimDir));
+    if (!claims.exists())
+        claims.mkpath(u"."_s);
+    Claim claim = acquireClaim(claims.filePath(keyToString(key) + u".lock"_s));
+    if (claim.waited)
+        WR_DEBUG(u"Image [%1] was being generated by another process, waited for it"_s.arg(keyToString(key)));
+    return claim;
+}
+
+QUrl Manager::imageUrl(Key key, const QFileInfo& file) const {
+    if (Pack::isSegmentFile(file.fileName()) || !isNativeThumbnail(file.fileName()))
+        return QUrl(u"image://%1/%2"_s.arg(QLatin1StringView(ImageProvider::s_ProviderId), keyToString(key)));
+    return QUrl::fromLocalFile(file.absoluteFilePath());
+}
+
+QImage Manager::loadImage(Key key) {
+    PackLocation location;
+    SharedImage shared;
+    {
+        QReadLocker lk(&m_packIndexLock);
+        location = m_packIndex.value(key);
+        shared   = m_sharedIndex.value(key);
+    }
+    if (!shared.fileName.isEmpty()) {
+        if (shared.location.isValid())
+            return m_sharedPack->readImage(shared.location);
+        return loadThumbnail(QDir(m_options.sharedDir).filePath(shared.fileName));
+    }
+    if (location.isValid()) {
+        QImage image = m_pack->readImage(location);
+        if (!image.isNull())
+            return image;
     }
-    WR_DEBUG(u"Image saved to %1"_s.arg(filePath));
 
+    // Not seen in this session, moved by compaction since, or a loose file
+    QString fileName;
+    QSqlDatabase db = _db();
     if (db.isOpen()) {
-        QSqlQuery insertQuery(db);
-        insertQuery.prepare(
-            u"INSERT OR REPLACE INTO image_cache (key, file_name, last_accessed) "
-            "VALUES (:key, :file_name, CURRENT_TIMESTAMP)"_s);
-        insertQuery.bindValue(u":key"_s, key);
-        insertQuery.bindValue(u":file_name"_s, fileName);
-        if (!insertQuery.exec())
-            WR_WARN(u"Failed to record image in db [%1]: %2"_s
-                        .arg(key, insertQuery.lastError().text()));
-        else {
-            QMutexLocker lock(&m_hotKeysMutex);
-            m_hotImageKeys.insert(key);
+        QSqlQuery query(db);
+        query.prepare(u"SELECT file_name, pack_segment, pack_offset, pack_length FROM image_cache WHERE key = :key"_s);
+        query.bindValue(u":key"_s, keyValue(key));
+        if (query.exec() && query.next()) {
+            fileName = query.value(0).toString();
+            location = packLocation(query, 1);
+        }
+    }
+    if (!location.isValid()) {
+        if (fileName.isEmpty()) {
+            WR_WARN(u"No cached image for key [%1]"_s.arg(keyToString(key)));
+            return QImage();
+        }
+        return loadThumbnail(m_cacheDir.filePath(fileName));
+    }
+    {
+        QWriteLocker lk(&m_packIndexLock);
+        m_packIndex.insert(key, location);
+    }
+    return m_pack->readImage(location);
+}
+
+QHash<Key, Entry> Manager::lookup(const QList<Source>& sources) {
+    QHash<Key, Entry> result;
+    if (sources.isEmpty())
+        return result;
+
+    QSqlDatabase db = _db();
+    if (!db.isOpen())
+        return result;
+
+    QHash<Key, const Source*> wanted;
+    wanted.reserve(sources.size());
+    for (const Source& source : sources)
+        wanted.insert(source.key, &source);
+
+    // A single directory listing instead of a stat() per hit.
+    const QStringList files = QDir(m_cacheDir.path()).entryList(QDir::Files | QDir::NoDotAndDotDot);
+    const QSet<QString> present(files.cbegin(), files.cend());
+
+    const QString select =
+        u"SELECT i.key, i.file_name, c.r, c.g, c.b, c.a, i.pack_segment, i.pack_offset, i.pack_length, "
+        "i.source_path, i.source_size, i.source_mtime, i.width, i.height, i.fingerprint, i.color_key, c.palette "
+        "FROM image_cache i JOIN color_cache c ON c.key = i.color_key WHERE %1"_s;
+    const auto entryAt = [this](const QSqlQuery& query) {
+        Entry entry{QFileInfo(m_cacheDir.filePath(query.value(1).toString())),
+                    QColor(query.value(2).toInt(),
+                           query.value(3).toInt(),
+                           query.value(4).toInt(),
+                           query.value(5).toInt()),
+                    packLocation(query, 6),
+                    static_cast<quint64>(query.value(14).toLongLong())};
+        entry.palette = stringToPalette(query.value(16).toString());
+        return entry;
+    };
+
+    QList<qint64> keys;
+    keys.reserve(wanted.size());
+    for (auto it = wanted.cbegin(); it != wanted.cend(); ++it)
+        keys.append(static_cast<qint64>(it.key()));
+
+    QList<Source> repointed;
+    result.reserve(wanted.size());
+    const bool ok = queryChunked(db, select.arg(u"i.key IN (%1)"_s), keys, s_LookupChunkSize, [&](const QSqlQuery& query) {
+        // Rows whose file went missing are left for getImage() to evict.
+        if (!present.contains(query.value(1).toString()))
+            return;
+        const Key key        = keyAt(query, 0);
+        const Source& source = *wanted.value(key);
+        Entry entry          = entryAt(query);
+        // Renamed or moved within the same file system, only the recorded path is outdated.
+        // Colors are keyed by identity too and follow along, rows that predate them share the key of their image.
+        if (query.value(9).toString() != source.path) {
+            repointed.append(source);
+            entry.colorKey = source.colorKey;
+        } else {
+            entry.colorKey = keyAt(query, 15);
+        }
+        result.insert(key, std::move(entry));
+    });
+    if (!ok)
+        return result;
+
+    // Rows nobody asked for, by content identity, in case their source has been moved to another file system.
+    // Only those of the same file sizes as the sources still missing are read.
+    struct Orphan {
+        Key key;
+        QString path;
+        Entry entry;
+    };
+    const auto identity = [](qint64 size, qint64 mtimeNs, const QSize& thumbnailSize) {
+        return Utils::hash64({quint64(size), quint64(mtimeNs), quint64(thumbnailSize.width()), quint64(thumbnailSize.height())});
+    };
+    QMultiHash<quint64, Orphan> orphans;
+    QSet<qint64> missingSizes;
+    for (const Source& source : sources) {
+        if (!result.contains(source.key))
+            missingSizes.insert(source.size);
+    }
+    if (!missingSizes.isEmpty()) {
+        queryChunked(db, select.arg(u"i.source_size IN (%1)"_s), missingSizes.values(), s_LookupChunkSize, [&](const QSqlQuery& query) {
+            const QString path = query.value(9).toString();
+            if (wanted.contains(keyAt(query, 0)) || path.isEmpty() || !present.contains(query.value(1).toString()))
+                return;
+            const QSize thumbnailSize(query.value(12).toInt(), query.value(13).toInt());
+            orphans.insert(identity(query.value(10).toLongLong(), query.value(11).toLongLong(), thumbnailSize),
+                           {keyAt(query, 0), path, entryAt(query)});
+        });
+    }
+
+    // A source that moved to another file system got a new inode, take over the row of the vanished original
+    QList<QPair<Key, Source>> moved;
+    if (!orphans.isEmpty()) {
+        for (const Source& source : sources) {
+            if (result.contains(source.key))
+                continue;
+            const quint64 id = identity(source.size, source.mtimeNs, source.thumbnailSize);
+            for (auto it = orphans.find(id); it != orphans.end() && it.key() == id; ++it) {
+                if (it->path == source.path || QFileInfo::exists(it->path))
+                    continue;
+                WR_DEBUG(u"Cache entry [%1] moved from %2 to %3"_s.arg(keyToString(it->key), it->path, source.path));
+                moved.append({it->key, source});
+                it->entry.colorKey = source.colorKey;
+                result.insert(source.key, std::move(it->entry));
+                orphans.erase(it);
+                break;
+            }
+        }
+    }
+
+    {
+        QWriteLocker lk(&m_packIndexLock);
+        for (auto it = result.cbegin(); it != result.cend(); ++it) {
+            if (it->location.isValid())
+                m_packIndex.insert(it.key(), it->location);
+        }
+    }
+
+    // Served from where they are, nothing is touched or written for them
+    const QHash<Key, Entry> shared = m_sharedPack ? _lookupShared(db, sources, result) : QHash<Key, Entry>{};
+
+    if (result.isEmpty()) {
+        WR_DEBUG(u"Bulk cache lookup: 0/%1 hit(s), %2 in the shared cache"_s.arg(wanted.size()).arg(shared.size()));
+        return shared;
+    }
+
+    {
+        QMutexLocker lk(&m_hotKeysMutex);
+        for (auto it = result.cbegin(); it != result.cend(); ++it) {
+            m_hotImageKeys.insert(it.key());
+            m_hotColorKeys.insert(it->colorKey);
         }
     }
+    // The writer applies all of these in a handful of transactions.
+    for (const auto& [oldKey, source] : std::as_const(moved))
+        m_writer->enqueue({.kind = Writer::Op::Kind::Repoint, .key = oldKey, .source = source});
+    for (const Source& source : std::as_const(repointed))
+        m_writer->enqueue({.kind = Writer::Op::Kind::Repoint, .key = source.key, .source = source});
+    for (auto it = result.cbegin(); it != result.cend(); ++it) {
+        m_writer->enqueue({.kind = Writer::Op::Kind::TouchImage, .key = it.key()});
+        m_writer->enqueue({.kind = Writer::Op::Kind::TouchColor, .key = it->colorKey});
+    }
+
+    if (!moved.isEmpty() || !repointed.isEmpty())
+        WR_INFO(u"Re-pointed %1 cache entry(ies) to renamed or moved images"_s.arg(moved.size() + repointed.size()));
+    WR_DEBUG(u"Bulk cache lookup: %1/%2 hit(s), %3 in the shared cache"_s
+                 .arg(result.size() + shared.size())
+                 .arg(wanted.size())
+                 .arg(shared.size()));
+    result.insert(shared);
+    return result;
+}
+
+QHash<Key, Entry> Manager::_lookupShared(QSqlDatabase& db, const QList<Source>& sources, const QHash<Key, Entry>& found) {
+    // Keys only depend on the file, a source has the same key for everyone on the machine
+    QHash<Key, const Source*> missing;
+    for (const Source& source : sources) {
+        if (!found.contains(source.key))
+            missing.insert(source.key, &source);
+    }
+    QHash<Key, Entry> result;
+    if (missing.isEmpty())
+        return result;
+
+    const QDir sharedDir(m_options.sharedDir);
+    const QStringList files = sharedDir.entryList(QDir::Files | QDir::NoDotAndDotDot);
+    const QSet<QString> present(files.cbegin(), files.cend());
+
+    QList<qint64> keys;
+    keys.reserve(missing.size());
+    for (auto it = missing.cbegin(); it != missing.cend(); ++it)
+        keys.append(static_cast<qint64>(it.key()));
+
+    // c.* because a shared cache written by an older version has no palette column
+    QHash<Key, SharedImage> served;
+    const QString select =
+        u"SELECT i.key, i.file_name, i.pack_segment, i.pack_offset, i.pack_length, i.fingerprint, c.* "
+        "FROM %1.image_cache i JOIN %1.color_cache c ON c.key = i.color_key WHERE i.key IN (%2)"_s.arg(s_SharedSchema);
+    queryChunked(db, select, keys, s_LookupChunkSize, [&](const QSqlQuery& query) {
+        const QString fileName = query.value(1).toString();
+        if (!present.contains(fileName))
+            return;
+        const Key key = keyAt(query, 0);
+        Entry entry{QFileInfo(sharedDir.filePath(fileName)),
+                    QColor(query.value(u"r"_s).toInt(),
+                           query.value(u"g"_s).toInt(),
+                           query.value(u"b"_s).toInt(),
+                           query.value(u"a"_s).toInt()),
+                    packLocation(query, 2),
+                    static_cast<quint64>(query.value(5).toLongLong())};
+        entry.colorKey = missing.value(key)->colorKey;
+        if (const int palette = query.record().indexOf(u"palette"_s); palette >= 0)
+            entry.palette = stringToPalette(query.value(palette).toString());
+        served.insert(key, {fileName, entry.location});
+        result.insert(key, std::move(entry));
+    });
+
+    QWriteLocker lk(&m_packIndexLock);
+    m_sharedIndex.insert(served);
+    return result;
+}
+
+void Manager::recordFailure(const Source& source, const QString& reason) {
+    WR_DEBUG(u"Recording failure of %1: %2"_s.arg(source.path, reason));
+    m_writer->enqueue({.kind = Writer::Op::Kind::InsertFailure, .key = source.key, .source = source, .reason = reason});
+}
 
-    return QFileInfo(filePath);
+QHash<QString, QString> Manager::lookupFailures(const QList<Source>& sources) {
+    QHash<QString, QString> result;
+    if (sources.isEmpty())
+        return result;
+
+    QSqlDatabase db = _db();
+    if (!db.isOpen())
+        return result;
+
+    QHash<QString, const Source*> wanted;
+    wanted.reserve(sources.size());
+    for (const Source& source : sources)
+        wanted.insert(source.path, &source);
+
+    // Failures are few, a scan is cheaper than a query per source
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    if (!query.exec(u"SELECT path, size, mtime, reason FROM failed_cache"_s)) {
+        WR_WARN(u"Failed to query failed images: %1"_s.arg(query.lastError().text()));
+        return result;
+    }
+    while (query.next()) {
+        const QString path = query.value(0).toString();
+        const auto it      = wanted.constFind(path);
+        if (it == wanted.cend())
+            continue;
+        const Source& source = **it;
+        if (query.value(1).toLongLong() == source.size && query.value(2).toLongLong() == source.mtimeNs) {
+            result.insert(path, query.value(3).toString());
+        } else {
+            // Changed since, worth another try
+            m_writer->enqueue({.kind = Writer::Op::Kind::DeleteFailure, .key = source.key, .source = source});
+        }
+    }
+    return result;
+}
+
+Info Manager::info(const QList<Source>& sources) {
+    Info info;
+    info.directory  = m_cacheDir.absolutePath();
+    info.wallpapers = sources.size();
+
+    QSqlDatabase db = _db();
+    if (!db.isOpen())
+        return info;
+    if (m_writer)
+        m_writer->flush();
+
+    const auto count = [&](const QString& table) -> qint64 {
+        QSqlQuery q(db);
+        if (q.exec(u"SELECT COUNT(*) FROM %1"_s.arg(table)) && q.next())
+            return q.value(0).toLongLong();
+        return 0;
+    };
+    info.imageEntries   = count(u"image_cache"_s);
+    info.colorEntries   = count(u"color_cache"_s);
+    info.settingEntries = count(u"settings_cache"_s);
+    info.failedEntries  = count(u"failed_cache"_s);
+
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    // Copies share a thumbnail, count each file or pack record once
+    if (query.exec(u"SELECT MAX(file_size) FROM image_cache GROUP BY file_name, pack_offset"_s)) {
+        while (query.next()) {
+            const qint64 size = query.value(0).toLongLong();
+            ++info.thumbnailFiles;
+            info.thumbnailBytes += size;
+            info.countSize(size);
+        }
+    }
+    const qint64 now = QDateTime::currentSecsSinceEpoch();
+    if (query.exec(u"SELECT last_accessed FROM image_cache"_s)) {
+        while (query.next())
+            info.countAge(query.isNull(0) ? -1 : qMax<qint64>(0, now - query.value(0).toLongLong()));
+    }
+
+    QSet<Key> wanted;
+    wanted.reserve(sources.size());
+    for (const Source& source : sources)
+        wanted.insert(source.key);
+
+    const QFileInfoList files = QDir(m_cacheDir.path()).entryInfoList(QDir::Files | QDir::NoDotAndDotDot);
+    QSet<QString> present;
+    present.reserve(files.size());
+    for (const QFileInfo& file : files) {
+        present.insert(file.fileName());
+        info.totalBytes += file.size();
+        if (file.fileName().startsWith(u"cache.db"_s))
+            info.databaseBytes += file.size();
+    }
+
+    if (query.exec(u"SELECT i.key, i.file_name FROM image_cache i JOIN color_cache c ON c.key = i.color_key"_s)) {
+        while (query.next()) {
+            if (wanted.contains(keyAt(query, 0)) && present.contains(query.value(1).toString()))
+                ++info.hits;
+        }
+    }
+    query.finish();
+
+    const Reconciliation diff = _reconcile(db);
+    info.staleRows            = diff.stale.size();
+    info.orphanFiles          = diff.orphans.size();
+    for (const QString& fileName : diff.orphans)
+        info.orphanBytes += QFileInfo(m_cacheDir.filePath(fileName)).size();
+    return info;
+}
+
+qsizetype Manager::exportCache(const QString& path) {
+    m_writer->flush();
+    QSqlDatabase db = _db();
+    if (!db.isOpen())
+        return -1;
+
+    // One entry per distinct content and size, copies share their thumbnail anyway
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    if (!query.exec(
+            u"SELECT i.fingerprint, i.width, i.height, i.file_name, i.pack_segment, i.pack_offset, i.pack_length, "
+            "c.r, c.g, c.b, c.a FROM image_cache i JOIN color_cache c ON c.key = i.color_key "
+            "WHERE IFNULL(i.fingerprint, 0) != 0 GROUP BY i.fingerprint, i.width, i.height"_s)) {
+        WR_WARN(u"Failed to query cache entries to export: %1"_s.arg(query.lastError().text()));
+        return -1;
+    }
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        WR_WARN(u"Cannot write cache archive %1: %2"_s.arg(path, file.errorString()));
+        return -1;
+    }
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_6_0);
+    out << s_ArchiveMagic << s_ArchiveVersion << m_options.fullContentHash;
+
+    qsizetype exported = 0;
+    while (query.next()) {
+        const PackLocation location = packLocation(query, 4);
+        QByteArray bytes;
+        if (location.isValid()) {
+            bytes = m_pack->read(location);
+        } else if (QFile loose(m_cacheDir.filePath(query.value(3).toString())); loose.open(QIODevice::ReadOnly)) {
+            bytes = loose.readAll();
+        }
+        const QString suffix = detectThumbnailSuffix(bytes);
+        if (bytes.isEmpty() || suffix.isEmpty())
+            continue;
+
+        // Each entry is preceded by true, the archive ends with false
+        out << true
+            << static_cast<quint64>(query.value(0).toLongLong())
+            << query.value(1).toInt()
+            << query.value(2).toInt()
+            << QColor(query.value(7).toInt(), query.value(8).toInt(), query.value(9).toInt(), query.value(10).toInt())
+            << suffix
+            << bytes;
+        ++exported;
+    }
+    out << false;
+
+    if (out.status() != QDataStream::Ok || !file.commit()) {
+        WR_WARN(u"Failed to write cache archive %1: %2"_s.arg(path, file.errorString()));
+        return -1;
+    }
+    WR_INFO(u"Exported %1 cache entry(ies) to %2"_s.arg(exported).arg(path));
+    return exported;
+}
+
+qsizetype Manager::importCache(const QString& path) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        WR_WARN(u"Cannot read cache archive %1: %2"_s.arg(path, file.errorString()));
+        return -1;
+    }
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_6_0);
+
+    quint32 magic = 0, version = 0;
+    bool fullContentHash = false;
+    in >> magic >> version >> fullContentHash;
+    if (in.status() != QDataStream::Ok || magic != s_ArchiveMagic || version != s_ArchiveVersion) {
+        WR_WARN(u"%1 is not a cache archive of this version"_s.arg(path));
+        return -1;
+    }
+    // Sampled and full fingerprints of the same file never match
+    if (fullContentHash != m_options.fullContentHash) {
+        WR_WARN(u"%1 was exported with cache.fullContentHash set to %2, its entries cannot match"_s
+                    .arg(path, fullContentHash ? u"true"_s : u"false"_s));
+        return -1;
+    }
+
+    QSqlDatabase db = _db();
+    if (!db.isOpen())
+        return -1;
+    QSqlQuery cached(db);
+    cached.prepare(
+        u"SELECT 1 FROM image_cache "
+        "WHERE fingerprint = :fingerprint AND width = :width AND height = :height LIMIT 1"_s);
+
+    // The suffix ends up in a file name
+    const auto isValidSuffix = [](const QString& suffix) {
+        return !suffix.isEmpty() && suffix.size() <= 8 &&
+               std::all_of(suffix.cbegin(), suffix.cend(), [](QChar c) { return c.isLower() || c.isDigit(); });
+    };
+
+    qsizetype imported = 0, skipped = 0;
+    bool more = false;
+    while ((in >> more, more) && in.status() == QDataStream::Ok) {
+        quint64 fingerprint = 0;
+        int width = 0, height = 0;
+        QColor color;
+        QString suffix;
+        QByteArray bytes;
+        in >> fingerprint >> width >> height >> color >> suffix >> bytes;
+        if (in.status() != QDataStream::Ok)
+            break;
+        if (fingerprint == 0 || width <= 0 || height <= 0 || !color.isValid() || bytes.isEmpty() ||
+            !isValidSuffix(suffix)) {
+            ++skipped;
+            continue;
+        }
+
+        cached.bindValue(u":fingerprint"_s, static_cast<qint64>(fingerprint));
+        cached.bindValue(u":width"_s, width);
+        cached.bindValue(u":height"_s, height);
+        if (cached.exec() && cached.next()) {
+            ++skipped;
+            continue;
+        }
+        cached.finish();
+
+        // Not bound to any file, only ever found by fingerprint
+        Source source;
+        source.thumbnailSize = QSize(width, height);
+        source.fingerprint   = fingerprint;
+        source.key           = Utils::hash64({fingerprint, quint64(width), quint64(height)}, s_ArchiveMagic);
+        source.colorKey      = Utils::hash64({fingerprint}, s_ArchiveMagic);
+
+        if (!isResolved(_storeImage(source, bytes, suffix, thumbnailAlignment(suffix))))
+            continue;
+        m_writer->enqueue({.kind = Writer::Op::Kind::InsertColor, .key = source.colorKey, .color = color});
+        ++imported;
+    }
+    m_writer->flush();
+
+    if (in.status() != QDataStream::Ok)
+        WR_WARN(u"Cache archive %1 is truncated, imported what could be read"_s.arg(path));
+    WR_INFO(u"Imported %1 cache entry(ies) from %2, skipped %3"_s.arg(imported).arg(path).arg(skipped));
+    return imported;
 }
 
 QString Manager::getSetting(SettingsType key, const std::function<QString()>& computeFunc) {
@@ -322,8 +1328,11 @@ QSqlDatabase Manager::_db() const {
             return QSqlDatabase{};
         }
         QSqlQuery q(db);
-        q.exec(u"PRAGMA journal_mode=WAL"_s);
-        q.exec(u"PRAGMA synchronous=NORMAL"_s);
+        if (!m_options.readOnly)
+            q.exec(u"PRAGMA journal_mode=WAL"_s);
+        q.exec(synchronousPragma(m_options.durability));
+        if (m_sharedPack)
+            _attachShared(db);
         return db;
     }
 
@@ -333,6 +1342,13 @@ QSqlDatabase Manager::_db() const {
 
     QSqlDatabase db = QSqlDatabase::addDatabase(u"QSQLITE"_s, connName);
     db.setDatabaseName(m_dbPath);
+    QStringList connectOptions;
+    // Needed to attach the shared layer read-only
+    if (m_sharedPack)
+        connectOptions.append(u"QSQLITE_OPEN_URI"_s);
+    if (m_options.readOnly)
+        connectOptions.append(u"QSQLITE_OPEN_READONLY"_s);
+    db.setConnectOptions(connectOptions.join(u';'));
 
     if (!db.open()) {
         WR_WARN(u"Cannot open cache database %1: %2"_s
@@ -350,155 +1366,544 @@ QSqlDatabase Manager::_db() const {
     }
 
     QSqlQuery q(db);
-    q.exec(u"PRAGMA journal_mode=WAL"_s);
-    q.exec(u"PRAGMA synchronous=NORMAL"_s);
+    // The journal mode is persistent, switching it is a write
+    if (!m_options.readOnly)
+        q.exec(u"PRAGMA journal_mode=WAL"_s);
+    q.exec(synchronousPragma(m_options.durability));
     q.exec(u"PRAGMA foreign_keys=ON"_s);
-    _setupTables(db);
+    if (m_sharedPack)
+        _attachShared(db);
 
     return db;
 }
 
+void Manager::_attachShared(QSqlDatabase& db) const {
+    QUrl uri = QUrl::fromLocalFile(QDir(m_options.sharedDir).filePath(u"cache.db"_s));
+    uri.setQuery(u"mode=ro"_s);
+    QSqlQuery q(db);
+    q.prepare(u"ATTACH DATABASE :uri AS %1"_s.arg(s_SharedSchema));
+    q.bindValue(u":uri"_s, uri.toString(QUrl::FullyEncoded));
+    if (!q.exec())
+        WR_WARN(u"Cannot attach shared cache %1: %2"_s.arg(uri.toLocalFile(), q.lastError().text()));
+}
+
 void Manager::_setupTables(QSqlDatabase& db) const {
     QSqlQuery q(db);
+    if (q.exec(u"PRAGMA user_version"_s) && q.next() && q.value(0).toInt() >= s_SchemaVersion)
+        return;
+    q.finish();
+
+    db.transaction();
+    // Keys used to be hex encoded SHA-256 digests of the path, which cannot be mapped to the current ones.
+    // Drop such tables together with their thumbnails, everything is regenerated on demand.
+    if (q.exec(u"SELECT type FROM pragma_table_info('image_cache') WHERE name = 'key'"_s) && q.next() &&
+        q.value(0).toString().compare(u"TEXT"_s, Qt::CaseInsensitive) == 0) {
+        q.finish();
+        int removed = 0;
+        if (q.exec(u"SELECT DISTINCT file_name FROM image_cache"_s)) {
+            while (q.next())
+                removed += QFile::remove(m_cacheDir.filePath(q.value(0).toString()));
+        }
+        q.exec(u"DROP TABLE image_cache"_s);
+        q.exec(u"DROP TABLE IF EXISTS color_cache"_s);
+        WR_INFO(u"Dropped cache tables with legacy keys, removed %1 file(s)"_s.arg(removed));
+    }
+    q.finish();
+
+    // last_accessed: seconds since the epoch
+    // palette: representative colors, computed on demand
     q.exec(
         u"CREATE TABLE IF NOT EXISTS color_cache ("
-        "  key           TEXT    PRIMARY KEY NOT NULL,"
+        "  key           INTEGER PRIMARY KEY NOT NULL,"
         "  r             INTEGER NOT NULL,"
         "  g             INTEGER NOT NULL,"
         "  b             INTEGER NOT NULL,"
         "  a             INTEGER NOT NULL,"
-        "  last_accessed TEXT"
+        "  last_accessed INTEGER,"
+        "  palette       TEXT"
         ")"_s);
+    // Name of the color of a palette closest to a dominant color, palette_hash identifies the palette's contents.
+    // Rows go along with their color_cache row.
+    q.exec(
+        u"CREATE TABLE IF NOT EXISTS palette_match ("
+        "  palette_hash INTEGER NOT NULL,"
+        "  color_key    INTEGER NOT NULL,"
+        "  color_name   TEXT    NOT NULL,"
+        "  PRIMARY KEY (palette_hash, color_key)"
+        ") WITHOUT ROWID"_s);
+    q.exec(u"CREATE INDEX IF NOT EXISTS palette_match_color_key ON palette_match (color_key)"_s);
+    // last_accessed: seconds since the epoch
+    // pack_*: NULL for loose files
+    // source_*: identity of the source image, used to follow renamed and moved images
+    // color_key: key of the dominant color in color_cache, shared by all thumbnail sizes of an image
+    // file_size: bytes taken by the thumbnail, counted against the byte budget
     q.exec(
         u"CREATE TABLE IF NOT EXISTS image_cache ("
-        "  key           TEXT PRIMARY KEY NOT NULL,"
-        "  file_name     TEXT NOT NULL,"
-        "  last_accessed TEXT"
+        "  key           INTEGER PRIMARY KEY NOT NULL,"
+        "  file_name     TEXT    NOT NULL,"
+        "  last_accessed INTEGER,"
+        "  pack_segment  INTEGER,"
+        "  pack_offset   INTEGER,"
+        "  pack_length   INTEGER,"
+        "  source_path   TEXT,"
+        "  source_size   INTEGER,"
+        "  source_mtime  INTEGER,"
+        "  width         INTEGER,"
+        "  height        INTEGER,"
+        "  fingerprint   INTEGER,"
+        "  file_size     INTEGER,"
+        "  color_key     INTEGER"
         ")"_s);
+    q.exec(u"CREATE INDEX IF NOT EXISTS image_cache_color_key ON image_cache (color_key)"_s);
+    q.exec(u"CREATE INDEX IF NOT EXISTS image_cache_fingerprint ON image_cache (fingerprint)"_s);
+    // References to thumbnails shared between copies are counted on eviction
+    q.exec(u"CREATE INDEX IF NOT EXISTS image_cache_file_name ON image_cache (file_name)"_s);
+    q.exec(u"CREATE INDEX IF NOT EXISTS image_cache_last_accessed ON image_cache (last_accessed)"_s);
+    q.exec(u"CREATE INDEX IF NOT EXISTS color_cache_last_accessed ON color_cache (last_accessed)"_s);
     q.exec(
         u"CREATE TABLE IF NOT EXISTS settings_cache ("
         "  key   TEXT PRIMARY KEY NOT NULL,"
         "  value TEXT NOT NULL"
         ");"_s);
-    // Migrate existing databases that predate the last_accessed column.
-    q.exec(u"ALTER TABLE color_cache ADD COLUMN last_accessed TEXT"_s);
-    q.exec(u"ALTER TABLE image_cache ADD COLUMN last_accessed TEXT"_s);
+    // Images that could not be loaded, skipped as long as size and mtime (nanoseconds) stay the same
+    q.exec(
+        u"CREATE TABLE IF NOT EXISTS failed_cache ("
+        "  path      TEXT    PRIMARY KEY NOT NULL,"
+        "  size      INTEGER NOT NULL,"
+        "  mtime     INTEGER NOT NULL,"
+        "  reason    TEXT,"
+        "  failed_at INTEGER"
+        ")"_s);
+    // Processes currently using the cache, by the start of their session
+    q.exec(
+        u"CREATE TABLE IF NOT EXISTS cache_sessions ("
+        "  pid        INTEGER PRIMARY KEY NOT NULL,"
+        "  started_at INTEGER NOT NULL"
+        ")"_s);
+    q.exec(u"PRAGMA user_version = %1"_s.arg(s_SchemaVersion));
+    if (!db.commit())
+        WR_WARN(u"Failed to set up cache database: %1"_s.arg(db.lastError().text()));
+}
+
+qint64 Manager::_oldestSession(QSqlDatabase& db, bool* shared) const {
+    qint64 oldest = m_sessionStart;
+    *shared       = false;
+
+    QSqlQuery sel(db);
+    if (!sel.exec(u"SELECT pid, started_at FROM cache_sessions"_s))
+        return oldest;
+    QList<qint64> vanished;
+    while (sel.next()) {
+        const qint64 pid = sel.value(0).toLongLong();
+        if (pid == QCoreApplication::applicationPid())
+            continue;
+        if (!isInstanceAlive(pid)) {
+            vanished.push_back(pid);
+            continue;
+        }
+        *shared = true;
+        oldest  = std::min(oldest, sel.value(1).toLongLong());
+    }
+    sel.finish();
+
+    // Crashed without unregistering
+    QSqlQuery drop(db);
+    drop.prepare(u"DELETE FROM cache_sessions WHERE pid = :pid"_s);
+    for (const qint64 pid : std::as_const(vanished)) {
+        drop.bindValue(u":pid"_s, pid);
+        drop.exec();
+    }
+    return oldest;
+}
+
+Manager::Reconciliation Manager::_reconcile(QSqlDatabase& db) const {
+    // A single directory listing diffed against a single scan of the table
+    const QStringList files = QDir(m_cacheDir.path()).entryList(QDir::Files | QDir::NoDotAndDotDot);
+    const QSet<QString> present(files.cbegin(), files.cend());
+    QSet<QString> referenced;
+    referenced.reserve(present.size());
+
+    Reconciliation diff;
+    QSqlQuery sel(db);
+    sel.setForwardOnly(true);
+    if (!sel.exec(u"SELECT key, file_name FROM image_cache"_s)) {
+        WR_WARN(u"Failed to scan image cache: %1"_s.arg(sel.lastError().text()));
+        return diff;
+    }
+    while (sel.next()) {
+        const QString fileName = sel.value(1).toString();
+        if (present.contains(fileName))
+            referenced.insert(fileName);
+        else
+            diff.stale.push_back(keyAt(sel, 0));
+    }
+    for (const QString& fileName : present) {
+        if (!referenced.contains(fileName) && isLooseThumbnail(fileName))
+            diff.orphans.push_back(fileName);
+    }
+    return diff;
+}
+
+void Manager::_verifyThumbnails(QSqlDatabase& db, qint64 since) {
+    // Only a run that was interrupted while writing leaves broken thumbnails behind, and only those
+    // written since the previous check can be affected
+    const qint64 verifiedAt   = getSetting(SettingsType::ThumbnailsVerifiedAt, [] { return u"0"_s; }).toLongLong();
+    const QFileInfoList files = QDir(m_cacheDir.path()).entryInfoList(QDir::Files | QDir::Hidden | QDir::NoDotAndDotDot);
+
+    int leftovers = 0;
+    QStringList broken;
+    for (const QFileInfo& file : files) {
+        const qint64 mtime = file.lastModified().toSecsSinceEpoch();
+        // Written in a live session, complete by construction or still being written
+        if (mtime >= since)
+            continue;
+        if (isTemporaryFile(file.fileName())) {
+            leftovers += QFile::remove(file.absoluteFilePath());
+        } else if (mtime >= verifiedAt && isLooseThumbnail(file.fileName()) &&
+                   !isCompleteThumbnail(file.absoluteFilePath())) {
+            broken.push_back(file.fileName());
+        }
+    }
+    if (leftovers)
+        WR_INFO(u"Removed %1 unfinished thumbnail write(s) of an interrupted run"_s.arg(leftovers));
+
+    // Moved aside rather than removed, so that they can still be inspected
+    QList<Key> evicted;
+    if (!broken.isEmpty()) {
+        const QDir quarantine(m_cacheDir.filePath(s_QuarantineDir));
+        quarantine.mkpath(u"."_s);
+        QSqlQuery sel(db);
+        sel.prepare(u"SELECT key FROM image_cache WHERE file_name = :fileName"_s);
+        for (const QString& fileName : std::as_const(broken)) {
+            WR_WARN(u"Thumbnail %1 is truncated, moving it to %2"_s.arg(fileName, quarantine.path()));
+            QFile::remove(quarantine.filePath(fileName));
+            if (!QFile::rename(m_cacheDir.filePath(fileName), quarantine.filePath(fileName)))
+                QFile::remove(m_cacheDir.filePath(fileName));
+            sel.bindValue(u":fileName"_s, fileName);
+            if (sel.exec()) {
+                while (sel.next())
+                    evicted.push_back(keyAt(sel, 0));
+            }
+        }
+    }
+
+    // Packed thumbnails whose segment ends before they do
+    const auto segments = m_pack->segments();
+    QSqlQuery packed(db);
+    packed.setForwardOnly(true);
+    if (packed.exec(u"SELECT key, pack_segment, pack_offset + pack_length FROM image_cache WHERE pack_segment IS NOT NULL"_s)) {
+        int truncated = 0;
+        while (packed.next()) {
+            if (packed.value(2).toLongLong() > segments.value(packed.value(1).toInt(), -1)) {
+                evicted.push_back(keyAt(packed, 0));
+                ++truncated;
+            }
+        }
+        if (truncated)
+            WR_WARN(u"%1 packed thumbnail(s) extend past the end of their segment"_s.arg(truncated));
+    }
+
+    if (!evicted.isEmpty()) {
+        {
+            QWriteLocker lk(&m_packIndexLock);
+            for (const Key k : std::as_const(evicted)) {
+                m_packIndex.remove(k);
+                m_imageFlights.forget(k);
+            }
+        }
+        WR_INFO(u"Evicted %1 image cache row(s) of truncated thumbnails"_s.arg(evicted.size()));
+        m_writer->enqueue({.kind = Writer::Op::Kind::EvictImages, .keys = std::move(evicted)});
+        m_writer->flush();
+    }
+
+    storeSetting(SettingsType::ThumbnailsVerifiedAt, QString::number(since));
 }
 
 void Manager::_runCleanup() {
-    WR_DEBUG(u"Cache cleanup started (maxEntries=%1)"_s.arg(m_maxEntries));
+    // One process at a time, a lock left behind by a crashed process is taken over
+    QLockFile lock(m_cacheDir.filePath(s_CleanupLockFile));
+    lock.setStaleLockTime(0);
+    if (!lock.tryLock(0)) {
+        WR_DEBUG(u"Cache cleanup is running in another process, skipped"_s);
+        return;
+    }
+    WR_DEBUG(u"Cache cleanup started (maxEntries=%1, maxBytes=%2)"_s.arg(m_options.maxEntries).arg(m_options.maxBytes));
 
     QSqlDatabase db = _db();
     if (!db.isOpen())
         return;
 
-    // Evict image_cache rows whose backing file no longer exists
+    // Whatever other live processes have written or accessed since their start is in use as well
+    bool shared        = false;
+    const qint64 since = _oldestSession(db, &shared);
+
+    _verifyThumbnails(db, since);
+
+    qint64 reclaimed = 0;
+
+    // Rows whose file is gone are evicted, thumbnails no row refers to (left behind by a crash) are removed
     {
-        QSqlQuery sel(db);
-        if (sel.exec(u"SELECT key, file_name FROM image_cache"_s)) {
-            struct Stale {
-                QString key, fileName;
-            };
+        const Reconciliation diff = _reconcile(db);
 
-            QList<Stale> stale;
-            while (sel.next()) {
-                const QString k    = sel.value(0).toString();
-                const QString file = sel.value(1).toString();
-                if (!QFileInfo::exists(m_cacheDir.filePath(file)))
-                    stale.push_back({k, file});
+        Writer::Op evict{.kind = Writer::Op::Kind::EvictImages};
+        {
+            QMutexLocker lk(&m_hotKeysMutex);
+            for (const Key k : diff.stale) {
+                if (!m_hotImageKeys.contains(k))
+                    evict.keys.push_back(k);
             }
-            int evicted = 0;
-            for (const auto& s : std::as_const(stale)) {
-                {
-                    QMutexLocker lk(&m_hotKeysMutex);
-                    if (m_hotImageKeys.contains(s.key))
-                        continue;
-                }
-                QSqlQuery del(db);
-                del.prepare(u"DELETE FROM image_cache WHERE key = :key"_s);
-                del.bindValue(u":key"_s, s.key);
-                if (del.exec())
-                    ++evicted;
+        }
+        // Remembered with their missing file
+        for (const Key k : std::as_const(evict.keys))
+            m_imageFlights.forget(k);
+        if (!evict.keys.isEmpty()) {
+            WR_INFO(u"Cleanup evicted %1 stale image cache row(s)"_s.arg(evict.keys.size()));
+            m_writer->enqueue(std::move(evict));
+        }
+
+        int orphans        = 0;
+        qint64 orphanBytes = 0;
+        for (const QString& fileName : diff.orphans) {
+            const QFileInfo orphan(m_cacheDir.filePath(fileName));
+            // Written in a live session, its row may still be queued
+            if (orphan.lastModified().toSecsSinceEpoch() >= since)
+                continue;
+            const qint64 size = orphan.size();
+            if (QFile::remove(orphan.absoluteFilePath())) {
+                ++orphans;
+                orphanBytes += size;
             }
-            if (evicted)
-                WR_INFO(u"Cleanup evicted %1 stale image cache row(s)"_s.arg(evicted));
         }
+        reclaimed += orphanBytes;
+        if (orphans)
+            WR_INFO(u"Cleanup removed %1 orphaned thumbnail(s), %2 byte(s)"_s.arg(orphans).arg(orphanBytes));
     }
 
-    // Trim image_cache to m_maxEntries (oldest last_accessed first)
+    // Access times of entries hit so far have to be visible to the queries below
+    m_writer->flush();
+
+    // Trim image_cache to maxEntries and maxBytes, least recently used first.
+    // The totals come from a single aggregate, the last_accessed index is only walked as far as needed.
     {
-        QSqlQuery countQ(db);
-        if (countQ.exec(u"SELECT COUNT(*) FROM image_cache"_s) && countQ.next()) {
-            int excess = countQ.value(0).toInt() - m_maxEntries;
-            if (excess > 0) {
-                QSqlQuery sel(db);
-                sel.exec(u"SELECT key, file_name FROM image_cache ORDER BY last_accessed ASC"_s);
-                QList<QPair<QString, QString>> toDelete;
-                while (sel.next() && excess > 0) {
-                    const QString k = sel.value(0).toString();
-                    QMutexLocker lk(&m_hotKeysMutex);
-                    if (!m_hotImageKeys.contains(k)) {
-                        toDelete.push_back({k, sel.value(1).toString()});
-                        --excess;
-                    }
+        // Copies share a thumbnail, which only counts once and is only freed along with its last row
+        const auto thumbnailId = [](const QSqlQuery& query, int pos) {
+            return query.isNull(pos + 1) ? query.value(pos).toString()
+                                         : u"%1+%2"_s.arg(query.value(pos).toString()).arg(query.value(pos + 1).toLongLong());
+        };
+
+        qint64 excessEntries = 0, excessBytes = 0;
+        QSqlQuery total(db);
+        if (total.exec(
+                u"SELECT (SELECT COUNT(*) FROM image_cache), IFNULL(SUM(file_size), 0) FROM ("
+                "  SELECT MAX(file_size) AS file_size FROM image_cache GROUP BY file_name, pack_offset"
+                ")"_s) &&
+            total.next()) {
+            if (m_options.maxEntries > 0)
+                excessEntries = total.value(0).toLongLong() - m_options.maxEntries;
+            if (m_options.maxBytes > 0)
+                excessBytes = total.value(1).toLongLong() - m_options.maxBytes;
+        }
+
+        struct Victim {
+            Key key;
+            QString fileName;
+            qint64 size;
+            bool last;  ///< No other row refers to its thumbnail
+        };
+
+        QList<Victim> victims;
+        if (excessEntries > 0 || excessBytes > 0) {
+            QHash<QString, int> shared;
+            QSqlQuery refs(db);
+            if (refs.exec(
+                    u"SELECT file_name, pack_offset, COUNT(*) FROM image_cache "
+                    "GROUP BY file_name, pack_offset HAVING COUNT(*) > 1"_s)) {
+                while (refs.next())
+                    shared.insert(thumbnailId(refs, 0), refs.value(2).toInt());
+            }
+
+            QSqlQuery sel(db);
+            sel.setForwardOnly(true);
+            sel.prepare(
+                u"SELECT key, file_name, pack_offset, file_size FROM image_cache "
+                "WHERE IFNULL(last_accessed, 0) < :sessionStart ORDER BY last_accessed, key"_s);
+            sel.bindValue(u":sessionStart"_s, since);
+            if (sel.exec()) {
+                QMutexLocker lk(&m_hotKeysMutex);
+                while ((excessEntries > 0 || excessBytes > 0) && sel.next()) {
+                    const Key k = keyAt(sel, 0);
+                    if (m_hotImageKeys.contains(k))
+                        continue;
+                    const qint64 size = sel.value(3).toLongLong();
+                    const auto ref    = shared.find(thumbnailId(sel, 1));
+                    const bool last   = ref == shared.end() || --*ref == 0;
+                    victims.push_back({k, sel.value(1).toString(), size, last});
+                    --excessEntries;
+                    if (last)
+                        excessBytes -= size;
                 }
-                int removed = 0;
-                for (const auto& [k, fileName] : std::as_const(toDelete)) {
-                    {
-                        QMutexLocker lk(&m_hotKeysMutex);
-                        if (m_hotImageKeys.contains(k))
-                            continue;
-                    }
-                    QFile::remove(m_cacheDir.filePath(fileName));
-                    QSqlQuery del(db);
-                    del.prepare(u"DELETE FROM image_cache WHERE key = :key"_s);
-                    del.bindValue(u":key"_s, k);
-                    if (del.exec())
-                        ++removed;
+            } else {
+                WR_WARN(u"Failed to select image cache entries to evict: %1"_s.arg(sel.lastError().text()));
+            }
+        }
+
+        if (!victims.isEmpty()) {
+            Writer::Op evict{.kind = Writer::Op::Kind::EvictImages};
+            evict.keys.reserve(victims.size());
+            for (const auto& victim : std::as_const(victims))
+                evict.keys.push_back(victim.key);
+            m_writer->enqueue(std::move(evict));
+            // Rows go first, a thumbnail must never be referenced after its file is gone
+            m_writer->flush();
+            for (const auto& victim : std::as_const(victims))
+                m_imageFlights.forget(victim.key);
+
+            // Packed entries leave a hole in their segment, reclaimed by compaction below
+            qint64 removedBytes = 0;
+            for (const auto& victim : std::as_const(victims)) {
+                if (victim.last && !Pack::isSegmentFile(victim.fileName) &&
+                    QFile::remove(m_cacheDir.filePath(victim.fileName)))
+                    removedBytes += victim.size;
+            }
+            reclaimed += removedBytes;
+            WR_INFO(u"Cleanup evicted %1 image cache entry(ies), removed %2 byte(s) of thumbnails"_s
+                        .arg(victims.size())
+                        .arg(removedBytes));
+        }
+    }
+
+    // Trim color_cache to maxEntries, least recently used first
+    if (m_options.maxEntries > 0) {
+        qint64 excess = 0;
+        QSqlQuery total(db);
+        if (total.exec(u"SELECT COUNT(*) FROM color_cache"_s) && total.next())
+            excess = total.value(0).toLongLong() - m_options.maxEntries;
+
+        Writer::Op evict{.kind = Writer::Op::Kind::EvictColors};
+        if (excess > 0) {
+            QSqlQuery sel(db);
+            sel.setForwardOnly(true);
+            sel.prepare(
+                u"SELECT key FROM color_cache "
+                "WHERE IFNULL(last_accessed, 0) < :sessionStart ORDER BY last_accessed, key"_s);
+            sel.bindValue(u":sessionStart"_s, since);
+            if (sel.exec()) {
+                QMutexLocker lk(&m_hotKeysMutex);
+                while (excess > 0 && sel.next()) {
+                    const Key k = keyAt(sel, 0);
+                    if (m_hotColorKeys.contains(k))
+                        continue;
+                    evict.keys.push_back(k);
+                    --excess;
                 }
-                if (removed)
-                    WR_INFO(u"Cleanup trimmed %1 image cache entry(ies)"_s.arg(removed));
+            } else {
+                WR_WARN(u"Failed to select color cache entries to evict: %1"_s.arg(sel.lastError().text()));
             }
         }
+        for (const Key k : std::as_const(evict.keys))
+            m_colorFlights.forget(k);
+        if (!evict.keys.isEmpty()) {
+            WR_INFO(u"Cleanup evicted %1 color cache entry(ies)"_s.arg(evict.keys.size()));
+            m_writer->enqueue(std::move(evict));
+        }
     }
 
-    // Trim color_cache to m_maxEntries (oldest last_accessed first)
+    // Other processes keep the locations of packed thumbnails in memory
+    if (shared)
+        WR_DEBUG(u"Other processes are using the cache, pack compaction skipped"_s);
+    else
+        reclaimed += _compactPacks(db);
+
+    WR_INFO(u"Cache cleanup complete, reclaimed %1 byte(s)"_s.arg(reclaimed));
+}
+
+qint64 Manager::_compactPacks(QSqlDatabase& db) {
+    const auto segments = m_pack->segments();
+    if (segments.isEmpty())
+        return 0;
+
+    // Make sure the deletes queued by the trimming above are visible
+    m_writer->flush();
+
+    QHash<int, qint64> liveBytes;
     {
-        QSqlQuery countQ(db);
-        if (countQ.exec(u"SELECT COUNT(*) FROM color_cache"_s) && countQ.next()) {
-            int excess = countQ.value(0).toInt() - m_maxEntries;
-            if (excess > 0) {
-                QSqlQuery sel(db);
-                sel.exec(u"SELECT key FROM color_cache ORDER BY last_accessed ASC"_s);
-                QStringList toDelete;
-                while (sel.next() && excess > 0) {
-                    const QString k = sel.value(0).toString();
-                    QMutexLocker lk(&m_hotKeysMutex);
-                    if (!m_hotColorKeys.contains(k)) {
-                        toDelete << k;
-                        --excess;
+        QSqlQuery sel(db);
+        if (!sel.exec(
+                u"SELECT pack_segment, SUM(pack_length) FROM ("
+                "  SELECT DISTINCT pack_segment, pack_offset, pack_length FROM image_cache "
+                "  WHERE pack_segment IS NOT NULL"
+                ") GROUP BY pack_segment"_s)) {
+            WR_WARN(u"Failed to query pack usage: %1"_s.arg(sel.lastError().text()));
+            return 0;
+        }
+        while (sel.next())
+            liveBytes.insert(sel.value(0).toInt(), sel.value(1).toLongLong());
+    }
+
+    // Never touch the newest segment, it is (or will be resumed as) the one being appended to
+    int newest = m_pack->currentSegment();
+    for (auto it = segments.cbegin(); it != segments.cend(); ++it)
+        newest = std::max(newest, it.key());
+
+    int compacted    = 0;
+    qint64 reclaimed = 0;
+    for (auto it = segments.cbegin(); it != segments.cend(); ++it) {
+        const int segment  = it.key();
+        const qint64 total = it.value();
+        const qint64 live  = liveBytes.value(segment, 0);
+        if (segment == newest || live > total * s_PackCompactThreshold)
+            continue;
+
+        if (live > 0) {
+            // Move the remaining entries to the end of the current segment
+            QSqlQuery sel(db);
+            sel.prepare(u"SELECT key, pack_offset, pack_length FROM image_cache WHERE pack_segment = :segment"_s);
+            sel.bindValue(u":segment"_s, segment);
+            if (!sel.exec())
+                continue;
+            bool moved = true;
+            // Thumbnails shared between copies are moved once
+            QHash<qint64, PackLocation> movedOffsets;
+            while (sel.next()) {
+                const Key key         = keyAt(sel, 0);
+                const qint64 offset   = sel.value(1).toLongLong();
+                PackLocation location = movedOffsets.value(offset);
+                if (!location.isValid()) {
+                    const QByteArray bytes = m_pack->read({segment, offset, sel.value(2).toLongLong()});
+                    // Keep raw thumbnails usable in place, whatever codec they were written with
+                    location = bytes.isEmpty() ? PackLocation{} : m_pack->append(bytes, thumbnailAlignment(ThumbnailCodec::Raw));
+                    if (!location.isValid()) {
+                        moved = false;
+                        break;
                     }
+                    movedOffsets.insert(offset, location);
                 }
-                int removed = 0;
-                for (const QString& k : std::as_const(toDelete)) {
-                    {
-                        QMutexLocker lk(&m_hotKeysMutex);
-                        if (m_hotColorKeys.contains(k))
-                            continue;
-                    }
-                    QSqlQuery del(db);
-                    del.prepare(u"DELETE FROM color_cache WHERE key = :key"_s);
-                    del.bindValue(u":key"_s, k);
-                    if (del.exec())
-                        ++removed;
+                {
+                    QWriteLocker lk(&m_packIndexLock);
+                    m_packIndex.insert(key, location);
                 }
-                if (removed)
-                    WR_INFO(u"Cleanup trimmed %1 color cache entry(ies)"_s.arg(removed));
+                // Remembered with its old segment
+                m_imageFlights.forget(key);
+                m_writer->enqueue({.kind     = Writer::Op::Kind::MoveImage,
+                                   .key      = key,
+                                   .fileName = Pack::segmentFileName(location.segment),
+                                   .location = location});
+            }
+            m_writer->flush();
+            if (!moved) {
+                WR_WARN(u"Failed to compact pack segment %1"_s.arg(segment));
+                continue;
             }
         }
-    }
 
-    WR_DEBUG(u"Cache cleanup complete"_s);
+        if (m_pack->removeSegment(segment)) {
+            ++compacted;
+            reclaimed += total - live;
+        }
+    }
+    if (compacted)
+        WR_INFO(u"Cleanup compacted %1 pack segment(s), reclaimed %2 byte(s)"_s.arg(compacted).arg(reclaimed));
+    return reclaimed;
 }
 
 }  // namespace WallReel::Core::Cache
@@ -5,51 +5,337 @@
 #include <QFileInfo>
 #include <QFuture>
 #include <QMutex>
+#include <QReadWriteLock>
 #include <QSet>
+#include <QUrl>
 #include <QtSql>
 
+#include "claim.hpp"
+#include "codec.hpp"
+#include "durability.hpp"
+#include "info.hpp"
+#include "pack.hpp"
+#include "singleflight.hpp"
 #include "types.hpp"
+#include "writer.hpp"
 
 namespace WallReel::Core::Cache {
 
+struct Options {
+    int maxEntries        = 1000;                  ///< Max number of entries kept per cache table by evictOldEntries()
+    qint64 maxBytes       = 0;                     ///< Max bytes of thumbnails kept by evictOldEntries(), 0 for no limit
+    bool packThumbnails   = false;                 ///< Append new thumbnails to pack segments instead of writing separate files
+    ThumbnailCodec codec  = ThumbnailCodec::Jpeg;  ///< How new thumbnails are encoded
+    bool fullContentHash  = false;                 ///< Fingerprint whole files instead of sampled byte ranges
+    Durability durability = Durability::Normal;    ///< What is synced to the disk before a thumbnail is recorded
+    QString sharedDir;                             ///< Read-only cache consulted by content on misses, empty for none
+    bool shareable        = false;                 ///< Written to be read by other users as sharedDir
+    bool readOnly         = false;                 ///< Only inspected by info(): no session, no schema setup, nothing written
+};
+
 class Manager {
   public:
-    static QString cacheKey(const QFileInfo& fileInfo, const QSize& imageSize);
+    /**
+     * @brief Identify a source image and compute the cache key of its thumbnail.
+     *
+     * @details The key is a 64-bit hash of device, inode, size and mtime of the file and the thumbnail size,
+     * so it survives renames and moves within a file system but changes whenever the content does.
+     * Only a single stat() is needed, the file is not read.
+     *
+     * @param fileInfo Source image
+     * @param imageSize Thumbnail size
+     * @return Source
+     */
+    static Source identify(const QFileInfo& fileInfo, const QSize& imageSize);
+
+    /**
+     * @brief Identify a source image at several thumbnail sizes with a single stat().
+     *
+     * @param fileInfo Source image
+     * @param imageSizes Thumbnail sizes
+     * @return QList<Source> One per size, in the same order
+     */
+    static QList<Source> identify(const QFileInfo& fileInfo, const QList<QSize>& imageSizes);
 
-    Manager(const QDir& cacheDir, int maxEntries = 1000);
+    /**
+     * @brief Compute the content fingerprint of a file, used to share thumbnails and colors between copies.
+     *
+     * @details Hashes the file size together with its first, middle and last s_FingerprintSampleSize bytes,
+     * or the whole file if Options::fullContentHash is set.
+     *
+     * @param path Path of the file
+     * @return quint64 0 if the file cannot be read
+     */
+    quint64 fingerprint(const QString& path) const;
+
+    /**
+     * @brief Construct a new Manager object
+     *
+     * @param cacheDir Directory holding cache.db and the thumbnails
+     * @param options
+     */
+    Manager(const QDir& cacheDir, const Options& options = {});
 
     ~Manager();
 
+    /**
+     * @brief Evict the least recently used entries beyond Options::maxEntries and Options::maxBytes
+     *        in the background. Entries used in this session are never evicted.
+     *
+     * @details Starts by repairing what an interrupted run may have left behind: unfinished temporary
+     * files are removed, thumbnails written since the last check that turn out to be truncated are moved
+     * to the quarantine subdirectory and their rows evicted.
+     *
+     * Runs in one process at a time. Entries accessed and files written since the start of any other
+     * live process are left alone as well, and packs are only compacted if no other process uses them.
+     */
     void evictOldEntries();
 
-    void clearCache(Type type = Type::Image | Type::Color);
+    void clearCache(Type type = Type::Image | Type::Color | Type::Failure);
+
+    /**
+     * @brief Get the cached dominant color of a source together with its palette, computing both on a miss.
+     *        Colors are keyed by Source::colorKey, shared by all thumbnail sizes of a source.
+     *        A miss is served from a copy with the same fingerprint if there is one.
+     *
+     * @details Resolved on the calling thread. Concurrent calls for the same key wait for the first one
+     * instead of computing the colors again, recently resolved keys are answered from memory. Either way
+     * every caller gets the palette, which is empty only if the color was cached without one.
+     */
+    Colors getColor(const Source& source, const std::function<Colors()>& computeFunc = nullptr);
+
+    /**
+     * @brief Get the cached representative colors of a source, computing them on a miss.
+     *        They are stored next to the dominant color under the same key, and copied along with it.
+     *
+     * @details Resolved on the calling thread. Nothing is stored unless the dominant color is cached.
+     *
+     * @param colorKey Source::colorKey or Entry::colorKey
+     */
+    QList<QColor> getPalette(Key colorKey, const std::function<QList<QColor>()>& computeFunc = nullptr);
+
+    /**
+     * @brief Store representative colors computed together with the dominant color, see getPalette().
+     */
+    void storePalette(Key colorKey, const QList<QColor>& palette);
+
+    /**
+     * @brief Load every stored match of dominant colors against a palette, see storePaletteMatches().
+     *
+     * @param paletteHash Identifies the contents of the palette
+     * @return QHash<Key, QString> Name of the closest palette color by color key
+     */
+    QHash<Key, QString> paletteMatches(quint64 paletteHash);
+
+    /**
+     * @brief Store matches of dominant colors against a palette, they are dropped along with their colors.
+     *
+     * @param paletteHash Identifies the contents of the palette
+     * @param matches Name of the closest palette color by color key
+     */
+    void storePaletteMatches(quint64 paletteHash, const QHash<Key, QString>& matches);
+
+    /**
+     * @brief Get the cached thumbnail of a source, computing it on a miss.
+     *        A miss shares the thumbnail of a copy with the same fingerprint and size if there is one, in this
+     *        cache or read in place from the shared layer, or scales down a larger thumbnail of the same source
+     *        with the same aspect ratio. Only a true miss is generated into this cache.
+     *
+     * @details Resolved on the calling thread. Concurrent calls for the same key wait for the first one
+     * instead of decoding and writing the thumbnail again, recently resolved keys are answered from memory.
+     * The same holds across processes: a thumbnail another process has claimed is waited for until its row
+     * is committed, or its owner is gone. Claims are file locks, see Claim, taking one writes nothing.
+     */
+    QFileInfo getImage(const Source& source, const std::function<Thumbnail()>& computeFunc = nullptr);
+
+    /**
+     * @brief Asynchronous getColor(), resolved in the global thread pool unless the result is already known.
+     *
+     * @return QFuture<Colors> Shared with every other pending request for the same key
+     */
+    QFuture<Colors> requestColor(const Source& source, std::function<Colors()> computeFunc = nullptr);
+
+    /**
+     * @brief Asynchronous getImage(), resolved in the global thread pool unless the result is already known.
+     *
+     * @return QFuture<QFileInfo> Shared with every other pending request for the same key
+     */
+    QFuture<QFileInfo> requestImage(const Source& source, std::function<Thumbnail()> computeFunc = nullptr);
 
-    QColor getColor(const QString& key, const std::function<QColor()>& computeFunc = nullptr);
+    /**
+     * @brief Get the url QML should load the cached image from.
+     *
+     * @param key Cache key of the image
+     * @param file Cached file as returned by getImage() or lookup()
+     * @return QUrl A file:// url for loose files QML can read itself, an image:// url served by ImageProvider
+     *         for packed ones and those written with a codec QML does not know
+     */
+    QUrl imageUrl(Key key, const QFileInfo& file) const;
 
-    QFileInfo getImage(const QString& key, const std::function<QImage()>& computeFunc = nullptr);
+    /**
+     * @brief Load a cached image, straight from its mapped segment if packed, used by ImageProvider.
+     *
+     * @param key Cache key of the image
+     * @return QImage Null if the key has no cached image
+     */
+    QImage loadImage(Key key);
+
+    /**
+     * @brief Resolve the cached thumbnail and dominant color of many sources at once.
+     *
+     * @details Entries of sources that have been renamed or moved, even to another file system, are
+     * re-pointed to their new path and key instead of being regenerated. Entries missing from this cache
+     * are looked up in the shared layer, which is read in place, its thumbnails are never copied.
+     * Only the rows of the given keys are read, and those of files as large as the sources still missing.
+     *
+     * @param sources Sources to look up, as returned by identify()
+     * @return QHash<Key, Entry> Entries for keys that have both a thumbnail on disk and a color,
+     *         keys missing from the result have to go through getImage() and getColor()
+     */
+    QHash<Key, Entry> lookup(const QList<Source>& sources);
+
+    /**
+     * @brief Remember that a source could not be loaded, so that it is skipped until it changes.
+     *
+     * @param source Source as returned by identify()
+     * @param reason Why it could not be loaded
+     */
+    void recordFailure(const Source& source, const QString& reason);
+
+    /**
+     * @brief Find the sources that failed to load before and have not changed since.
+     *        Records of sources that have changed are dropped.
+     *
+     * @param sources Sources to check, as returned by identify()
+     * @return QHash<QString, QString> Reasons of the recorded failures by source path
+     */
+    QHash<QString, QString> lookupFailures(const QList<Source>& sources);
+
+    /**
+     * @brief Collect statistics about the contents and health of the cache, for --cache-info.
+     *
+     * @details Waits for pending writes, reads every table once and lists the cache directory once.
+     * Stale rows and orphaned files are only counted. Nothing is modified if the Manager was constructed
+     * with Options::readOnly, as for --cache-info: the database is opened read-only, no session is
+     * registered and the schema is neither created nor migrated.
+     *
+     * @param sources Current wallpapers as returned by identify(), the hit ratio is estimated against them
+     * @return Info
+     */
+    Info info(const QList<Source>& sources);
+
+    /**
+     * @brief Write every cached thumbnail together with its color to a portable archive.
+     *
+     * @details Entries are keyed by content fingerprint and thumbnail size instead of path or inode,
+     * one per distinct content, so that the archive can be imported on machines with the same images
+     * in different places. Thumbnails are stored as they are, whatever codec they were written with.
+     *
+     * @param path Archive to write, replaced atomically
+     * @return qsizetype Number of exported entries, -1 on failure
+     */
+    qsizetype exportCache(const QString& path);
+
+    /**
+     * @brief Add the entries of an archive written by exportCache() to the cache.
+     *
+     * @details Imported entries are not bound to any path. A source with the same fingerprint and
+     * thumbnail size takes them over on its first lookup, without decoding anything. Entries whose
+     * content is already cached at that size are skipped.
+     *
+     * @param path Archive to read
+     * @return qsizetype Number of imported entries, -1 if the archive cannot be used
+     */
+    qsizetype importCache(const QString& path);
 
     QString getSetting(SettingsType key, const std::function<QString()>& computeFunc = nullptr);
 
     void storeSetting(SettingsType key, const QString& value);
 
   private:
+    // Bytes hashed at each of the start, middle and end of a file by fingerprint()
+    static constexpr qint64 s_FingerprintSampleSize = 64 * 1024;
+    // Segments that end up less than this fraction full after eviction are rewritten
+    static constexpr double s_PackCompactThreshold = 0.5;
+    // Recently resolved keys kept in memory, per kind
+    static constexpr qsizetype s_L1Capacity = 4096;
+    // Name the shared layer is attached to the database connections under
+    static constexpr QLatin1StringView s_SharedSchema{"shared"};
+    // Header of archives written by exportCache(), the version changes with the layout
+    static constexpr quint32 s_ArchiveMagic   = 0x57524341;  // "WRCA"
+    static constexpr quint32 s_ArchiveVersion = 1;
+    // Subdirectory truncated thumbnails are moved to by _verifyThumbnails()
+    static constexpr QLatin1StringView s_QuarantineDir{"quarantine"};
+    // Held by the process running _runCleanup()
+    static constexpr QLatin1StringView s_CleanupLockFile{"cleanup.lock"};
+    // Subdirectory holding the lock files of thumbnails being generated, see Claim
+    static constexpr QLatin1StringView s_ClaimDir{"claims"};
+    // Larger thumbnails whose aspect ratio differs by more than 1 / s_DeriveAspectTolerance are not scaled down
+    static constexpr qint64 s_DeriveAspectTolerance = 100;
+    // Stored in PRAGMA user_version, _setupTables() only runs on databases of an older version
+    static constexpr int s_SchemaVersion = 1;
+    // Keys looked up by a single statement
+    static constexpr qsizetype s_LookupChunkSize = 500;
+
     QDir m_cacheDir;
-    int m_maxEntries;
+    Options m_options;
     QString m_dbPath;
     QString m_connectionPrefix;
+    // Seconds since the epoch, entries accessed since are in use
+    qint64 m_sessionStart;
 
     mutable QMutex m_connectionsMutex;
     mutable QSet<QString> m_connectionNames;
 
     mutable QMutex m_hotKeysMutex;
-    mutable QSet<QString> m_hotColorKeys;
-    mutable QSet<QString> m_hotImageKeys;
+    mutable QSet<Key> m_hotColorKeys;
+    mutable QSet<Key> m_hotImageKeys;
 
     QFuture<void> m_cleanupFuture;
 
+    // All image/color cache writes go through here, constructed after the schema is set up
+    std::unique_ptr<Writer> m_writer;
+
+    std::unique_ptr<Pack> m_pack;
+    // Packs of the shared layer, only read from, null if there is no shared layer
+    std::unique_ptr<Pack> m_sharedPack;
+    // Known locations of packed thumbnails, so that ImageProvider rarely has to query the database
+    mutable QReadWriteLock m_packIndexLock;
+    QHash<Key, PackLocation> m_packIndex;
+    // Thumbnails served in place from the shared layer, by the key they were found for, under m_packIndexLock
+    struct SharedImage {
+        QString fileName;       ///< Relative to sharedDir
+        PackLocation location;  ///< Valid if packed, in m_sharedPack
+    };
+    QHash<Key, SharedImage> m_sharedIndex;
+
+    // Single-flight resolution and L1 of getImage() / getColor()
+    SingleFlight<QFileInfo> m_imageFlights{s_L1Capacity};
+    SingleFlight<Colors> m_colorFlights{s_L1Capacity};
+
+    struct Reconciliation {
+        QList<Key> stale;     ///< Rows whose file is missing
+        QStringList orphans;  ///< Loose thumbnails no row refers to
+    };
+
     QSqlDatabase _db() const;
     void _setupTables(QSqlDatabase& db) const;
+    void _attachShared(QSqlDatabase& db) const;
+    Colors _resolveColor(const Source& source, const std::function<Colors()>& computeFunc);
+    QFileInfo _resolveImage(const Source& source, const std::function<Thumbnail()>& computeFunc);
+    QFileInfo _cachedImage(QSqlDatabase& db, Key key);
+    QFileInfo _generateImage(const Source& source, const std::function<Thumbnail()>& computeFunc);
+    QFileInfo _storeImage(const Source& source, const QByteArray& bytes, const QString& suffix, int alignment);
+    QFileInfo _sharedImage(QSqlDatabase& db, const Source& source);
+    QFileInfo _serveShared(Key key, const QString& fileName, const PackLocation& location);
+    QHash<Key, Entry> _lookupShared(QSqlDatabase& db, const QList<Source>& sources, const QHash<Key, Entry>& found);
+    QFileInfo _deriveImage(QSqlDatabase& db, const Source& source);
+    Claim _claimImage(Key key);
+    qint64 _oldestSession(QSqlDatabase& db, bool* shared) const;
+    Reconciliation _reconcile(QSqlDatabase& db) const;
+    void _verifyThumbnails(QSqlDatabase& db, qint64 since);
     void _runCleanup();
+    qint64 _compactPacks(QSqlDatabase& db);
 };
 
 }  // namespace WallReel::Core::Cache
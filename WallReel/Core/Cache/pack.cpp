@@ -0,0 +1,195 @@
+#include "pack.hpp"
+
+#include <QReadLocker>
+#include <QScopeGuard>
+#include <QWriteLocker>
+#include <sys/file.h>
+
+#include "codec.hpp"
+#include "logger.hpp"
+
+WALLREEL_DECLARE_SENDER("CachePack")
+
+using namespace Qt::StringLiterals;
+
+namespace WallReel::Core::Cache {
+
+Pack::Pack(const QDir& dir, Durability durability) : m_dir(dir), m_durability(durability) {}
+
+Pack::~Pack() = default;
+
+QString Pack::segmentFileName(int segment) {
+    return u"pack-%1.seg"_s.arg(segment, 6, 10, QChar(u'0'));
+}
+
+bool Pack::isSegmentFile(const QString& fileName) {
+    return fileName.startsWith("pack-"_L1) && fileName.endsWith(".seg"_L1);
+}
+
+template <typename Func>
+bool Pack::_withMapped(const PackLocation& location, Func&& func) const {
+    if (!location.isValid())
+        return false;
+    const qint64 end = location.offset + location.length;
+
+    {
+        QReadLocker lock(&m_mapLock);
+        auto it = m_mappings.constFind(location.segment);
+        if (it != m_mappings.cend() && it->size >= end) {
+            func(it->data + location.offset, it->file);
+            return true;
+        }
+    }
+
+    QWriteLocker lock(&m_mapLock);
+    Mapping& mapping = m_mappings[location.segment];
+    if (mapping.size < end) {
+        // Not mapped yet, or the segment has grown since it was mapped
+        mapping   = {};
+        auto file = std::make_shared<QFile>(m_dir.filePath(segmentFileName(location.segment)));
+        if (!file->open(QIODevice::ReadOnly)) {
+            WR_WARN(u"Cannot open pack segment %1: %2"_s.arg(file->fileName(), file->errorString()));
+            m_mappings.remove(location.segment);
+            return false;
+        }
+        const qint64 size = file->size();
+        uchar* data       = size >= end ? file->map(0, size) : nullptr;
+        if (!data) {
+            WR_WARN(u"Cannot map pack segment %1 (%2 byte(s), need %3)"_s
+                        .arg(file->fileName())
+                        .arg(size)
+                        .arg(end));
+            m_mappings.remove(location.segment);
+            return false;
+        }
+        mapping = {std::move(file), data, size};
+    }
+    func(mapping.data + location.offset, mapping.file);
+    return true;
+}
+
+PackLocation Pack::append(const QByteArray& data, int alignment) {
+    if (data.isEmpty())
+        return {};
+
+    QMutexLocker lock(&m_appendMutex);
+    if (!m_current || (m_currentSize > 0 && m_currentSize + alignment + data.size() > s_MaxSegmentSize)) {
+        if (!_openNextSegment())
+            return {};
+    }
+
+    // Other processes may append to the same segment, the offset is only known while holding its lock
+    const int fd = m_current->handle();
+    if (::flock(fd, LOCK_EX) != 0) {
+        WR_WARN(u"Failed to lock %1"_s.arg(m_current->fileName()));
+        return {};
+    }
+    const auto unlock = qScopeGuard([fd] { ::flock(fd, LOCK_UN); });
+    m_currentSize     = m_current->size();
+
+    if (const qint64 padding = (alignment - m_currentSize % alignment) % alignment; padding > 0) {
+        if (m_current->write(QByteArray(padding, '\0')) != padding) {
+            WR_WARN(u"Failed to pad %1: %2"_s.arg(m_current->fileName(), m_current->errorString()));
+            m_currentSize = m_current->size();
+            return {};
+        }
+        m_currentSize += padding;
+    }
+
+    const qint64 offset = m_currentSize;
+    if (m_current->write(data) != data.size()) {
+        WR_WARN(u"Failed to append %1 byte(s) to %2: %3"_s
+                    .arg(data.size())
+                    .arg(m_current->fileName(), m_current->errorString()));
+        // Skip whatever was partially written, it is unreferenced and reclaimed by compaction
+        m_currentSize = m_current->size();
+        return {};
+    }
+    m_currentSize += data.size();
+    // The location is recorded right after this returns, it must not point past the end after a power loss
+    if (m_durability != Durability::Off && !syncFile(*m_current))
+        return {};
+    return {m_currentSegment, offset, data.size()};
+}
+
+QByteArray Pack::read(const PackLocation& location) const {
+    QByteArray ret;
+    _withMapped(location, [&](const uchar* data, const std::shared_ptr<QFile>&) {
+        ret = QByteArray(reinterpret_cast<const char*>(data), location.length);
+    });
+    return ret;
+}
+
+QImage Pack::readImage(const PackLocation& location) const {
+    QImage ret;
+    _withMapped(location, [&](const uchar* data, const std::shared_ptr<QFile>& file) {
+        // Raw thumbnails keep the mapping alive instead of being copied out of it
+        ret = decodeThumbnail(data, location.length, file);
+    });
+    return ret;
+}
+
+QHash<int, qint64> Pack::segments() const {
+    QHash<int, qint64> ret;
+    const auto infos = QDir(m_dir.path()).entryInfoList({u"pack-*.seg"_s}, QDir::Files);
+    for (const QFileInfo& info : infos) {
+        bool ok           = false;
+        const int segment = info.completeBaseName().mid(5).toInt(&ok);
+        if (ok)
+            ret.insert(segment, info.size());
+    }
+    return ret;
+}
+
+int Pack::currentSegment() const {
+    QMutexLocker lock(&m_appendMutex);
+    return m_currentSegment;
+}
+
+bool Pack::removeSegment(int segment) {
+    {
+        QMutexLocker lock(&m_appendMutex);
+        if (segment == m_currentSegment)
+            return false;
+    }
+    {
+        QWriteLocker lock(&m_mapLock);
+        // Closing the file unmaps it
+        m_mappings.remove(segment);
+    }
+    const QString path = m_dir.filePath(segmentFileName(segment));
+    if (!QFile::remove(path)) {
+        WR_WARN(u"Failed to remove pack segment %1"_s.arg(path));
+        return false;
+    }
+    WR_DEBUG(u"Removed pack segment %1"_s.arg(path));
+    return true;
+}
+
+/// Called with m_appendMutex held.
+bool Pack::_openNextSegment() {
+    int next = m_currentSegment + 1;
+    if (m_currentSegment < 0) {
+        // Resume the newest segment from a previous run if it still has room
+        const auto existing = segments();
+        int last            = -1;
+        for (auto it = existing.cbegin(); it != existing.cend(); ++it)
+            last = std::max(last, it.key());
+        next = (last >= 0 && existing.value(last) < s_MaxSegmentSize) ? last : last + 1;
+    }
+
+    auto file = std::make_unique<QFile>(m_dir.filePath(segmentFileName(next)));
+    if (!file->open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Unbuffered)) {
+        WR_WARN(u"Cannot open pack segment %1: %2"_s.arg(file->fileName(), file->errorString()));
+        return false;
+    }
+    if (m_durability == Durability::Full)
+        syncDirectory(m_dir.path());
+    WR_DEBUG(u"Appending to pack segment %1"_s.arg(file->fileName()));
+    m_currentSize    = file->size();
+    m_current        = std::move(file);
+    m_currentSegment = next;
+    return true;
+}
+
+}  // namespace WallReel::Core::Cache
@@ -0,0 +1,118 @@
+#ifndef WALLREEL_CACHE_PACK_HPP
+#define WALLREEL_CACHE_PACK_HPP
+
+#include <QDir>
+#include <QFile>
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QReadWriteLock>
+#include <memory>
+
+#include "durability.hpp"
+#include "types.hpp"
+
+namespace WallReel::Core::Cache {
+
+/**
+ * @brief Append-only segment files holding encoded thumbnails.
+ *
+ * @details Thumbnails are appended to the current segment (pack-NNNNNN.seg in the cache directory)
+ * until it reaches s_MaxSegmentSize, then a new segment is started. Where a thumbnail lives is recorded
+ * as a PackLocation in the image_cache table. Segments are mmap()ed on first read and served from memory
+ * afterwards. Evicted thumbnails leave holes behind, which are reclaimed by rewriting mostly-empty
+ * segments (see Manager::_compactPacks()). Several processes may append to the same segment, appends are
+ * serialized with an advisory lock on the segment file.
+ */
+class Pack {
+  public:
+    static constexpr qint64 s_MaxSegmentSize = 64ll * 1024 * 1024;
+
+    /**
+     * @brief Construct a new Pack object
+     *
+     * @param dir Directory holding the segments
+     * @param durability Unless Durability::Off, appended data is synced before append() returns
+     */
+    explicit Pack(const QDir& dir, Durability durability = Durability::Normal);
+
+    ~Pack();
+
+    Pack(const Pack&)            = delete;
+    Pack& operator=(const Pack&) = delete;
+
+    static QString segmentFileName(int segment);
+
+    /**
+     * @brief Check whether the given file name (not path) belongs to a segment file.
+     */
+    static bool isSegmentFile(const QString& fileName);
+
+    /**
+     * @brief Append data to the current segment.
+     *
+     * @param data Bytes to append
+     * @param alignment Required alignment of the data's offset in the segment
+     * @return PackLocation Where the data was written, invalid on failure
+     */
+    PackLocation append(const QByteArray& data, int alignment = 1);
+
+    /**
+     * @brief Copy the bytes at the given location out of the (mapped) segment.
+     *
+     * @return QByteArray Empty if the location cannot be read
+     */
+    QByteArray read(const PackLocation& location) const;
+
+    /**
+     * @brief Decode the image at the given location straight from the mapped segment.
+     *        Raw thumbnails are used in place, see decodeThumbnail().
+     *
+     * @return QImage Null if the location cannot be read or decoded
+     */
+    QImage readImage(const PackLocation& location) const;
+
+    /**
+     * @brief Get the sizes of all segment files on disk, keyed by segment number.
+     */
+    QHash<int, qint64> segments() const;
+
+    /**
+     * @brief The segment new data is currently appended to, -1 if none has been opened yet.
+     */
+    int currentSegment() const;
+
+    /**
+     * @brief Unmap and delete a segment file. The current segment cannot be removed.
+     */
+    bool removeSegment(int segment);
+
+  private:
+    struct Mapping {
+        std::shared_ptr<QFile> file;
+        uchar* data = nullptr;
+        qint64 size = 0;
+    };
+
+    QDir m_dir;
+    Durability m_durability;
+
+    mutable QMutex m_appendMutex;
+    std::unique_ptr<QFile> m_current;
+    int m_currentSegment = -1;
+    qint64 m_currentSize = 0;
+
+    mutable QReadWriteLock m_mapLock;
+    mutable QHash<int, Mapping> m_mappings;
+
+    bool _openNextSegment();
+
+    /// Runs func(const uchar*, const std::shared_ptr<QFile>&) on the mapped bytes and the file owning the mapping,
+    /// while holding the map lock.
+    template <typename Func>
+    bool _withMapped(const PackLocation& location, Func&& func) const;
+};
+
+}  // namespace WallReel::Core::Cache
+
+#endif  // WALLREEL_CACHE_PACK_HPP
@@ -0,0 +1,154 @@
+#ifndef WALLREEL_CACHE_SINGLEFLIGHT_HPP
+#define WALLREEL_CACHE_SINGLEFLIGHT_HPP
+
+#include <QCache>
+#include <QColor>
+#include <QFileInfo>
+#include <QFuture>
+#include <QHash>
+#include <QMutex>
+#include <QPromise>
+#include <QtConcurrent>
+#include <atomic>
+#include <functional>
+#include <memory>
+
+#include "types.hpp"
+
+namespace WallReel::Core::Cache {
+
+/// Whether a result is worth remembering, failures are handed out but tried again on the next request.
+inline bool isResolved(const QFileInfo& file) { return !file.filePath().isEmpty(); }
+
+inline bool isResolved(const Colors& colors) { return colors.dominant.isValid(); }
+
+/**
+ * @brief Deduplicates concurrent resolutions of the same key and remembers recent results.
+ *
+ * @details The first caller for a key resolves it, callers arriving while it is being resolved wait for
+ * and share that result instead of resolving the key again. Resolved results are kept in a small in-memory
+ * LRU map (L1), so that repeated requests do not reach the database at all.
+ *
+ * @tparam T Result type, see isResolved()
+ */
+template <typename T>
+class SingleFlight {
+  public:
+    using Resolver = std::function<T()>;
+
+    /**
+     * @brief Construct a new SingleFlight object
+     *
+     * @param capacity Max number of results kept in L1
+     */
+    explicit SingleFlight(qsizetype capacity) { m_resolved.setMaxCost(capacity); }
+
+    ~SingleFlight() { waitForPending(); }
+
+    SingleFlight(const SingleFlight&)            = delete;
+    SingleFlight& operator=(const SingleFlight&) = delete;
+
+    /**
+     * @brief Resolve key on the calling thread, or wait for the caller already resolving it.
+     *
+     * @param key
+     * @param resolve Only called if key is neither in L1 nor being resolved
+     * @return T
+     */
+    T run(Key key, const Resolver& resolve) {
+        std::shared_ptr<QPromise<T>> promise;
+        {
+            QMutexLocker lk(&m_mutex);
+            if (const T* value = m_resolved.object(key))
+                return *value;
+            if (const auto it = m_inFlight.constFind(key); it != m_inFlight.cend()) {
+                QFuture<T> shared = *it;
+                lk.unlock();
+                return shared.result();
+            }
+            promise = std::make_shared<QPromise<T>>();
+            promise->start();
+            m_inFlight.insert(key, promise->future());
+        }
+
+        const T value = resolve();
+        {
+            QMutexLocker lk(&m_mutex);
+            m_inFlight.remove(key);
+            if (isResolved(value))
+                m_resolved.insert(key, new T(value));
+        }
+        promise->addResult(value);
+        promise->finish();
+        return value;
+    }
+
+    /**
+     * @brief Resolve key in the global thread pool, unless it is in L1 or already being resolved.
+     *
+     * @details A key only counts as being resolved once the task resolving it has started, so that
+     * callers waiting for it never wait for a task stuck in the queue behind themselves.
+     *
+     * @param key
+     * @param resolve Called from a pool thread
+     * @return QFuture<T>
+     */
+    QFuture<T> runAsync(Key key, Resolver resolve) {
+        {
+            QMutexLocker lk(&m_mutex);
+            if (const T* value = m_resolved.object(key)) {
+                QPromise<T> ready;
+                ready.start();
+                ready.addResult(*value);
+                ready.finish();
+                return ready.future();
+            }
+            if (const auto it = m_inFlight.constFind(key); it != m_inFlight.cend())
+                return *it;
+        }
+        m_pending.fetch_add(1, std::memory_order_relaxed);
+        return QtConcurrent::run([this, key, resolve = std::move(resolve)] {
+            const T value = run(key, resolve);
+            if (m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                m_pending.notify_all();
+            return value;
+        });
+    }
+
+    /**
+     * @brief Drop a result from L1, e.g. because the cached file has moved.
+     */
+    void forget(Key key) {
+        QMutexLocker lk(&m_mutex);
+        m_resolved.remove(key);
+    }
+
+    /**
+     * @brief Drop all results from L1.
+     */
+    void clear() {
+        QMutexLocker lk(&m_mutex);
+        m_resolved.clear();
+    }
+
+    /**
+     * @brief Block until every resolution started by runAsync() has finished.
+     */
+    void waitForPending() {
+        int pending = m_pending.load(std::memory_order_acquire);
+        while (pending != 0) {
+            m_pending.wait(pending, std::memory_order_acquire);
+            pending = m_pending.load(std::memory_order_acquire);
+        }
+    }
+
+  private:
+    QMutex m_mutex;
+    QHash<Key, QFuture<T>> m_inFlight;  ///< Keys being resolved, with the future of their result
+    QCache<Key, T> m_resolved;          ///< L1, least recently used results are dropped first
+    std::atomic<int> m_pending{0};      ///< Number of unfinished runAsync() resolutions
+};
+
+}  // namespace WallReel::Core::Cache
+
+#endif  // WALLREEL_CACHE_SINGLEFLIGHT_HPP
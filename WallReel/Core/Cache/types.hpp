@@ -3,6 +3,11 @@
 
 #include <QColor>
 #include <QFileInfo>
+#include <QImage>
+#include <QList>
+#include <QSize>
+#include <QString>
+#include <QStringList>
 #include <cstdint>
 #include <type_traits>
 #include <variant>
@@ -14,6 +19,7 @@ enum class Type : uint32_t {
     Image    = 1,       ///< Cache for processed images
     Color    = 1 << 1,  ///< Cache for dominant colors
     Settings = 1 << 2,  ///< Cache for settings (simple key-value pairs)
+    Failure  = 1 << 3,  ///< Records of images that failed to load
     All      = ~0u
 };
 
@@ -29,10 +35,101 @@ inline constexpr Type operator&(Type a, Type b) {
 
 using Data = std::variant<std::monostate, QFileInfo, QColor>;
 
+/**
+ * @brief Cache key of an image at a given thumbnail size, see Manager::identify()
+ */
+using Key = quint64;
+
+/**
+ * @brief Fixed width hex representation of a key, as used in urls and file names
+ */
+inline QString keyToString(Key key) {
+    return QString("%1").arg(key, 16, 16, QChar('0'));
+}
+
+inline Key stringToKey(const QString& str, bool* ok = nullptr) {
+    return str.toULongLong(ok, 16);
+}
+
+/**
+ * @brief Representative colors as stored in color_cache, "#rrggbb" names separated by spaces
+ */
+inline QString paletteToString(const QList<QColor>& palette) {
+    QStringList names;
+    names.reserve(palette.size());
+    for (const QColor& color : palette)
+        names.append(color.name());
+    return names.join(' ');
+}
+
+inline QList<QColor> stringToPalette(const QString& str) {
+    QList<QColor> palette;
+    for (const auto name : QStringView(str).split(' ', Qt::SkipEmptyParts)) {
+        const QColor color = QColor::fromString(name);
+        if (color.isValid())
+            palette.append(color);
+    }
+    return palette;
+}
+
+/**
+ * @brief Identity of a source image, as recorded alongside its cached thumbnail
+ */
+struct Source {
+    Key key      = 0;
+    Key colorKey = 0;    ///< Cache key of the dominant color, the same at every thumbnail size
+    QString path;        ///< Absolute path of the source image
+    qint64 size    = 0;  ///< File size in bytes
+    qint64 mtimeNs = 0;  ///< Modification time in nanoseconds since epoch
+    QSize thumbnailSize;
+    quint64 fingerprint = 0;  ///< Content fingerprint, 0 if not computed, see Manager::fingerprint()
+};
+
+/**
+ * @brief Location of a thumbnail inside a pack segment, see Pack
+ */
+struct PackLocation {
+    int segment   = -1;
+    qint64 offset = 0;
+    qint64 length = 0;
+
+    bool isValid() const { return segment >= 0 && length > 0; }
+};
+
+/**
+ * @brief A cached thumbnail together with its dominant color, as resolved by Manager::lookup()
+ */
+struct Entry {
+    QFileInfo image;
+    QColor color;
+    PackLocation location;    ///< Valid if the thumbnail is stored in a pack segment, image is the segment file then
+    quint64 fingerprint = 0;  ///< Content fingerprint of the source, 0 if unknown
+    Key colorKey        = 0;  ///< Key the color is stored under, see Source::colorKey
+    QList<QColor> palette;    ///< Representative colors stored with the color, empty if there are none yet
+};
+
+/**
+ * @brief A freshly computed thumbnail handed to Manager::getImage()
+ */
+struct Thumbnail {
+    QImage image;        ///< Pixels, encoded with the configured codec unless encoded is set
+    QByteArray encoded;  ///< Already encoded bytes to be stored as they are instead, if not empty
+    QString suffix;      ///< File suffix matching encoded, e.g. "png"
+};
+
+/**
+ * @brief A dominant color together with its representative colors, as resolved by Manager::getColor()
+ */
+struct Colors {
+    QColor dominant;
+    QList<QColor> palette;  ///< Empty if the color was cached without one
+};
+
 enum class SettingsType : uint32_t {
     LastSelectedPalette = 0,
     LastSortType,
     LastSortDescending,
+    ThumbnailsVerifiedAt,  ///< Start of the last session whose thumbnails have been checked for truncation
 };
 
 }  // namespace WallReel::Core::Cache
@@ -0,0 +1,305 @@
+#include "writer.hpp"
+
+#include <QDateTime>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+
+#include "logger.hpp"
+
+WALLREEL_DECLARE_SENDER("CacheWriter")
+
+using namespace Qt::StringLiterals;
+
+namespace WallReel::Core::Cache {
+
+Writer::Writer(const QString& dbPath, const QString& connectionName, Durability durability)
+    : m_dbPath(dbPath),
+      m_connectionName(connectionName),
+      m_durability(durability),
+      m_head(&m_stub),
+      m_tail(&m_stub) {
+    m_thread.reset(QThread::create([this] { _run(); }));
+    m_thread->start();
+}
+
+Writer::~Writer() {
+    m_stopping.store(true, std::memory_order_release);
+    m_wake.fetch_add(1, std::memory_order_release);
+    m_wake.notify_one();
+    // The writer thread only exits once everything enqueued so far has been applied.
+    m_thread->wait();
+}
+
+void Writer::enqueue(Op op) {
+    auto* node = new Node;
+    node->op   = std::move(op);
+    _push(node);
+    m_enqueued.fetch_add(1, std::memory_order_release);
+    m_wake.fetch_add(1, std::memory_order_release);
+    m_wake.notify_one();
+}
+
+void Writer::flush() {
+    const uint64_t target = m_enqueued.load(std::memory_order_acquire);
+    uint64_t applied      = m_applied.load(std::memory_order_acquire);
+    while (applied < target) {
+        m_applied.wait(applied, std::memory_order_acquire);
+        applied = m_applied.load(std::memory_order_acquire);
+    }
+}
+
+void Writer::_push(Node* node) {
+    node->next.store(nullptr, std::memory_order_relaxed);
+    Node* prev = m_head.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+}
+
+/// Consumer side, only called from the writer thread.
+/// Returns nullptr if the queue is empty or a producer is in the middle of a push.
+Writer::Node* Writer::_pop() {
+    Node* tail = m_tail;
+    Node* next = tail->next.load(std::memory_order_acquire);
+    if (tail == &m_stub) {
+        if (!next)
+            return nullptr;
+        m_tail = next;
+        tail   = next;
+        next   = next->next.load(std::memory_order_acquire);
+    }
+    if (next) {
+        m_tail = next;
+        return tail;
+    }
+    if (tail != m_head.load(std::memory_order_acquire))
+        return nullptr;
+    _push(&m_stub);
+    next = tail->next.load(std::memory_order_acquire);
+    if (next) {
+        m_tail = next;
+        return tail;
+    }
+    return nullptr;
+}
+
+void Writer::_run() {
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase(u"QSQLITE"_s, m_connectionName);
+        db.setDatabaseName(m_dbPath);
+        if (db.open()) {
+            QSqlQuery q(db);
+            q.exec(u"PRAGMA journal_mode=WAL"_s);
+            q.exec(synchronousPragma(m_durability));
+            WR_DEBUG(u"Opened cache writer connection [%1]"_s.arg(m_connectionName));
+        } else {
+            WR_WARN(u"Cannot open cache database for writing %1: %2, cache writes will be dropped"_s
+                        .arg(m_dbPath, db.lastError().text()));
+        }
+
+        QSqlQuery insertImage(db), insertColor(db), touchImage(db), touchColor(db), deleteImage(db), deleteColor(db), moveImage(db);
+        QSqlQuery repointImage(db), repointColor(db);
+        QSqlQuery stageEvicted(db), clearEvicted(db), evictImages(db), evictColors(db);
+        QSqlQuery insertFailure(db), deleteFailure(db), storePalette(db), insertMatch(db), evictMatches(db);
+        if (db.isOpen()) {
+            // Access times are seconds since the epoch, bound by apply()
+            insertImage.prepare(
+                u"INSERT OR REPLACE INTO image_cache "
+                "(key, file_name, pack_segment, pack_offset, pack_length, "
+                " source_path, source_size, source_mtime, width, height, fingerprint, file_size, color_key, last_accessed) "
+                "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)"_s);
+            insertColor.prepare(
+                u"INSERT OR REPLACE INTO color_cache (key, r, g, b, a, palette, last_accessed) "
+                "VALUES (?, ?, ?, ?, ?, ?, ?)"_s);
+            touchImage.prepare(u"UPDATE image_cache SET last_accessed = ? WHERE key = ?"_s);
+            touchColor.prepare(u"UPDATE color_cache SET last_accessed = ? WHERE key = ?"_s);
+            deleteImage.prepare(u"DELETE FROM image_cache WHERE key = ?"_s);
+            deleteColor.prepare(u"DELETE FROM color_cache WHERE key = ?"_s);
+            moveImage.prepare(
+                u"UPDATE image_cache SET file_name = ?, pack_segment = ?, pack_offset = ?, pack_length = ? "
+                "WHERE key = ?"_s);
+            // OR REPLACE: a row for the new key may have been inserted in the meantime
+            repointImage.prepare(u"UPDATE OR REPLACE image_cache SET key = ?, source_path = ?, color_key = ? WHERE key = ?"_s);
+            repointColor.prepare(
+                u"UPDATE OR REPLACE color_cache SET key = ? "
+                "WHERE key = (SELECT color_key FROM image_cache WHERE key = ?)"_s);
+            // Keys to evict are staged in a temporary table of this connection and deleted in one go
+            QSqlQuery(db).exec(u"CREATE TEMP TABLE IF NOT EXISTS evicted (key INTEGER PRIMARY KEY)"_s);
+            stageEvicted.prepare(u"INSERT OR IGNORE INTO temp.evicted (key) VALUES (?)"_s);
+            clearEvicted.prepare(u"DELETE FROM temp.evicted"_s);
+            evictImages.prepare(u"DELETE FROM image_cache WHERE key IN (SELECT key FROM temp.evicted)"_s);
+            evictColors.prepare(u"DELETE FROM color_cache WHERE key IN (SELECT key FROM temp.evicted)"_s);
+            insertFailure.prepare(
+                u"INSERT OR REPLACE INTO failed_cache (path, size, mtime, reason, failed_at) "
+                "VALUES (?, ?, ?, ?, ?)"_s);
+            deleteFailure.prepare(u"DELETE FROM failed_cache WHERE path = ?"_s);
+            storePalette.prepare(u"UPDATE color_cache SET palette = ? WHERE key = ?"_s);
+            insertMatch.prepare(u"INSERT OR REPLACE INTO palette_match (palette_hash, color_key, color_name) VALUES (?, ?, ?)"_s);
+            evictMatches.prepare(u"DELETE FROM palette_match WHERE color_key IN (SELECT key FROM temp.evicted)"_s);
+        }
+
+        // NULL columns for thumbnails stored as loose files
+        const auto bindLocation = [](QSqlQuery& query, int pos, const PackLocation& location) {
+            const bool packed = location.isValid();
+            query.bindValue(pos, packed ? QVariant(location.segment) : QVariant());
+            query.bindValue(pos + 1, packed ? QVariant(location.offset) : QVariant());
+            query.bindValue(pos + 2, packed ? QVariant(location.length) : QVariant());
+        };
+
+        const auto apply = [&](const Op& op) {
+            if (!db.isOpen())
+                return;
+            // Keys are stored as signed 64-bit integers
+            const qint64 key = static_cast<qint64>(op.key);
+            const qint64 now = QDateTime::currentSecsSinceEpoch();
+            QSqlQuery* query = nullptr;
+            switch (op.kind) {
+                case Op::Kind::InsertImage:
+                    query = &insertImage;
+                    query->bindValue(0, key);
+                    query->bindValue(1, op.fileName);
+                    bindLocation(*query, 2, op.location);
+                    query->bindValue(5, op.source.path);
+                    query->bindValue(6, op.source.size);
+                    query->bindValue(7, op.source.mtimeNs);
+                    query->bindValue(8, op.source.thumbnailSize.width());
+                    query->bindValue(9, op.source.thumbnailSize.height());
+                    query->bindValue(10, op.source.fingerprint ? QVariant(static_cast<qint64>(op.source.fingerprint)) : QVariant());
+                    query->bindValue(11, op.fileSize);
+                    query->bindValue(12, static_cast<qint64>(op.source.colorKey));
+                    query->bindValue(13, now);
+                    break;
+                case Op::Kind::InsertColor:
+                    query = &insertColor;
+                    query->bindValue(0, key);
+                    query->bindValue(1, op.color.red());
+                    query->bindValue(2, op.color.green());
+                    query->bindValue(3, op.color.blue());
+                    query->bindValue(4, op.color.alpha());
+                    query->bindValue(5, op.palette.isEmpty() ? QVariant() : QVariant(paletteToString(op.palette)));
+                    query->bindValue(6, now);
+                    break;
+                case Op::Kind::TouchImage:
+                    query = &touchImage;
+                    query->bindValue(0, now);
+                    query->bindValue(1, key);
+                    break;
+                case Op::Kind::TouchColor:
+                    query = &touchColor;
+                    query->bindValue(0, now);
+                    query->bindValue(1, key);
+                    break;
+                case Op::Kind::DeleteImage:
+                    query = &deleteImage;
+                    query->bindValue(0, key);
+                    break;
+                case Op::Kind::DeleteColor:
+                    query = &deleteColor;
+                    query->bindValue(0, key);
+                    break;
+                case Op::Kind::MoveImage:
+                    query = &moveImage;
+                    query->bindValue(0, op.fileName);
+                    bindLocation(*query, 1, op.location);
+                    query->bindValue(4, key);
+                    break;
+                case Op::Kind::Repoint:
+                    // Before the image row, which refers to the color by its old key
+                    repointColor.bindValue(0, static_cast<qint64>(op.source.colorKey));
+                    repointColor.bindValue(1, key);
+                    if (!repointColor.exec())
+                        WR_WARN(u"Cache write failed [%1]: %2"_s.arg(keyToString(op.key), repointColor.lastError().text()));
+                    query = &repointImage;
+                    query->bindValue(0, static_cast<qint64>(op.source.key));
+                    query->bindValue(1, op.source.path);
+                    query->bindValue(2, static_cast<qint64>(op.source.colorKey));
+                    query->bindValue(3, key);
+                    break;
+                case Op::Kind::EvictImages:
+                case Op::Kind::EvictColors:
+                    clearEvicted.exec();
+                    for (const Key k : op.keys) {
+                        stageEvicted.bindValue(0, static_cast<qint64>(k));
+                        stageEvicted.exec();
+                    }
+                    if (op.kind == Op::Kind::EvictColors && !evictMatches.exec())
+                        WR_WARN(u"Cache write failed [%1]: %2"_s.arg(keyToString(op.key), evictMatches.lastError().text()));
+                    query = op.kind == Op::Kind::EvictImages ? &evictImages : &evictColors;
+                    break;
+                case Op::Kind::InsertFailure:
+                    query = &insertFailure;
+                    query->bindValue(0, op.source.path);
+                    query->bindValue(1, op.source.size);
+                    query->bindValue(2, op.source.mtimeNs);
+                    query->bindValue(3, op.reason);
+                    query->bindValue(4, now);
+                    break;
+                case Op::Kind::DeleteFailure:
+                    query = &deleteFailure;
+                    query->bindValue(0, op.source.path);
+                    break;
+                case Op::Kind::ReleaseClaim:
+                    // Handled after the commit
+                    return;
+                case Op::Kind::StorePalette:
+                    query = &storePalette;
+                    query->bindValue(0, paletteToString(op.palette));
+                    query->bindValue(1, key);
+                    break;
+                case Op::Kind::InsertMatch:
+                    query = &insertMatch;
+                    query->bindValue(0, static_cast<qint64>(op.paletteHash));
+                    query->bindValue(1, key);
+                    query->bindValue(2, op.colorName);
+                    break;
+            }
+            if (!query->exec())
+                WR_WARN(u"Cache write failed [%1]: %2"_s.arg(keyToString(op.key), query->lastError().text()));
+        };
+
+        uint64_t drained = 0;
+        while (true) {
+            const uint32_t wake     = m_wake.load(std::memory_order_acquire);
+            const uint64_t enqueued = m_enqueued.load(std::memory_order_acquire);
+            if (drained == enqueued) {
+                if (m_stopping.load(std::memory_order_acquire))
+                    break;
+                m_wake.wait(wake, std::memory_order_acquire);
+                continue;
+            }
+
+            const bool inTransaction = db.isOpen() && db.transaction();
+            int batch                = 0;
+            QList<Claim> released;
+            while (batch < s_MaxBatchSize) {
+                Node* node = _pop();
+                if (!node)
+                    break;
+                if (node->op.kind == Op::Kind::ReleaseClaim)
+                    released.push_back(node->op.claim);
+                apply(node->op);
+                delete node;
+                ++batch;
+            }
+            if (inTransaction && !db.commit()) {
+                WR_WARN(u"Failed to commit %1 cache write(s): %2"_s.arg(batch).arg(db.lastError().text()));
+                db.rollback();
+            }
+            // Processes waiting for a claim look up the thumbnail right away, its row has to be visible by now
+            for (Claim& claim : released)
+                releaseClaim(claim);
+
+            if (batch == 0) {
+                // A producer has bumped the counter but not linked its node yet
+                QThread::yieldCurrentThread();
+                continue;
+            }
+            drained += batch;
+            m_applied.store(drained, std::memory_order_release);
+            m_applied.notify_all();
+        }
+    }
+    QSqlDatabase::removeDatabase(m_connectionName);
+    WR_DEBUG(u"Cache writer stopped"_s);
+}
+
+}  // namespace WallReel::Core::Cache
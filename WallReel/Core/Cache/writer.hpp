@@ -0,0 +1,121 @@
+#ifndef WALLREEL_CACHE_WRITER_HPP
+#define WALLREEL_CACHE_WRITER_HPP
+
+#include <QColor>
+#include <QList>
+#include <QString>
+#include <QThread>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include "claim.hpp"
+#include "durability.hpp"
+#include "types.hpp"
+
+namespace WallReel::Core::Cache {
+
+/**
+ * @brief Write-behind actor owning the only writing connection to the cache database.
+ *
+ * @details Any thread may enqueue() operations, which never blocks: operations are pushed onto an
+ * intrusive lock-free MPSC queue and the writer thread is woken up. The writer thread drains the queue
+ * and applies everything that piled up in batched transactions, using prepared statements that are
+ * created once for its connection. Pending operations are flushed when the Writer is destroyed.
+ */
+class Writer {
+  public:
+    struct Op {
+        enum class Kind : uint8_t {
+            InsertImage,    ///< key, fileName, location, fileSize, source (including fingerprint and color key)
+            InsertColor,    ///< key, color, palette (may be empty)
+            TouchImage,     ///< key
+            TouchColor,     ///< key
+            DeleteImage,    ///< key
+            DeleteColor,    ///< key
+            MoveImage,      ///< key, fileName, location
+            Repoint,        ///< key, source: the image and color rows of key now belong to source (renamed or moved)
+            EvictImages,    ///< keys, deleted with a single statement
+            EvictColors,    ///< keys, deleted with a single statement
+            InsertFailure,  ///< source, reason
+            DeleteFailure,  ///< source
+            ReleaseClaim,   ///< key, claim: released once everything queued before it is committed
+            StorePalette,   ///< key, palette, stored next to an existing color
+            InsertMatch,    ///< key (of the color), paletteHash, colorName
+        };
+
+        Kind kind;
+        Key key = 0;
+        QString fileName;
+        QColor color;
+        QList<QColor> palette;
+        PackLocation location;
+        qint64 fileSize = 0;  ///< Bytes taken by the thumbnail on disk
+        Source source;
+        QString reason;
+        QList<Key> keys;
+        quint64 paletteHash = 0;
+        QString colorName;
+        Claim claim;
+    };
+
+    /**
+     * @brief Construct a new Writer object and start the writer thread
+     *
+     * @param dbPath Path to the cache database, the tables must already exist
+     * @param connectionName Name of the QSqlDatabase connection used by the writer thread
+     * @param durability Selects the SQLite synchronous mode of the writer connection
+     */
+    Writer(const QString& dbPath, const QString& connectionName, Durability durability = Durability::Normal);
+
+    /**
+     * @brief Flush all pending operations and stop the writer thread
+     */
+    ~Writer();
+
+    Writer(const Writer&)            = delete;
+    Writer& operator=(const Writer&) = delete;
+
+    /**
+     * @brief Queue an operation, returns immediately
+     */
+    void enqueue(Op op);
+
+    /**
+     * @brief Block until every operation enqueued before this call has been applied
+     */
+    void flush();
+
+  private:
+    struct Node {
+        std::atomic<Node*> next{nullptr};
+        Op op;
+    };
+
+    // Max operations per transaction, so that readers of the WAL are not starved by a huge commit
+    static constexpr int s_MaxBatchSize = 512;
+
+    QString m_dbPath;
+    QString m_connectionName;
+    Durability m_durability;
+
+    // Vyukov intrusive MPSC queue: producers exchange m_head, the writer thread owns m_tail.
+    std::atomic<Node*> m_head;
+    Node* m_tail;
+    Node m_stub;
+
+    std::atomic<uint64_t> m_enqueued{0};  ///< Number of operations pushed
+    std::atomic<uint64_t> m_applied{0};   ///< Number of operations applied (or failed), waited on by flush()
+    std::atomic<uint32_t> m_wake{0};      ///< Bumped on every enqueue and on stop, waited on by the writer thread
+    std::atomic<bool> m_stopping{false};
+
+    std::unique_ptr<QThread> m_thread;
+
+    void _push(Node* node);
+    Node* _pop();
+    void _run();
+};
+
+}  // namespace WallReel::Core::Cache
+
+#endif  // WALLREEL_CACHE_WRITER_HPP
@@ -16,12 +16,14 @@
 // wallpaper.dirs[].path        string  ""      Path to the directory.
 // wallpaper.dirs[].recursive   boolean false   Whether to search the directory recursively.
 // wallpaper.excludes           array   []      Exclude patterns (regex)
+// wallpaper.hideDuplicates     boolean false   Whether to show only one of several identical image files
 //
 // theme.palettes                       array   []
 // theme.palettes[].name                string  ""      Name of the palette
 // theme.palettes[].colors              array   []      List of colors in the palette
 // theme.palettes[].colors[].name       string  ""      Name of the color
 // theme.palettes[].colors[].value      string  ""      Color value in hex format, e.g. "#ff0000" for red
+// theme.colorMetric                    string  "legacy" How palette colors are matched: "legacy" (weighted RGB plus a hue penalty), "cie76", "ciede2000" (most accurate, slowest) or "oklab"
 //
 // action.previewDebounceTime   number  300     Debounce time for preview action in milliseconds
 // action.printSelected         boolean true    Whether to print the selected wallpaper path to stdout on confirm
@@ -45,6 +47,13 @@
 // cache.saveSortMethod         boolean true    Whether to persist the sort type and order
 // cache.savePalette            bool    true    Whether to persist the selected palette
 // cache.maxImageEntries        number  1000    Maximum number of entries in the image cache (older entries will be evicted)
+// cache.packThumbnails         boolean false   Whether to store thumbnails in a few memory-mapped pack files instead of one file per thumbnail
+// cache.thumbnailCodec         string  "jpeg"  How thumbnails are encoded: "jpeg" (smallest), "raw" (uncompressed, loads without decoding) or "qoi" (lossless, fast to decode)
+// cache.fullContentHash        boolean false   Whether to hash whole files instead of sampled ranges when detecting identical images
+// cache.maxBytes               number  0       Maximum total size of cached thumbnails in bytes, least recently used ones are evicted first (0 for no limit)
+// cache.durability             string  "normal" What is synced to disk before a thumbnail is recorded: "off" (nothing), "normal" (the thumbnail) or "full" (also the directory and every database commit)
+// cache.sharedDir              string  "/var/cache/wallreel" Read-only cache shared by all users, consulted by content before a missing thumbnail or color is generated
+// cache.freedesktopThumbnails  string  "read"  How thumbnails other applications share under ~/.cache/thumbnails are used: "off", "read" (cropped from instead of decoding the original) or "write" (also written for originals that had to be decoded)
 
 namespace WallReel::Core::Config {
 
@@ -92,6 +101,7 @@ struct WallpaperConfigItems {
     QStringList paths;
     QList<WallpaperDirConfigItem> dirs;
     QList<QRegularExpression> excludes;
+    bool hideDuplicates = false;
 };
 
 struct ThemeConfigItems {
@@ -106,6 +116,7 @@ struct ThemeConfigItems {
     };
 
     QList<PaletteConfigItem> palettes;
+    QString colorMetric = "legacy";
 };
 
 struct ActionConfigItems {
@@ -136,9 +147,17 @@ struct StyleConfigItems {
 };
 
 struct CacheConfigItems {
-    bool saveSortMethod = true;
-    bool savePalette    = true;
-    int maxImageEntries = 1000;
+    bool saveSortMethod           = true;
+    bool savePalette              = true;
+    int maxImageEntries           = 1000;
+    qint64 maxBytes               = 0;
+    bool packThumbnails           = false;
+    QString thumbnailCodec        = "jpeg";    // "jpeg", "raw" or "qoi"
+    bool fullContentHash          = false;
+    QString durability            = "normal";  // "off", "normal" or "full"
+    QString sharedDir             = "/var/cache/wallreel";
+    QString freedesktopThumbnails = "read";    // "off", "read" or "write"
+    QList<qreal> scaleFactors     = {1.0};     // Device pixel ratios the headless modes generate thumbnails for
 
     static const QString defaultSortType;
     static const QString defaultSortDescending;
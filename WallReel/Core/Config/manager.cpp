@@ -128,6 +128,13 @@ void Manager::_loadWallpaperConfig(const QJsonObject& root) {
             }
         }
     }
+
+    if (config.contains("hideDuplicates")) {
+        const auto& val = config["hideDuplicates"];
+        if (val.isBool()) {
+            m_wallpaperConfig.hideDuplicates = val.toBool();
+        }
+    }
 }
 
 void Manager::_loadThemeConfig(const QJsonObject& root) {
@@ -136,6 +143,18 @@ void Manager::_loadThemeConfig(const QJsonObject& root) {
     }
     const QJsonObject& theme = root["theme"].toObject();
 
+    if (theme.contains("colorMetric")) {
+        const auto& val = theme["colorMetric"];
+        if (val.isString()) {
+            const QString metric = val.toString().toLower();
+            if (metric == "legacy" || metric == "cie76" || metric == "ciede2000" || metric == "oklab") {
+                m_themeConfig.colorMetric = metric;
+            } else {
+                WR_WARN(QString("Unknown color metric in config: %1").arg(val.toString()));
+            }
+        }
+    }
+
     if (!theme.contains("palettes") || !theme["palettes"].isArray()) {
         return;
     }
@@ -319,6 +338,79 @@ void Manager::_loadCacheConfig(const QJsonObject& root) {
             m_cacheConfig.maxImageEntries = val.toInt();
         }
     }
+    if (config.contains("maxBytes")) {
+        const auto& val = config["maxBytes"];
+        if (val.isDouble() && val.toDouble() >= 0) {
+            m_cacheConfig.maxBytes = val.toInteger();
+        }
+    }
+    if (config.contains("packThumbnails")) {
+        const auto& val = config["packThumbnails"];
+        if (val.isBool()) {
+            m_cacheConfig.packThumbnails = val.toBool();
+        }
+    }
+    if (config.contains("thumbnailCodec")) {
+        const auto& val = config["thumbnailCodec"];
+        if (val.isString()) {
+            const QString codec = val.toString().toLower();
+            if (codec == "jpeg" || codec == "raw" || codec == "qoi") {
+                m_cacheConfig.thumbnailCodec = codec;
+            } else {
+                WR_WARN(QString("Unknown thumbnail codec in config: %1").arg(val.toString()));
+            }
+        }
+    }
+    if (config.contains("fullContentHash")) {
+        const auto& val = config["fullContentHash"];
+        if (val.isBool()) {
+            m_cacheConfig.fullContentHash = val.toBool();
+        }
+    }
+    if (config.contains("durability")) {
+        const auto& val = config["durability"];
+        if (val.isString()) {
+            const QString durability = val.toString().toLower();
+            if (durability == "off" || durability == "normal" || durability == "full") {
+                m_cacheConfig.durability = durability;
+            } else {
+                WR_WARN(QString("Unknown cache durability in config: %1").arg(val.toString()));
+            }
+        }
+    }
+    if (config.contains("sharedDir")) {
+        const auto& val = config["sharedDir"];
+        if (val.isString()) {
+            m_cacheConfig.sharedDir = val.toString();
+        }
+    }
+    if (config.contains("freedesktopThumbnails")) {
+        const auto& val = config["freedesktopThumbnails"];
+        if (val.isString()) {
+            const QString mode = val.toString().toLower();
+            if (mode == "off" || mode == "read" || mode == "write") {
+                m_cacheConfig.freedesktopThumbnails = mode;
+            } else {
+                WR_WARN(QString("Unknown freedesktop thumbnail mode in config: %1").arg(val.toString()));
+            }
+        }
+    }
+    if (config.contains("scaleFactors")) {
+        const auto& val = config["scaleFactors"];
+        if (val.isArray()) {
+            QList<qreal> factors;
+            for (const auto& item : val.toArray()) {
+                if (item.isDouble() && item.toDouble() > 0) {
+                    factors.append(item.toDouble());
+                } else {
+                    WR_WARN(QString("Invalid scale factor in config: %1").arg(item.toVariant().toString()));
+                }
+            }
+            if (!factors.isEmpty()) {
+                m_cacheConfig.scaleFactors = factors;
+            }
+        }
+    }
 }
 
 void Manager::scanWallpapers() {
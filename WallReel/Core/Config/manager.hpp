@@ -2,6 +2,7 @@
 #define WALLREEL_CONFIG_MANAGER_HPP
 
 #include <QDir>
+#include <algorithm>
 
 #include "data.hpp"
 
@@ -67,6 +68,42 @@ class Manager : public QObject {
         return QSize{m_styleConfig.imageWidth, m_styleConfig.imageHeight} * m_styleConfig.imageFocusScale;
     }
 
+    /**
+     * @brief Sizes thumbnails are generated at, so that every image is shown without being rescaled:
+     *        the focused size first, then the unfocused one if different, both in device pixels.
+     *
+     * @param devicePixelRatio Of the screen the images are shown on
+     */
+    QList<QSize> getThumbnailSizes(qreal devicePixelRatio = 1.0) const {
+        QList<QSize> sizes{getFocusImageSize() * devicePixelRatio};
+        const QSize unfocused = QSize{m_styleConfig.imageWidth, m_styleConfig.imageHeight} * devicePixelRatio;
+        if (unfocused != sizes.first()) {
+            sizes.append(unfocused);
+        }
+        return sizes;
+    }
+
+    /**
+     * @brief Sizes thumbnails are generated at for screens of several densities at once, largest first and
+     *        without duplicates, so that the others are scaled down from the first one. See getThumbnailSizes(qreal).
+     *
+     * @param devicePixelRatios Of the screens the images may be shown on
+     */
+    QList<QSize> getThumbnailSizes(const QList<qreal>& devicePixelRatios) const {
+        QList<QSize> sizes;
+        for (const qreal ratio : devicePixelRatios) {
+            for (const QSize& size : getThumbnailSizes(ratio)) {
+                if (!sizes.contains(size)) {
+                    sizes.append(size);
+                }
+            }
+        }
+        std::stable_sort(sizes.begin(), sizes.end(), [](const QSize& a, const QSize& b) {
+            return qint64(a.width()) * a.height() > qint64(b.width()) * b.height();
+        });
+        return sizes;
+    }
+
     /**
      * @brief Capture the current state of the configuration and emit stateCaptured() when done
      */
@@ -1,18 +1,36 @@
 #include "data.hpp"
 
 #include <QCryptographicHash>
+#include <QFile>
 #include <QImageReader>
 
 #include "Palette/domcolor.hpp"
+#include "embeddedpreview.hpp"
 #include "logger.hpp"
 
 WALLREEL_DECLARE_SENDER("ImageData")
 
 WallReel::Core::Image::Data* WallReel::Core::Image::Data::create(
     const QString& path,
+    const QList<QSize>& sizes,
+    Cache::Manager& cacheMgr,
+    Freedesktop::Mode freedesktopMode) {
+    Data* ret = new Data(path, sizes, cacheMgr, freedesktopMode);
+    if (!ret->isValid()) {
+        delete ret;
+        return nullptr;
+    }
+    return ret;
+}
+
+WallReel::Core::Image::Data* WallReel::Core::Image::Data::create(
+    const QFileInfo& file,
+    Cache::Key key,
     const QSize& size,
-    Cache::Manager& cacheMgr) {
-    Data* ret = new Data(path, size, cacheMgr);
+    const Cache::Entry& entry,
+    Cache::Manager& cacheMgr,
+    const QList<Tier>& tiers) {
+    Data* ret = new Data(file, key, size, entry, cacheMgr, tiers);
     if (!ret->isValid()) {
         delete ret;
         return nullptr;
@@ -20,15 +38,121 @@ WallReel::Core::Image::Data* WallReel::Core::Image::Data::create(
     return ret;
 }
 
-WallReel::Core::Image::Data::Data(const QString& path, const QSize& targetSize, Cache::Manager& cacheMgr)
-    : m_cacheMgr(cacheMgr), m_file(path), m_targetSize(targetSize) {
-    m_id            = cacheMgr.cacheKey(m_file, m_targetSize);
-    m_cachedFile    = cacheMgr.getImage(m_id, [this]() { return computeImage(); });
-    m_dominantColor = cacheMgr.getColor(m_id, [this]() { return computeDominantColor(loadImageFromCache()); });
-    m_isValid       = m_cachedFile.isFile() && m_dominantColor.isValid();
+// Sources in these formats that already have the target size are cached as they are
+static const QList<QByteArray> s_passthroughFormats = {"jpeg", "png"};
+
+// Scale a thumbnail down to a smaller size of the same aspect ratio, cropping what rounding leaves over
+static QImage scaleThumbnail(const QImage& thumbnail, const QSize& size) {
+    QImage image = thumbnail.scaled(size, Qt::KeepAspectRatioByExpanding, Qt::SmoothTransformation);
+    if (image.size() != size) {
+        image = image.copy((image.width() - size.width()) / 2, (image.height() - size.height()) / 2, size.width(), size.height());
+    }
+    return image;
+}
+
+WallReel::Core::Image::Data::Data(
+    const QString& path,
+    const QList<QSize>& sizes,
+    Cache::Manager& cacheMgr,
+    Freedesktop::Mode freedesktopMode)
+    : m_cacheMgr(cacheMgr), m_file(path), m_targetSize(sizes.first()), m_freedesktopMode(freedesktopMode) {
+    Cache::Source source = Cache::Manager::identify(m_file, m_targetSize);
+    // Reading a few sampled ranges is cheap compared to decoding, and lets copies share their cache entries
+    source.fingerprint = cacheMgr.fingerprint(source.path);
+    // On a miss the dominant color is computed from the thumbnail still in memory instead of decoding it again
+    m_key              = source.key;
+    m_colorKey         = source.colorKey;
+    m_fingerprint      = source.fingerprint;
+    m_id               = Cache::keyToString(m_key);
+    m_cachedFile       = cacheMgr.getImage(source, [this]() {
+        Cache::Thumbnail thumbnail = computeThumbnail(m_targetSize, &m_error);
+        m_thumbnail                = thumbnail.image;
+        m_generated                = !thumbnail.image.isNull();
+        return thumbnail;
+    });
+    m_url              = cacheMgr.imageUrl(m_key, m_cachedFile);
+
+    // The dominant color and the other sizes only depend on the thumbnail still in memory, so they are
+    // requested side by side, and shared with any other request for the same keys
+    QFuture<Cache::Colors> colors;
+    QList<QPair<QSize, QFuture<QFileInfo>>> tierFiles;
+    QList<Cache::Key> tierKeys;
+    if (m_cachedFile.isFile()) {
+        colors = cacheMgr.requestColor(source, [this]() {
+            return computeColors(m_thumbnail.isNull() ? loadImageFromCache() : m_thumbnail);
+        });
+        // The source is decoded only once, unless the target size was cached already
+        for (qsizetype i = 1; i < sizes.size(); ++i) {
+            const QSize size         = sizes[i];
+            Cache::Source tierSource = Cache::Manager::identify(m_file, size);
+            tierSource.fingerprint   = m_fingerprint;
+            tierKeys.append(tierSource.key);
+            tierFiles.append({size, cacheMgr.requestImage(tierSource, [this, size, thumbnail = m_thumbnail]() -> Cache::Thumbnail {
+                Cache::Thumbnail tier = thumbnail.isNull() ? computeThumbnail(size) : Cache::Thumbnail{.image = scaleThumbnail(thumbnail, size)};
+                if (!tier.image.isNull()) {
+                    m_generated = true;
+                }
+                return tier;
+            })});
+        }
+    }
+
+    // Every Data sharing the request gets the palette from the result, whichever of them computed it
+    const Cache::Colors resolved = colors.isValid() ? colors.result() : Cache::Colors{};
+    m_dominantColor              = resolved.dominant;
+    m_palette                    = resolved.palette;
+    m_isValid                    = m_cachedFile.isFile() && m_dominantColor.isValid();
+    if (m_isValid && m_palette.isEmpty()) {
+        // The color was cached without its palette, resolve it here on the worker thread rather than on the UI thread
+        m_palette = cacheMgr.getPalette(m_colorKey, [this]() {
+            return Palette::getPalette(m_thumbnail.isNull() ? loadImageFromCache() : m_thumbnail);
+        });
+    }
+
+    // Waited for even if the color is missing, they refer to this object
+    for (qsizetype i = 0; i < tierFiles.size(); ++i) {
+        const QFileInfo tierFile = tierFiles[i].second.result();
+        if (m_isValid && tierFile.isFile()) {
+            m_tiers.append({tierFiles[i].first, tierKeys[i], cacheMgr.imageUrl(tierKeys[i], tierFile)});
+        }
+    }
+    m_thumbnail = QImage();
+
+    // Broken files are skipped in later runs until they change, failures of the cache itself are not recorded
+    if (!m_isValid && !m_error.isEmpty()) {
+        cacheMgr.recordFailure(source, m_error);
+    }
+}
+
+WallReel::Core::Image::Data::Data(
+    const QFileInfo& file,
+    Cache::Key key,
+    const QSize& targetSize,
+    const Cache::Entry& entry,
+    Cache::Manager& cacheMgr,
+    const QList<Tier>& tiers)
+    : m_cacheMgr(cacheMgr),
+      m_key(key),
+      m_colorKey(entry.colorKey),
+      m_fingerprint(entry.fingerprint),
+      m_id(Cache::keyToString(key)),
+      m_file(file),
+      m_cachedFile(entry.image),
+      m_url(cacheMgr.imageUrl(key, entry.image)),
+      m_targetSize(targetSize),
+      m_tiers(tiers),
+      m_dominantColor(entry.color),
+      m_palette(entry.palette) {
+    // The existence of the cached file has already been checked by the lookup, no need to stat it again
+    m_isValid = !m_cachedFile.filePath().isEmpty() && m_dominantColor.isValid();
 }
 
 QImage WallReel::Core::Image::Data::loadImageFromCache() const {
+    // Packed thumbnails and those QML cannot read itself are served by Cache::ImageProvider
+    if (!m_url.isLocalFile()) {
+        return m_cacheMgr.loadImage(m_key);
+    }
+
     QImageReader reader(m_cachedFile.absoluteFilePath());
 
     if (!reader.canRead()) {
@@ -44,20 +168,40 @@ QImage WallReel::Core::Image::Data::loadImageFromCache() const {
     return image;
 }
 
-QImage WallReel::Core::Image::Data::computeImage() const {
+WallReel::Core::Cache::Thumbnail WallReel::Core::Image::Data::computeThumbnail(const QSize& targetSize, QString* error) const {
     QImageReader reader(m_file.absoluteFilePath());
     if (!reader.canRead()) {
+        if (error) {
+            *error = reader.errorString();
+        }
         WR_WARN("Cannot read image file: " + m_file.absoluteFilePath());
-        return QImage();
+        return {};
     }
 
     const QSize originalSize = reader.size();
 
+    // Sources of exactly the target size are stored as they are, re-encoding them would only lose quality or add bytes
+    if (originalSize == targetSize && s_passthroughFormats.contains(reader.format())) {
+        QFile file(m_file.absoluteFilePath());
+        if (file.open(QIODevice::ReadOnly)) {
+            const QByteArray encoded = file.readAll();
+            // Still decoded once, the dominant color and the smaller tiers are computed from it
+            QImage image = QImage::fromData(encoded, reader.format().constData());
+            if (image.size() == targetSize) {
+                WR_DEBUG("Passing through image file: " + m_file.absoluteFilePath());
+                if (image.format() != QImage::Format_ARGB32_Premultiplied) {
+                    image = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+                }
+                return {.image = image, .encoded = encoded, .suffix = reader.format() == "jpeg" ? "jpg" : "png"};
+            }
+        }
+    }
+
     // Scale the image to fit the target size while maintaining aspect ratio
     QSize processSize = originalSize;
     if (originalSize.isValid()) {
-        double widthRatio  = (double)m_targetSize.width() / originalSize.width();
-        double heightRatio = (double)m_targetSize.height() / originalSize.height();
+        double widthRatio  = (double)targetSize.width() / originalSize.width();
+        double heightRatio = (double)targetSize.height() / originalSize.height();
         double scaleFactor = std::max(widthRatio, heightRatio);
         processSize        = originalSize * scaleFactor;
 
@@ -67,31 +211,54 @@ QImage WallReel::Core::Image::Data::computeImage() const {
         }
     }
 
+    // Cropping from a thumbnail a file manager already made is much cheaper than decoding a multi-megabyte original
     QImage image;
-    if (!reader.read(&image)) {
-        WR_WARN("Failed to read image file: " + m_file.absoluteFilePath());
-        return QImage();
+    if (m_freedesktopMode != Freedesktop::Mode::Off && originalSize.isValid()) {
+        image = Freedesktop::readThumbnail(m_file, processSize);
+    }
+    // Camera JPEGs carry a preview of a megapixel or two, decoding it is a fraction of the work
+    if (image.isNull() && reader.format() == "jpeg") {
+        image = readEmbeddedPreview(m_file.absoluteFilePath(), originalSize, processSize);
+    }
+    if (image.isNull()) {
+        if (!reader.read(&image)) {
+            if (error) {
+                *error = reader.errorString();
+            }
+            WR_WARN("Failed to read image file: " + m_file.absoluteFilePath());
+            return {};
+        }
+        if (m_freedesktopMode == Freedesktop::Mode::Write) {
+            Freedesktop::writeThumbnail(m_file, image);
+        }
     }
 
-    // If reader doesn't support built-in scaling or the image still do not match the target size, do manual scaling
+    // If reader doesn't support built-in scaling, the image was read from a thumbnail or preview,
+    // or the image still do not match the target size, do manual scaling
     if (image.size() != processSize) {
         image = image.scaled(processSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
     }
 
     // Crop to target size if necessary
-    if (image.size() != m_targetSize) {
-        int x = (image.width() - m_targetSize.width()) / 2;
-        int y = (image.height() - m_targetSize.height()) / 2;
-        image = image.copy(x, y, m_targetSize.width(), m_targetSize.height());
+    if (image.size() != targetSize) {
+        int x = (image.width() - targetSize.width()) / 2;
+        int y = (image.height() - targetSize.height()) / 2;
+        image = image.copy(x, y, targetSize.width(), targetSize.height());
     }
 
     // Convert to GPU-friendly format
     if (image.format() != QImage::Format_ARGB32_Premultiplied) {
         image = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
     }
-    return image;
+    return {.image = image};
 }
 
-QColor WallReel::Core::Image::Data::computeDominantColor(const QImage& image) const {
-    return Palette::getDominantColor(image);
+WallReel::Core::Cache::Colors WallReel::Core::Image::Data::computeColors(const QImage& image) const {
+    // The palette comes from the same downscaled image, and is stored along with the color
+    const Palette::Colors colors = Palette::getColors(image);
+    // A null image means the thumbnail could not be loaded, which is not the source's fault
+    if (!colors.dominant.isValid() && !image.isNull()) {
+        m_error = "No dominant color";
+    }
+    return {.dominant = colors.dominant, .palette = colors.palette};
 }
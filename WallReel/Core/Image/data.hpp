@@ -5,24 +5,41 @@
 #include <QFileInfo>
 #include <QImage>
 #include <QUrl>
+#include <atomic>
 
 #include "Cache/manager.hpp"
+#include "freedesktop.hpp"
 
 // Development note
 /*
 Current implementation of image loading and caching:
 1. Generate a unique ID for the image based on:
-    - File path
-    - Last modified timestamp
+    - Device and inode of the file
+    - File size and last modified timestamp
     - Target size (width x height)
-   and use it as the cache key.
+   and use its 64-bit hash as the cache key. Renaming or moving the file does not change the key,
+   entries of images moved to another file system are re-pointed by Cache::Manager::lookup().
+   The dominant color is keyed the same way without the target size, so it survives style changes.
 2. Check if a cached version of the image exists in the cache directory using the generated ID.
     - If so, load the image from the cache and construct the Data object accordingly.
+    - If not, but an identical file (same content fingerprint) has been cached under another path,
+      share its thumbnail and dominant color.
+    - If not, but the image has been cached at a larger size with the same aspect ratio, scale that down.
     - If not:
-        a. Load the original image from disk.
+        a. Load the original image from disk, or a large enough thumbnail another application has already
+           generated for it (see freedesktop.hpp), or a large enough preview embedded in it (see embeddedpreview.hpp).
         b. Scale and crop it to the target size.
-        c. Save the processed image to the cache directory using the generated ID as the filename.
-        d. Construct the Data object with the new generated image.
+        c. Save the processed image to the cache directory using the generated ID as the filename, encoded
+           with the configured codec. Sources of exactly the target size are stored without re-encoding.
+        d. Compute the dominant color and the palette of representative colors from the processed image
+           still in memory, unless they are cached already.
+        e. Construct the Data object with the new generated image.
+3. Repeat step 2 for the unfocused size, if it differs from the focused one. Both sizes are in device pixels,
+   see Config::Manager::getThumbnailSizes(). On a miss the smaller thumbnail is scaled from the larger one
+   still in memory, so the original is decoded once for all sizes.
+   Steps 2 and 3 are done for all images at once by Image::Manager via Cache::Manager::lookup(), so that cache hits
+   are constructed directly from the lookup result and only misses are processed in worker threads.
+   Misses that could not be decoded in a previous run are skipped as long as their size and mtime stay the same.
 
 Why this approach - Main purposes
 - Fast decoding:
@@ -45,41 +62,97 @@ namespace WallReel::Core::Image {
  *
  */
 class Data {
+  public:
+    /**
+     * @brief A thumbnail of the image at one of the other sizes, see Config::Manager::getThumbnailSizes()
+     */
+    struct Tier {
+        QSize size;
+        Cache::Key key = 0;
+        QUrl url;
+    };
+
+  private:
     Cache::Manager& m_cacheMgr;
 
-    QString m_id;                          ///< Unique identifier for the image
-    QFileInfo m_file;                      ///< File information of the image
-    QFileInfo m_cachedFile;                ///< Cached file information for the loaded image
-    QSize m_targetSize;                    ///< Target size for the loaded image
-    QColor m_dominantColor;                ///< Dominant color of the image, used for palette matching
-    QHash<QString, QString> m_colorCache;  ///< Cache for palette color matching results, key is palette name, value is matched color name
+    Cache::Key m_key      = 0;        ///< Cache key of the image
+    Cache::Key m_colorKey = 0;        ///< Cache key of the dominant color and palette
+    quint64 m_fingerprint = 0;        ///< Content fingerprint, equal for identical files, 0 if unknown
+    QString m_id;                     ///< Unique identifier for the image, string form of m_key
+    QFileInfo m_file;                 ///< File information of the image
+    QFileInfo m_cachedFile;           ///< Cached file information for the loaded image
+    QUrl m_url;                       ///< Url the frontend loads the cached image from
+    QSize m_targetSize;               ///< Target size for the loaded image
+    QList<Tier> m_tiers;              ///< Thumbnails at the other sizes, largest first
+    QColor m_dominantColor;           ///< Dominant color of the image, used for palette matching
+    mutable QList<QColor> m_palette;  ///< Representative colors, computed along with the dominant color or loaded with it
+    mutable QString m_error;          ///< Why the image itself could not be loaded, empty if it could or the cache failed
+    QImage m_thumbnail;               ///< Thumbnail of the target size decoded in the constructor, the dominant color and other sizes are derived from it
 
     bool m_isValid = false;
 
-    QImage computeImage() const;
-    QColor computeDominantColor(const QImage& image) const;
+    std::atomic<bool> m_generated = false;  ///< Whether any of its thumbnails was generated rather than found in a cache, set from worker threads
+
+    Freedesktop::Mode m_freedesktopMode = Freedesktop::Mode::Off;  ///< How thumbnails shared by other applications are used
+
+    /**
+     * @brief Decode the source scaled and cropped to targetSize, called from any thread.
+     *
+     * @param error Set to why the source could not be read, if given
+     */
+    Cache::Thumbnail computeThumbnail(const QSize& targetSize, QString* error = nullptr) const;
+    Cache::Colors computeColors(const QImage& image) const;
     QImage loadImageFromCache() const;
 
-    Data(const QString& path, const QSize& size, Cache::Manager& cacheMgr);
+    Data(const QString& path, const QList<QSize>& sizes, Cache::Manager& cacheMgr, Freedesktop::Mode freedesktopMode);
+    Data(const QFileInfo& file, Cache::Key key, const QSize& size, const Cache::Entry& entry, Cache::Manager& cacheMgr, const QList<Tier>& tiers);
 
   public:
     /**
      * @brief Factory method to create a Data instance from a file path. Returns nullptr if loading fails.
      *
      * @param path File path of the image
-     * @param size Target size for loaded image, the image will be scaled and cropped to this size and stored in memory
+     * @param sizes Target size for loaded image, the image will be scaled and cropped to this size and stored in memory,
+     *              followed by the other sizes thumbnails are generated at from the same decoded image
+     * @param freedesktopMode Whether thumbnails other applications generated are cropped from instead of decoding the file,
+     *                        and whether thumbnails are written for them in turn
      * @return Data*
      */
-    static Data* create(const QString& path, const QSize& size, Cache::Manager& cacheMgr);
+    static Data* create(const QString& path, const QList<QSize>& sizes, Cache::Manager& cacheMgr, Freedesktop::Mode freedesktopMode = Freedesktop::Mode::Off);
+
+    /**
+     * @brief Factory method to create a Data instance from an already resolved cache entry
+     *        (see Cache::Manager::lookup()), without touching the cache database. Returns nullptr if the entry is invalid.
+     *
+     * @param file File information of the image
+     * @param key Cache key of the image, as returned by Cache::Manager::identify()
+     * @param size Target size of the cached image
+     * @param entry Cached thumbnail and dominant color
+     * @param tiers Cached thumbnails at the other sizes
+     * @return Data*
+     */
+    static Data* create(const QFileInfo& file, Cache::Key key, const QSize& size, const Cache::Entry& entry, Cache::Manager& cacheMgr, const QList<Tier>& tiers = {});
 
     QSize getTargetSize() const { return m_targetSize; }
 
     QString getId() const { return m_id; }
 
-    QUrl getUrl() const { return QUrl::fromLocalFile(m_cachedFile.absoluteFilePath()); }
+    quint64 getFingerprint() const { return m_fingerprint; }
+
+    QUrl getUrl() const { return m_url; }
+
+    /**
+     * @brief Url of the smallest thumbnail, that of the target size if there are no others
+     */
+    QUrl getThumbnailUrl() const { return m_tiers.isEmpty() ? m_url : m_tiers.last().url; }
 
     bool isValid() const { return m_isValid; }
 
+    /**
+     * @brief Whether the source had to be processed for any of its thumbnails, false if all were cached
+     */
+    bool wasGenerated() const { return m_generated.load(std::memory_order_relaxed); }
+
     QString getFullPath() const { return m_file.absoluteFilePath(); }
 
     QString getFileName() const { return m_file.fileName(); }
@@ -92,16 +165,13 @@ class Data {
 
     const QColor& getDominantColor() const { return m_dominantColor; }
 
-    std::optional<QString> getCachedColor(const QString& paletteName) const {
-        if (m_colorCache.contains(paletteName)) {
-            return m_colorCache.value(paletteName);
-        }
-        return std::nullopt;
-    }
+    /**
+     * @brief Representative colors of the image, most frequent first, see Palette::getPalette().
+     *        Resolved along with the dominant color, empty if there are none.
+     */
+    const QList<QColor>& getPalette() const { return m_palette; }
 
-    void cacheColor(const QString& paletteName, const QString& colorName) {
-        m_colorCache.insert(paletteName, colorName);
-    }
+    Cache::Key getColorKey() const { return m_colorKey; }
 };
 
 }  // namespace WallReel::Core::Image
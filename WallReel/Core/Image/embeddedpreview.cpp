@@ -0,0 +1,216 @@
+#include "embeddedpreview.hpp"
+
+#include <QBuffer>
+#include <QFile>
+#include <QImageReader>
+#include <algorithm>
+
+#include "logger.hpp"
+
+WALLREEL_DECLARE_SENDER("ImagePreview")
+
+using namespace Qt::StringLiterals;
+
+namespace WallReel::Core::Image {
+
+namespace {
+
+// JPEG markers
+constexpr uchar s_MarkerPrefix = 0xFF;
+constexpr uchar s_Soi          = 0xD8;
+constexpr uchar s_Eoi          = 0xD9;
+constexpr uchar s_Sos          = 0xDA;
+constexpr uchar s_App1         = 0xE1;
+constexpr uchar s_App2         = 0xE2;
+
+// TIFF tags
+constexpr quint16 s_JpegOffsetTag = 0x0201;  // JPEGInterchangeFormat, EXIF thumbnail in IFD1
+constexpr quint16 s_JpegLengthTag = 0x0202;  // JPEGInterchangeFormatLength
+constexpr quint16 s_MpEntryTag    = 0xB002;  // MP Entry, 16 bytes per image
+
+constexpr qsizetype s_IfdEntrySize = 12;
+constexpr qsizetype s_MpEntrySize  = 16;
+
+// Previews whose aspect ratio differs by more than 1 / s_AspectTolerance are not used
+constexpr qint64 s_AspectTolerance = 100;
+
+/**
+ * @brief Bounds checked reads from a TIFF structure, out of range reads yield 0.
+ */
+class Tiff {
+    QByteArrayView m_data;
+    bool m_littleEndian = false;
+
+  public:
+    explicit Tiff(QByteArrayView data) : m_data(data) {
+        if (data.startsWith("II*\0"_ba)) {
+            m_littleEndian = true;
+        } else if (!data.startsWith("MM\0*"_ba)) {
+            m_data = {};
+        }
+    }
+
+    bool isValid() const { return !m_data.isEmpty(); }
+
+    QByteArrayView data() const { return m_data; }
+
+    quint16 u16(qsizetype pos) const {
+        if (pos < 0 || pos + 2 > m_data.size())
+            return 0;
+        const auto* p = reinterpret_cast<const uchar*>(m_data.data()) + pos;
+        return m_littleEndian ? quint16(p[0] | p[1] << 8) : quint16(p[0] << 8 | p[1]);
+    }
+
+    quint32 u32(qsizetype pos) const {
+        if (pos < 0 || pos + 4 > m_data.size())
+            return 0;
+        return m_littleEndian ? quint32(u16(pos)) | quint32(u16(pos + 2)) << 16
+                              : quint32(u16(pos)) << 16 | quint32(u16(pos + 2));
+    }
+
+    /**
+     * @brief Position of the value of a tag in the IFD at ifd, -1 if absent.
+     *        Values of at most 4 bytes are stored in place, larger ones are referred to by offset.
+     */
+    qsizetype find(qsizetype ifd, quint16 tag) const {
+        const quint16 count = u16(ifd);
+        for (quint16 i = 0; i < count; ++i) {
+            const qsizetype entry = ifd + 2 + i * s_IfdEntrySize;
+            if (u16(entry) == tag)
+                return entry + 8;
+        }
+        return -1;
+    }
+
+    qsizetype nextIfd(qsizetype ifd) const { return u32(ifd + 2 + u16(ifd) * s_IfdEntrySize); }
+
+    qsizetype firstIfd() const { return u32(4); }
+};
+
+bool isJpeg(QByteArrayView data) {
+    return data.size() > 4 && uchar(data[0]) == s_MarkerPrefix && uchar(data[1]) == s_Soi;
+}
+
+// The thumbnail of the EXIF data lives in the second IFD
+void collectExifThumbnail(const Tiff& tiff, QList<QByteArrayView>& previews) {
+    if (!tiff.isValid())
+        return;
+    const qsizetype ifd1 = tiff.nextIfd(tiff.firstIfd());
+    if (ifd1 <= 0)
+        return;
+    const qsizetype offsetPos = tiff.find(ifd1, s_JpegOffsetTag);
+    const qsizetype lengthPos = tiff.find(ifd1, s_JpegLengthTag);
+    if (offsetPos < 0 || lengthPos < 0)
+        return;
+    const qsizetype offset = tiff.u32(offsetPos);
+    const qsizetype length = tiff.u32(lengthPos);
+    if (offset > 0 && length > 0 && offset + length <= tiff.data().size())
+        previews.append(tiff.data().sliced(offset, length));
+}
+
+// Offsets of Multi-Picture images are relative to the MPF TIFF header, the first (main) image has offset 0
+void collectMpfImages(const Tiff& tiff, QByteArrayView file, qsizetype tiffStart, QList<QByteArrayView>& previews) {
+    if (!tiff.isValid())
+        return;
+    const qsizetype valuePos = tiff.find(tiff.firstIfd(), s_MpEntryTag);
+    if (valuePos < 0)
+        return;
+    const qsizetype count   = tiff.u32(valuePos - 4) / s_MpEntrySize;
+    const qsizetype entries = tiff.u32(valuePos);
+    for (qsizetype i = 0; i < count; ++i) {
+        const qsizetype entry  = entries + i * s_MpEntrySize;
+        const qsizetype length = tiff.u32(entry + 4);
+        const qsizetype offset = tiff.u32(entry + 8);
+        if (offset > 0 && length > 0 && tiffStart + offset + length <= file.size())
+            previews.append(file.sliced(tiffStart + offset, length));
+    }
+}
+
+QList<QByteArrayView> findPreviews(QByteArrayView file) {
+    QList<QByteArrayView> previews;
+    if (!isJpeg(file))
+        return previews;
+
+    // Metadata segments all precede the compressed data of the main image
+    qsizetype pos = 2;
+    while (pos + 4 <= file.size() && uchar(file[pos]) == s_MarkerPrefix) {
+        const uchar marker = file[pos + 1];
+        if (marker == s_MarkerPrefix) {
+            // Fill byte
+            ++pos;
+            continue;
+        }
+        if (marker == s_Sos || marker == s_Eoi)
+            break;
+
+        const qsizetype length = uchar(file[pos + 2]) << 8 | uchar(file[pos + 3]);
+        if (length < 2 || pos + 2 + length > file.size())
+            break;
+        const QByteArrayView payload = file.sliced(pos + 4, length - 2);
+        if (marker == s_App1 && payload.startsWith("Exif\0\0"_ba)) {
+            collectExifThumbnail(Tiff(payload.sliced(6)), previews);
+        } else if (marker == s_App2 && payload.startsWith("MPF\0"_ba)) {
+            collectMpfImages(Tiff(payload.sliced(4)), file, pos + 8, previews);
+        }
+        pos += 2 + length;
+    }
+
+    previews.removeIf([](QByteArrayView preview) { return !isJpeg(preview); });
+    return previews;
+}
+
+}  // namespace
+
+QImage readEmbeddedPreview(const QString& path, const QSize& originalSize, const QSize& minSize) {
+    if (originalSize.isEmpty() || minSize.isEmpty())
+        return QImage();
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return QImage();
+    // Previews of the Multi-Picture Format follow the main image, map instead of reading the whole file
+    const uchar* mapped = file.map(0, file.size());
+    if (!mapped)
+        return QImage();
+    const QByteArrayView data(mapped, file.size());
+
+    struct Candidate {
+        QByteArrayView bytes;
+        QSize size;
+    };
+    QList<Candidate> candidates;
+    for (const QByteArrayView preview : findPreviews(data)) {
+        QByteArray raw = QByteArray::fromRawData(preview.data(), preview.size());
+        QBuffer buffer(&raw);
+        QImageReader reader(&buffer, "jpeg");
+        const QSize size = reader.size();
+        if (size.width() < minSize.width() || size.height() < minSize.height())
+            continue;
+        const qint64 skew = qAbs(qint64(size.width()) * originalSize.height() - qint64(size.height()) * originalSize.width());
+        if (skew * s_AspectTolerance > qint64(originalSize.width()) * size.height())
+            continue;
+        candidates.append({preview, size});
+    }
+    if (candidates.isEmpty())
+        return QImage();
+
+    // Cheapest to decode first
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+        return qint64(a.size.width()) * a.size.height() < qint64(b.size.width()) * b.size.height();
+    });
+    for (const auto& candidate : std::as_const(candidates)) {
+        QByteArray raw = QByteArray::fromRawData(candidate.bytes.data(), candidate.bytes.size());
+        QBuffer buffer(&raw);
+        QImage image;
+        if (QImageReader reader(&buffer, "jpeg"); reader.read(&image)) {
+            WR_DEBUG(QString("Using %1x%2 embedded preview of %3")
+                         .arg(candidate.size.width())
+                         .arg(candidate.size.height())
+                         .arg(path));
+            return image;
+        }
+    }
+    return QImage();
+}
+
+}  // namespace WallReel::Core::Image
@@ -0,0 +1,27 @@
+#ifndef WALLREEL_IMAGE_EMBEDDEDPREVIEW_HPP
+#define WALLREEL_IMAGE_EMBEDDEDPREVIEW_HPP
+
+#include <QImage>
+#include <QSize>
+#include <QString>
+
+namespace WallReel::Core::Image {
+
+/**
+ * @brief Decode the smallest preview embedded in a JPEG that is still large enough,
+ *        instead of the main image.
+ *
+ * @details Cameras store a reduced copy of every shot next to the full resolution image, either as the
+ * EXIF thumbnail (APP1, IFD1) or as an additional image of the Multi-Picture Format (APP2), where previews
+ * of one or two megapixels are common. Only the marker segments are parsed, the main image is never touched.
+ *
+ * @param path JPEG file
+ * @param originalSize Size of the main image, previews with another aspect ratio (e.g. letterboxed) are ignored
+ * @param minSize Size the preview is scaled down to afterwards, both dimensions must be reached
+ * @return QImage A null image if there is no suitable preview
+ */
+QImage readEmbeddedPreview(const QString& path, const QSize& originalSize, const QSize& minSize);
+
+}  // namespace WallReel::Core::Image
+
+#endif  // WALLREEL_IMAGE_EMBEDDEDPREVIEW_HPP
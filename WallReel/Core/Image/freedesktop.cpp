@@ -0,0 +1,142 @@
+#include "freedesktop.hpp"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QImageReader>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QUrl>
+#include <algorithm>
+
+#include "logger.hpp"
+#include "version.h"
+
+WALLREEL_DECLARE_SENDER("ImageFreedesktop")
+
+namespace WallReel::Core::Image::Freedesktop {
+
+namespace {
+
+struct Flavor {
+    QString dirName;
+    int dimension;  ///< Thumbnails are fitted into a square of this size
+};
+
+// Ascending, so that the cheapest thumbnail that is large enough is found first
+const QList<Flavor> s_Flavors = {
+    {"normal", 128},
+    {"large", 256},
+    {"x-large", 512},
+    {"xx-large", 1024},
+};
+
+constexpr QFile::Permissions s_PrivateDir  = QFile::ReadOwner | QFile::WriteOwner | QFile::ExeOwner;
+constexpr QFile::Permissions s_PrivateFile = QFile::ReadOwner | QFile::WriteOwner;
+
+QDir thumbnailRoot() {
+    return QDir(QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + "/thumbnails");
+}
+
+QString fileUri(const QFileInfo& file) {
+    return QString::fromLatin1(QUrl::fromLocalFile(file.absoluteFilePath()).toEncoded());
+}
+
+QString thumbnailName(const QString& uri) {
+    return QString::fromLatin1(QCryptographicHash::hash(uri.toUtf8(), QCryptographicHash::Md5).toHex()) + ".png";
+}
+
+// The spec forbids thumbnailing thumbnails
+bool isThumbnail(const QFileInfo& file) {
+    return file.absoluteFilePath().startsWith(thumbnailRoot().absolutePath() + '/');
+}
+
+// Thumb::MTime is written as an integer, some tools add a fractional part
+bool isUpToDate(QImageReader& reader, const QString& uri, qint64 mtime) {
+    bool ok            = false;
+    const double value = reader.text("Thumb::MTime").toDouble(&ok);
+    if (!ok || qint64(value) != mtime) {
+        return false;
+    }
+    const QString storedUri = reader.text("Thumb::URI");
+    return storedUri.isEmpty() || storedUri == uri;
+}
+
+}  // namespace
+
+QImage readThumbnail(const QFileInfo& file, const QSize& minSize) {
+    if (minSize.isEmpty() || isThumbnail(file)) {
+        return QImage();
+    }
+    const QDir root     = thumbnailRoot();
+    const QString uri   = fileUri(file);
+    const QString name  = thumbnailName(uri);
+    const qint64 mtime  = file.lastModified().toSecsSinceEpoch();
+    const int minLength = std::max(minSize.width(), minSize.height());
+
+    for (const auto& flavor : s_Flavors) {
+        if (flavor.dimension < minLength) {
+            continue;
+        }
+        QImageReader reader(root.filePath(flavor.dirName + '/' + name));
+        if (!reader.canRead()) {
+            continue;
+        }
+        const QSize size = reader.size();
+        if (size.width() < minSize.width() || size.height() < minSize.height() || !isUpToDate(reader, uri, mtime)) {
+            continue;
+        }
+        QImage image;
+        if (reader.read(&image)) {
+            WR_DEBUG(QString("Using %1 thumbnail of %2").arg(flavor.dirName, file.absoluteFilePath()));
+            return image;
+        }
+    }
+    return QImage();
+}
+
+void writeThumbnail(const QFileInfo& file, const QImage& image) {
+    if (image.isNull() || isThumbnail(file)) {
+        return;
+    }
+    // Never scale up, the largest flavor the image fills
+    const int length = std::max(image.width(), image.height());
+    const auto fills = [length](const Flavor& flavor) { return flavor.dimension <= length; };
+    const auto it    = std::find_if(s_Flavors.crbegin(), s_Flavors.crend(), fills);
+    if (it == s_Flavors.crend()) {
+        return;
+    }
+
+    const QDir root    = thumbnailRoot();
+    const QString uri  = fileUri(file);
+    const QString path = root.filePath(it->dirName + '/' + thumbnailName(uri));
+    const qint64 mtime = file.lastModified().toSecsSinceEpoch();
+    if (QImageReader reader(path); reader.canRead() && isUpToDate(reader, uri, mtime)) {
+        return;
+    }
+
+    // Thumbnails reveal what the user looked at, the spec keeps them private
+    if (!root.exists()) {
+        QDir().mkpath(QFileInfo(root.absolutePath()).absolutePath());
+        QDir().mkdir(root.absolutePath(), s_PrivateDir);
+    }
+    if (!root.exists(it->dirName)) {
+        QDir().mkdir(root.filePath(it->dirName), s_PrivateDir);
+    }
+
+    QImage thumbnail = image.scaled(it->dimension, it->dimension, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    thumbnail.setText("Thumb::URI", uri);
+    thumbnail.setText("Thumb::MTime", QString::number(mtime));
+    thumbnail.setText("Thumb::Size", QString::number(file.size()));
+    thumbnail.setText("Software", APP_NAME);
+
+    // Other applications may read it at any time, never let them see a partial file
+    QSaveFile out(path);
+    if (!out.open(QIODevice::WriteOnly) || !thumbnail.save(&out, "PNG") || !out.commit()) {
+        WR_DEBUG(QString("Failed to write %1 thumbnail of %2: %3").arg(it->dirName, file.absoluteFilePath(), out.errorString()));
+        return;
+    }
+    QFile::setPermissions(path, s_PrivateFile);
+}
+
+}  // namespace WallReel::Core::Image::Freedesktop
@@ -0,0 +1,69 @@
+#ifndef WALLREEL_IMAGE_FREEDESKTOP_HPP
+#define WALLREEL_IMAGE_FREEDESKTOP_HPP
+
+#include <QFileInfo>
+#include <QImage>
+#include <QSize>
+#include <QString>
+#include <QStringList>
+
+// Thumbnails shared between applications as described by the freedesktop.org thumbnail spec:
+// $XDG_CACHE_HOME/thumbnails/<size>/<md5 of the file URI>.png, fitted into a square of the size's
+// dimension, carrying the URI and modification time of their source as Thumb::URI and Thumb::MTime.
+// File managers generate them for every image they show, so most wallpapers already have one.
+
+namespace WallReel::Core::Image::Freedesktop {
+
+/**
+ * @brief How the thumbnails shared with other applications are used.
+ */
+enum class Mode : int {
+    Off,    // "off", never looked at
+    Read,   // "read", cropped from instead of decoding the original when large enough
+    Write,  // "write", also written for originals that had to be decoded
+};
+
+inline const QStringList s_availableModes = {"off", "read", "write"};
+
+inline QString modeToString(Mode mode) {
+    switch (mode) {
+        case Mode::Off:
+            return "off";
+        case Mode::Write:
+            return "write";
+        default:
+            return "read";
+    }
+}
+
+inline Mode stringToMode(const QString& str) {
+    if (str.compare("off", Qt::CaseInsensitive) == 0) {
+        return Mode::Off;
+    } else if (str.compare("write", Qt::CaseInsensitive) == 0) {
+        return Mode::Write;
+    } else {
+        return Mode::Read;  // default
+    }
+}
+
+/**
+ * @brief Load the smallest up to date shared thumbnail of a file that still covers minSize.
+ *
+ * @param file Original image
+ * @param minSize Size the thumbnail is scaled down to afterwards, both dimensions must be reached
+ * @return QImage A null image if there is none
+ */
+QImage readThumbnail(const QFileInfo& file, const QSize& minSize);
+
+/**
+ * @brief Store a shared thumbnail of a file in the largest spec size image still fills,
+ *        unless an up to date one already exists there.
+ *
+ * @param file Original image
+ * @param image The whole original, already scaled down
+ */
+void writeThumbnail(const QFileInfo& file, const QImage& image);
+
+}  // namespace WallReel::Core::Image::Freedesktop
+
+#endif  // WALLREEL_IMAGE_FREEDESKTOP_HPP
@@ -11,12 +11,12 @@ WALLREEL_DECLARE_SENDER("ImageManager")
 WallReel::Core::Image::Manager::Manager(
     Config::Manager& configMgr,
     Cache::Manager& cacheMgr,
-    const QSize& thumbnailSize,
+    const QList<QSize>& thumbnailSizes,
     QObject* parent)
     : QObject(parent),
       m_configMgr(configMgr),
       m_cacheMgr(cacheMgr),
-      m_thumbnailSize(thumbnailSize) {
+      m_thumbnailSizes(thumbnailSizes) {
     m_dataModel  = new Model(this);
     m_proxyModel = new ProxyModel(this);
     m_proxyModel->setSourceModel(m_dataModel);
@@ -38,6 +38,14 @@ WallReel::Core::Image::Manager::Manager(
 WallReel::Core::Image::Manager::~Manager() {
     m_watcher.cancel();
     m_watcher.waitForFinished();
+    // Its continuation is dropped along with this object, the items it resolved are not
+    if (m_lookupPending) {
+        m_lookupFuture.waitForFinished();
+        if (m_lookupFuture.resultCount() > 0) {
+            qDeleteAll(m_lookupFuture.result().prefetched);
+        }
+    }
+    qDeleteAll(m_prefetched);
 }
 
 void WallReel::Core::Image::Manager::loadAndProcess() {
@@ -70,24 +78,121 @@ void WallReel::Core::Image::Manager::loadAndProcess(const QStringList& paths) {
 
 void WallReel::Core::Image::Manager::_process(const QStringList& paths) {
     m_processedCount = 0;
+    m_totalCount     = paths.size();
+    m_generatedCount = 0;
+    m_generatedBytes = 0;
+    m_stopRequested  = false;
     m_progressUpdateTimer.start(s_ProgressUpdateIntervalMs);
+
+    // Every path is stat()ed and looked up in the database, none of which may block the UI thread
+    const auto thumbnailSizes = m_thumbnailSizes;
+    const auto cacheMgr       = &m_cacheMgr;
+    m_lookupPending           = true;
+    m_lookupFuture            = QtConcurrent::run([paths, thumbnailSizes, cacheMgr]() {
+        return _lookup(paths, thumbnailSizes, *cacheMgr);
+    });
+    m_lookupFuture.then(this, [this](Lookup lookup) {
+        _startWorkers(std::move(lookup));
+    });
+    emit totalCountChanged();
+}
+
+WallReel::Core::Image::Manager::Lookup WallReel::Core::Image::Manager::_lookup(
+    const QStringList& paths,
+    const QList<QSize>& thumbnailSizes,
+    Cache::Manager& cacheMgr) {
+    // Resolve everything already cached with a single lookup,
+    // so that only cache misses have to go through the worker pool
+    const QSize& thumbnailSize = thumbnailSizes.first();
+    QList<QFileInfo> files;
+    QList<Cache::Source> sources;
+    QList<Cache::Source> tierSources;  // Those of the other thumbnail sizes, paths.size() per size
+    files.reserve(paths.size());
+    sources.reserve(paths.size());
+    tierSources.resize(paths.size() * (thumbnailSizes.size() - 1));
+    for (qsizetype i = 0; i < paths.size(); ++i) {
+        files.append(QFileInfo(paths[i]));
+        // A single stat() for all sizes
+        const auto identified = Cache::Manager::identify(files.last(), thumbnailSizes);
+        sources.append(identified.first());
+        for (qsizetype t = 1; t < thumbnailSizes.size(); ++t) {
+            tierSources[(t - 1) * paths.size() + i] = identified[t];
+        }
+    }
+    const auto hits = cacheMgr.lookup(sources + tierSources);
+
+    Lookup lookup;
+    QList<qsizetype> missIndices;
+    QList<Cache::Source> missSources;
+    missIndices.reserve(paths.size());
+    missSources.reserve(paths.size());
+    for (qsizetype i = 0; i < paths.size(); ++i) {
+        // Only a hit if every size is cached, the others are cheap to complete in a worker
+        auto it = hits.constFind(sources[i].key);
+        QList<Data::Tier> tiers;
+        for (qsizetype t = 1; it != hits.cend() && t < thumbnailSizes.size(); ++t) {
+            const Cache::Source& tierSource = tierSources[(t - 1) * paths.size() + i];
+            if (auto tierIt = hits.constFind(tierSource.key); tierIt != hits.cend()) {
+                tiers.append({thumbnailSizes[t], tierSource.key, cacheMgr.imageUrl(tierSource.key, tierIt->image)});
+            } else {
+                it = hits.cend();
+            }
+        }
+        // Colors cached without a palette get one in a worker too, the UI thread must not decode for it
+        if (it == hits.cend() || it->palette.isEmpty()) {
+            missIndices.append(i);
+            missSources.append(sources[i]);
+            continue;
+        }
+        if (auto data = Data::create(files[i], sources[i].key, thumbnailSize, *it, cacheMgr, tiers)) {
+            lookup.prefetched.append(data);
+        }
+    }
+
+    // Files that failed to load before are not tried again until they change, or --retry-failed is given
+    const auto failures = cacheMgr.lookupFailures(missSources);
+    lookup.misses.reserve(missIndices.size() - failures.size());
+    for (const qsizetype i : std::as_const(missIndices)) {
+        if (auto it = failures.constFind(sources[i].path); it != failures.cend()) {
+            WR_DEBUG(QString("Skipping '%1', failed to load before: %2").arg(paths[i], *it));
+            continue;
+        }
+        lookup.misses.append(paths[i]);
+    }
+    if (!failures.isEmpty()) {
+        WR_INFO(QString("Skipped %1 image(s) that failed to load before, run with --retry-failed to try again").arg(failures.size()));
+    }
+    WR_DEBUG(QString("%1 image(s) resolved from cache, %2 to be processed").arg(paths.size() - lookup.misses.size()).arg(lookup.misses.size()));
+    return lookup;
+}
+
+void WallReel::Core::Image::Manager::_startWorkers(Lookup lookup) {
+    m_lookupPending = false;
+    m_prefetched    = std::move(lookup.prefetched);
+    if (m_stopRequested) {
+        lookup.misses.clear();
+    }
+    m_processedCount = m_totalCount - lookup.misses.size();
+
     // These are all small objects so capturing by value should be fine
-    const auto thumbnailSize = m_thumbnailSize;
-    const auto counterPtr    = &m_processedCount;
-    const auto cacheMgr      = &m_cacheMgr;
+    const auto thumbnailSizes = m_thumbnailSizes;
+    const auto counterPtr     = &m_processedCount;
+    const auto cacheMgr       = &m_cacheMgr;
+    const auto mode           = Freedesktop::stringToMode(m_configMgr.getCacheConfig().freedesktopThumbnails);
     QFuture<Data*> future =
-        QtConcurrent::mapped(paths, [thumbnailSize, counterPtr, cacheMgr](const QString& path) {
-            auto data = Data::create(path, thumbnailSize, *cacheMgr);
+        QtConcurrent::mapped(lookup.misses, [thumbnailSizes, counterPtr, cacheMgr, mode](const QString& path) {
+            auto data = Data::create(path, thumbnailSizes, *cacheMgr, mode);
             counterPtr->fetch_add(1, std::memory_order_relaxed);
             return data;
         });
     m_watcher.setFuture(future);
-    emit totalCountChanged();
 }
 
 void WallReel::Core::Image::Manager::stop() {
     if (m_isLoading) {
         WR_INFO("Stopping image loading...");
+        // Still looking up the cache, no worker is started then
+        m_stopRequested = true;
         m_watcher.cancel();
     } else {
         WR_WARN("No loading operation to stop.");
@@ -107,9 +212,17 @@ void WallReel::Core::Image::Manager::_onProgressValueChanged(int value) {
 void WallReel::Core::Image::Manager::_onProcessingFinished() {
     auto results = m_watcher.future().results();
 
-    QList<Data*> filteredResults;
-    filteredResults.reserve(results.size());
+    QList<Data*> filteredResults = std::exchange(m_prefetched, {});
+    filteredResults.reserve(filteredResults.size() + results.size());
+    for (Data* data : std::as_const(filteredResults)) {
+        m_dataMap.insert(data->getId(), data);
+    }
     for (Data* data : results) {
+        // Counted before duplicates are hidden, their thumbnails have been generated all the same
+        if (data && data->wasGenerated()) {
+            ++m_generatedCount;
+            m_generatedBytes += data->getSize();
+        }
         if (data && data->isValid()) {
             filteredResults.append(data);
             m_dataMap.insert(data->getId(), data);
@@ -121,6 +234,28 @@ void WallReel::Core::Image::Manager::_onProcessingFinished() {
         }
     }
 
+    if (m_configMgr.getWallpaperConfig().hideDuplicates) {
+        // Keep the first of each set of identical files, in the order they were found
+        QSet<quint64> seen;
+        qsizetype hidden = 0;
+        for (auto it = filteredResults.begin(); it != filteredResults.end();) {
+            const quint64 fingerprint = (*it)->getFingerprint();
+            if (fingerprint == 0 || !seen.contains(fingerprint)) {
+                seen.insert(fingerprint);
+                ++it;
+                continue;
+            }
+            WR_DEBUG(QString("Hiding duplicate image '%1'").arg((*it)->getFullPath()));
+            m_dataMap.remove((*it)->getId());
+            delete *it;
+            it = filteredResults.erase(it);
+            ++hidden;
+        }
+        if (hidden > 0) {
+            WR_INFO(QString("Hid %1 duplicate image(s)").arg(hidden));
+        }
+    }
+
     m_dataModel->insertData(filteredResults);
 
     WR_INFO("Finished loading images. Total valid images: " + QString::number(filteredResults.size()));
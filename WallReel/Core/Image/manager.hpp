@@ -23,7 +23,7 @@ class Manager : public QObject {
     Manager(
         Config::Manager& configMgr,
         Cache::Manager& cacheMgr,
-        const QSize& thumbnailSize,
+        const QList<QSize>& thumbnailSizes,
         QObject* parent = nullptr);
 
     ~Manager();
@@ -36,7 +36,13 @@ class Manager : public QObject {
 
     // Total count of processing items, NOT the count of items in the model
     // (Why did I name this method like this? idk)
-    int totalCount() const { return m_watcher.progressMaximum(); }
+    int totalCount() const { return m_totalCount; }
+
+    // Images of the last load whose thumbnails had to be generated, rather than found in a cache
+    int generatedCount() const { return m_generatedCount; }
+
+    // Total size of the source files of generatedCount()
+    qint64 generatedBytes() const { return m_generatedBytes; }
 
     void setSortType(Config::SortType type) { m_proxyModel->setSortType(type); }
 
@@ -63,9 +69,19 @@ class Manager : public QObject {
         return nullptr;
     }
 
+    QList<Image::Data*> images() const { return m_dataMap.values(); }
+
   private:
+    /// Wallpapers resolved against the cache, see _lookup()
+    struct Lookup {
+        QList<Data*> prefetched;  ///< Items resolved from the cache
+        QStringList misses;       ///< Paths left for the workers
+    };
+
     void _clearData();
     void _process(const QStringList& paths);
+    static Lookup _lookup(const QStringList& paths, const QList<QSize>& thumbnailSizes, Cache::Manager& cacheMgr);
+    void _startWorkers(Lookup lookup);
 
   signals:
     // Properties
@@ -84,10 +100,17 @@ class Manager : public QObject {
 
     Config::Manager& m_configMgr;
     Cache::Manager& m_cacheMgr;
-    QSize m_thumbnailSize;
+    QList<QSize> m_thumbnailSizes;  ///< See Config::Manager::getThumbnailSizes(), the first one is the primary
 
     QFutureWatcher<Data*> m_watcher;
-    bool m_isLoading = false;
+    QFuture<Lookup> m_lookupFuture;  ///< Runs _lookup() in the worker pool, handed to _startWorkers() on this thread
+    QList<Data*> m_prefetched;       ///< Items resolved from the cache by _lookup(), merged in _onProcessingFinished()
+    bool m_isLoading     = false;
+    bool m_lookupPending = false;  ///< m_lookupFuture has not been handed to _startWorkers() yet
+    bool m_stopRequested = false;  ///< stop() was called before any worker was started
+    int m_totalCount        = 0;
+    int m_generatedCount    = 0;
+    qint64 m_generatedBytes = 0;
 
     std::atomic<int> m_processedCount{0};
     QTimer m_progressUpdateTimer;
@@ -42,6 +42,8 @@ QVariant Model::data(const QModelIndex& index, int role) const {
             return item->getLastModified();
         case DomColorRole:
             return item->getDominantColor();
+        case ThumbUrlRole:
+            return item->getThumbnailUrl();
         default:
             return QVariant();
     }
@@ -68,6 +70,8 @@ QVariant Model::dataAt(int index, const QString& roleName) const {
         return item->getLastModified();
     } else if (roleName == "imgDomColor") {
         return item->getDominantColor();
+    } else if (roleName == "imgThumbUrl") {
+        return item->getThumbnailUrl();
     } else {
         return QVariant();
     }
@@ -21,6 +21,7 @@ class Model : public QAbstractListModel {
         SizeRole,
         DateRole,
         DomColorRole,
+        ThumbUrlRole,
     };
 
     QHash<int, QByteArray> roleNames() const override {
@@ -32,6 +33,7 @@ class Model : public QAbstractListModel {
             {SizeRole, "imgSize"},
             {DateRole, "imgDate"},
             {DomColorRole, "imgDomColor"},
+            {ThumbUrlRole, "imgThumbUrl"},  // smallest thumbnail, for unfocused items
         };
     }
 
@@ -0,0 +1,145 @@
+#include "colorspace.hpp"
+
+#include <array>
+#include <cmath>
+#include <numbers>
+
+// Fifth root by Newton's method, std::pow() is not usable in constant expressions
+static constexpr double root5(double y) {
+    double x = 1.0;
+    while (true) {
+        const double x4   = x * x * x * x;
+        const double next = (4.0 * x + y / x4) / 5.0;
+        // Starting above the root, the iterations decrease until rounding stops them
+        if (next >= x) {
+            return x;
+        }
+        x = next;
+    }
+}
+
+// sRGB transfer function inverted for every 8 bit value, x^2.4 as x^2 * (x^2)^(1/5)
+static constexpr auto linearTable = [] {
+    std::array<double, 256> table{};
+    for (int c = 0; c < 256; ++c) {
+        const double v = c / 255.0;
+        if (v <= 0.04045) {
+            table[c] = v / 12.92;
+        } else {
+            const double x  = (v + 0.055) / 1.055;
+            const double x2 = x * x;
+            table[c]        = x2 * root5(x2);
+        }
+    }
+    return table;
+}();
+
+double WallReel::Core::Palette::linearChannel(int channel) {
+    return ::linearTable[channel & 0xff];
+}
+
+WallReel::Core::Palette::Lab WallReel::Core::Palette::toCieLab(const QColor& color) {
+    const double r = ::linearTable[color.red()];
+    const double g = ::linearTable[color.green()];
+    const double b = ::linearTable[color.blue()];
+
+    // Linear sRGB to XYZ, divided by the D65 white point
+    const double x = (0.4124564 * r + 0.3575761 * g + 0.1804375 * b) / 0.95047;
+    const double y = (0.2126729 * r + 0.7151522 * g + 0.0721750 * b) / 1.00000;
+    const double z = (0.0193339 * r + 0.1191920 * g + 0.9503041 * b) / 1.08883;
+
+    constexpr double delta = 6.0 / 29.0;
+    const auto f           = [](double t) {
+        return t > delta * delta * delta ? std::cbrt(t) : t / (3.0 * delta * delta) + 4.0 / 29.0;
+    };
+    const double fx = f(x);
+    const double fy = f(y);
+    const double fz = f(z);
+    return {116.0 * fy - 16.0, 500.0 * (fx - fy), 200.0 * (fy - fz)};
+}
+
+WallReel::Core::Palette::Lab WallReel::Core::Palette::toOkLab(const QColor& color) {
+    const double r = ::linearTable[color.red()];
+    const double g = ::linearTable[color.green()];
+    const double b = ::linearTable[color.blue()];
+
+    // Linear sRGB to cone responses, then to OKLab, see https://bottosson.github.io/posts/oklab/
+    const double l = std::cbrt(0.4122214708 * r + 0.5363325363 * g + 0.0514459929 * b);
+    const double m = std::cbrt(0.2119034982 * r + 0.6806995451 * g + 0.1073969566 * b);
+    const double s = std::cbrt(0.0883024619 * r + 0.2817188376 * g + 0.6299787005 * b);
+    return {0.2104542553 * l + 0.7936177850 * m - 0.0040720468 * s,
+            1.9779984951 * l - 2.4285922050 * m + 0.4505937099 * s,
+            0.0259040371 * l + 0.7827717662 * m - 0.8086757660 * s};
+}
+
+// Following "The CIEDE2000 Color-Difference Formula" by Sharma, Wu and Dalal, angles in degrees
+double WallReel::Core::Palette::deltaE2000(const Lab& x, const Lab& y) {
+    constexpr double pow25To7 = 6103515625.0;
+    constexpr double toRad    = std::numbers::pi / 180.0;
+    constexpr double toDeg    = 180.0 / std::numbers::pi;
+
+    const double c1     = std::hypot(x.a, x.b);
+    const double c2     = std::hypot(y.a, y.b);
+    const double cMean  = (c1 + c2) / 2.0;
+    const double cMean7 = std::pow(cMean, 7.0);
+    const double g      = 0.5 * (1.0 - std::sqrt(cMean7 / (cMean7 + pow25To7)));
+
+    const double a1  = (1.0 + g) * x.a;
+    const double a2  = (1.0 + g) * y.a;
+    const double c1p = std::hypot(a1, x.b);
+    const double c2p = std::hypot(a2, y.b);
+    const auto hue   = [](double b, double a) {
+        if (a == 0.0 && b == 0.0) {
+            return 0.0;
+        }
+        const double h = std::atan2(b, a) * toDeg;
+        return h < 0.0 ? h + 360.0 : h;
+    };
+    const double h1p = hue(x.b, a1);
+    const double h2p = hue(y.b, a2);
+
+    const double dLp = y.l - x.l;
+    const double dCp = c2p - c1p;
+    double dhp       = 0.0;
+    if (c1p * c2p != 0.0) {
+        dhp = h2p - h1p;
+        if (dhp > 180.0) {
+            dhp -= 360.0;
+        } else if (dhp < -180.0) {
+            dhp += 360.0;
+        }
+    }
+    const double dHp = 2.0 * std::sqrt(c1p * c2p) * std::sin(dhp * toRad / 2.0);
+
+    const double lMeanP = (x.l + y.l) / 2.0;
+    const double cMeanP = (c1p + c2p) / 2.0;
+    double hMeanP       = h1p + h2p;
+    if (c1p * c2p != 0.0) {
+        if (std::abs(h1p - h2p) <= 180.0) {
+            hMeanP /= 2.0;
+        } else if (hMeanP < 360.0) {
+            hMeanP = (hMeanP + 360.0) / 2.0;
+        } else {
+            hMeanP = (hMeanP - 360.0) / 2.0;
+        }
+    }
+
+    const double t = 1.0 - 0.17 * std::cos((hMeanP - 30.0) * toRad) +
+                     0.24 * std::cos(2.0 * hMeanP * toRad) +
+                     0.32 * std::cos((3.0 * hMeanP + 6.0) * toRad) -
+                     0.20 * std::cos((4.0 * hMeanP - 63.0) * toRad);
+
+    const double dTheta  = 30.0 * std::exp(-std::pow((hMeanP - 275.0) / 25.0, 2.0));
+    const double cMeanP7 = std::pow(cMeanP, 7.0);
+    const double rc      = 2.0 * std::sqrt(cMeanP7 / (cMeanP7 + pow25To7));
+    const double l50     = (lMeanP - 50.0) * (lMeanP - 50.0);
+    const double sl      = 1.0 + 0.015 * l50 / std::sqrt(20.0 + l50);
+    const double sc      = 1.0 + 0.045 * cMeanP;
+    const double sh      = 1.0 + 0.015 * cMeanP * t;
+    const double rt      = -std::sin(2.0 * dTheta * toRad) * rc;
+
+    const double l = dLp / sl;
+    const double c = dCp / sc;
+    const double h = dHp / sh;
+    return std::sqrt(l * l + c * c + h * h + rt * c * h);
+}
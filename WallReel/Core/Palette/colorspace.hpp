@@ -0,0 +1,52 @@
+#ifndef WALLREEL_PALETTE_COLORSPACE_HPP
+#define WALLREEL_PALETTE_COLORSPACE_HPP
+
+#include <QColor>
+
+namespace WallReel::Core::Palette {
+
+/**
+ * @brief Coordinates in CIELAB (L in [0, 100]) or OKLab (L in [0, 1]), depending on where they came from.
+ */
+struct Lab {
+    double l = 0.0;
+    double a = 0.0;
+    double b = 0.0;
+};
+
+/**
+ * @brief Linear light intensity of an 8 bit sRGB channel, read from a table computed at compile time.
+ *
+ * @param channel 0 to 255
+ * @return double 0.0 to 1.0
+ */
+double linearChannel(int channel);
+
+/**
+ * @brief Convert a color to CIELAB, relative to the D65 white point of sRGB.
+ *
+ * @param color
+ * @return Lab
+ */
+Lab toCieLab(const QColor& color);
+
+/**
+ * @brief Convert a color to OKLab, where euclidean distances follow perceived differences closely.
+ *
+ * @param color
+ * @return Lab
+ */
+Lab toOkLab(const QColor& color);
+
+/**
+ * @brief CIEDE2000 color difference of two CIELAB colors, with all parametric factors set to 1.
+ *
+ * @param x
+ * @param y
+ * @return double 0 for identical colors, about 1 for a just noticeable difference
+ */
+double deltaE2000(const Lab& x, const Lab& y);
+
+}  // namespace WallReel::Core::Palette
+
+#endif  // WALLREEL_PALETTE_COLORSPACE_HPP
@@ -1,7 +1,17 @@
 #include "domcolor.hpp"
 
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <cmath>
+
 #include "logger.hpp"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define WALLREEL_DOMCOLOR_X86
+#endif
+
 WALLREEL_DECLARE_SENDER("DomColor")
 
 static constexpr int scaleMaxWidth  = 128;
@@ -11,11 +21,205 @@ static constexpr double weightSaturationPower = 2.0;
 static constexpr double weightLightnessPower  = 2.0;
 static constexpr int numBins                  = 36;  // 360 degrees / 10 degrees per bin
 
-static double getWeight(const QColor& color) {
-    int h, s, l;
-    color.getHsl(&h, &s, &l);
-    if (h < 0) return 0.0;  // Skip undefined hues
+// Pixels are converted a row at a time, rows are never wider than the scaled image
+using ConvertRow = void (*)(const QRgb* line, int width, int* hue100, int* saturation, int* lightness);
+
+// QColor::redF() etc. of an 8 bit channel, which QColor stores as 16 bit and divides in float,
+// promoted to double only when accumulated, as the values QColor returns are
+static constexpr auto channelF = [] {
+    std::array<float, 256> table{};
+    for (int c = 0; c < 256; ++c) {
+        table[c] = float(c * 257) / float(USHRT_MAX);
+    }
+    return table;
+}();
+
+// Same as qt_div_257(), scales a 16 bit component of QColor down to 8 bit
+static inline int div257(int x) {
+    return (x - (x >> 8) + 0x80) >> 8;
+}
+
+// Same as qRound() for non-negative values
+static inline int roundToInt(float x) {
+    return int(x + 0.5f);
+}
+
+// Hue, saturation and lightness of opaque pixels, computed with the same float operations in the same order
+// as QColor::toHsv() and QColor::toHsl(), so that the results match QColor::hue() and QColor::getHsl() exactly.
+// The hue is kept multiplied by 100 as QColor stores it, -1 for achromatic pixels.
+static void convertRowScalar(const QRgb* line, int width, int* hue100, int* saturation, int* lightness) {
+    for (int x = 0; x < width; ++x) {
+        const float r     = qRed(line[x]) * 257 / float(USHRT_MAX);
+        const float g     = qGreen(line[x]) * 257 / float(USHRT_MAX);
+        const float b     = qBlue(line[x]) * 257 / float(USHRT_MAX);
+        const float max   = std::max({r, g, b});
+        const float min   = std::min({r, g, b});
+        const float delta = max - min;
+        const float sum   = max + min;
+        const float l     = 0.5f * sum;
+
+        lightness[x] = div257(roundToInt(l * USHRT_MAX));
+        if (delta <= 0.00001f) {
+            hue100[x]     = -1;
+            saturation[x] = 0;
+            continue;
+        }
+        saturation[x] = div257(roundToInt((l < 0.5f ? delta / sum : delta / (2.0f - sum)) * USHRT_MAX));
+
+        float h = 0;
+        if (r == max) {
+            h = (g - b) / delta;
+        } else if (g == max) {
+            h = 2.0f + (b - r) / delta;
+        } else {
+            h = 4.0f + (r - g) / delta;
+        }
+        h *= 60.0f;
+        if (h < 0.0f) {
+            h += 360.0f;
+        }
+        hue100[x] = roundToInt(h * 100.0f);
+    }
+}
+
+#ifdef WALLREEL_DOMCOLOR_X86
+
+// Vectorized versions of convertRowScalar(), every lane goes through the same IEEE operations.
+// Both sides of each branch are computed and blended, divisions by zero only happen in lanes that are masked out.
+
+__attribute__((target("sse4.1"))) static inline __m128 toFloatSse41(__m128i c) {
+    const __m128i channel = _mm_and_si128(c, _mm_set1_epi32(0xff));
+    return _mm_div_ps(_mm_cvtepi32_ps(_mm_mullo_epi32(channel, _mm_set1_epi32(257))), _mm_set1_ps(USHRT_MAX));
+}
+
+__attribute__((target("sse4.1"))) static inline __m128i toIntSse41(__m128 v) {
+    return _mm_cvttps_epi32(_mm_add_ps(v, _mm_set1_ps(0.5f)));
+}
+
+__attribute__((target("sse4.1"))) static inline __m128i div257Sse41(__m128i v) {
+    return _mm_srli_epi32(_mm_add_epi32(_mm_sub_epi32(v, _mm_srli_epi32(v, 8)), _mm_set1_epi32(0x80)), 8);
+}
+
+__attribute__((target("sse4.1"))) static void convertRowSse41(const QRgb* line, int width, int* hue100, int* saturation, int* lightness) {
+    const __m128 scale = _mm_set1_ps(USHRT_MAX);
+    const __m128 half  = _mm_set1_ps(0.5f);
+
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        const __m128i argb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(line + x));
+        const __m128 r     = toFloatSse41(_mm_srli_epi32(argb, 16));
+        const __m128 g     = toFloatSse41(_mm_srli_epi32(argb, 8));
+        const __m128 b     = toFloatSse41(argb);
+        const __m128 max   = _mm_max_ps(_mm_max_ps(r, g), b);
+        const __m128 min   = _mm_min_ps(_mm_min_ps(r, g), b);
+        const __m128 delta = _mm_sub_ps(max, min);
+        const __m128 sum   = _mm_add_ps(max, min);
+        const __m128 l     = _mm_mul_ps(half, sum);
+
+        const __m128 achromatic = _mm_cmple_ps(delta, _mm_set1_ps(0.00001f));
+        const __m128 denom      = _mm_blendv_ps(_mm_sub_ps(_mm_set1_ps(2.0f), sum), sum, _mm_cmplt_ps(l, half));
+        const __m128i s         = div257Sse41(toIntSse41(_mm_mul_ps(_mm_div_ps(delta, denom), scale)));
+
+        const __m128 hr = _mm_div_ps(_mm_sub_ps(g, b), delta);
+        const __m128 hg = _mm_add_ps(_mm_set1_ps(2.0f), _mm_div_ps(_mm_sub_ps(b, r), delta));
+        const __m128 hb = _mm_add_ps(_mm_set1_ps(4.0f), _mm_div_ps(_mm_sub_ps(r, g), delta));
 
+        __m128 h = _mm_blendv_ps(_mm_blendv_ps(hb, hg, _mm_cmpeq_ps(g, max)), hr, _mm_cmpeq_ps(r, max));
+        h        = _mm_mul_ps(h, _mm_set1_ps(60.0f));
+        h        = _mm_blendv_ps(h, _mm_add_ps(h, _mm_set1_ps(360.0f)), _mm_cmplt_ps(h, _mm_setzero_ps()));
+
+        const __m128i h100           = toIntSse41(_mm_mul_ps(h, _mm_set1_ps(100.0f)));
+        const __m128i achromaticMask = _mm_castps_si128(achromatic);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(hue100 + x), _mm_blendv_epi8(h100, _mm_set1_epi32(-1), achromaticMask));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(saturation + x), _mm_andnot_si128(achromaticMask, s));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lightness + x), div257Sse41(toIntSse41(_mm_mul_ps(l, scale))));
+    }
+    convertRowScalar(line + x, width - x, hue100 + x, saturation + x, lightness + x);
+}
+
+__attribute__((target("avx2"))) static inline __m256 toFloatAvx2(__m256i c) {
+    const __m256i channel = _mm256_and_si256(c, _mm256_set1_epi32(0xff));
+    return _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_mullo_epi32(channel, _mm256_set1_epi32(257))), _mm256_set1_ps(USHRT_MAX));
+}
+
+__attribute__((target("avx2"))) static inline __m256i toIntAvx2(__m256 v) {
+    return _mm256_cvttps_epi32(_mm256_add_ps(v, _mm256_set1_ps(0.5f)));
+}
+
+__attribute__((target("avx2"))) static inline __m256i div257Avx2(__m256i v) {
+    return _mm256_srli_epi32(_mm256_add_epi32(_mm256_sub_epi32(v, _mm256_srli_epi32(v, 8)), _mm256_set1_epi32(0x80)), 8);
+}
+
+__attribute__((target("avx2"))) static void convertRowAvx2(const QRgb* line, int width, int* hue100, int* saturation, int* lightness) {
+    const __m256 scale = _mm256_set1_ps(USHRT_MAX);
+    const __m256 half  = _mm256_set1_ps(0.5f);
+
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        const __m256i argb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(line + x));
+        const __m256 r     = toFloatAvx2(_mm256_srli_epi32(argb, 16));
+        const __m256 g     = toFloatAvx2(_mm256_srli_epi32(argb, 8));
+        const __m256 b     = toFloatAvx2(argb);
+        const __m256 max   = _mm256_max_ps(_mm256_max_ps(r, g), b);
+        const __m256 min   = _mm256_min_ps(_mm256_min_ps(r, g), b);
+        const __m256 delta = _mm256_sub_ps(max, min);
+        const __m256 sum   = _mm256_add_ps(max, min);
+        const __m256 l     = _mm256_mul_ps(half, sum);
+
+        const __m256 achromatic = _mm256_cmp_ps(delta, _mm256_set1_ps(0.00001f), _CMP_LE_OQ);
+        const __m256 denom      = _mm256_blendv_ps(_mm256_sub_ps(_mm256_set1_ps(2.0f), sum), sum, _mm256_cmp_ps(l, half, _CMP_LT_OQ));
+        const __m256i s         = div257Avx2(toIntAvx2(_mm256_mul_ps(_mm256_div_ps(delta, denom), scale)));
+
+        const __m256 hr = _mm256_div_ps(_mm256_sub_ps(g, b), delta);
+        const __m256 hg = _mm256_add_ps(_mm256_set1_ps(2.0f), _mm256_div_ps(_mm256_sub_ps(b, r), delta));
+        const __m256 hb = _mm256_add_ps(_mm256_set1_ps(4.0f), _mm256_div_ps(_mm256_sub_ps(r, g), delta));
+
+        __m256 h = _mm256_blendv_ps(_mm256_blendv_ps(hb, hg, _mm256_cmp_ps(g, max, _CMP_EQ_OQ)), hr, _mm256_cmp_ps(r, max, _CMP_EQ_OQ));
+        h        = _mm256_mul_ps(h, _mm256_set1_ps(60.0f));
+        h        = _mm256_blendv_ps(h, _mm256_add_ps(h, _mm256_set1_ps(360.0f)), _mm256_cmp_ps(h, _mm256_setzero_ps(), _CMP_LT_OQ));
+
+        const __m256i h100           = toIntAvx2(_mm256_mul_ps(h, _mm256_set1_ps(100.0f)));
+        const __m256i achromaticMask = _mm256_castps_si256(achromatic);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(hue100 + x), _mm256_blendv_epi8(h100, _mm256_set1_epi32(-1), achromaticMask));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(saturation + x), _mm256_andnot_si256(achromaticMask, s));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(lightness + x), div257Avx2(toIntAvx2(_mm256_mul_ps(l, scale))));
+    }
+    convertRowScalar(line + x, width - x, hue100 + x, saturation + x, lightness + x);
+}
+
+#endif  // WALLREEL_DOMCOLOR_X86
+
+// nullptr if the CPU does not support the kernel, Reference has no row kernel either
+static ConvertRow convertRowOf(WallReel::Core::Palette::Kernel kernel) {
+    using WallReel::Core::Palette::Kernel;
+    switch (kernel) {
+        case Kernel::Reference:
+            return nullptr;
+        case Kernel::Scalar:
+            return convertRowScalar;
+#ifdef WALLREEL_DOMCOLOR_X86
+        case Kernel::Sse41:
+            return __builtin_cpu_supports("sse4.1") ? convertRowSse41 : nullptr;
+        case Kernel::Avx2:
+            return __builtin_cpu_supports("avx2") ? convertRowAvx2 : nullptr;
+#else
+        case Kernel::Sse41:
+        case Kernel::Avx2:
+            return nullptr;
+#endif
+        case Kernel::Auto:
+            break;
+    }
+    for (const Kernel candidate : {Kernel::Avx2, Kernel::Sse41}) {
+        if (const ConvertRow convertRow = convertRowOf(candidate)) {
+            WR_DEBUG(QString("Using %1 kernel").arg(candidate == Kernel::Avx2 ? "AVX2" : "SSE4.1"));
+            return convertRow;
+        }
+    }
+    return convertRowScalar;
+}
+
+static double getWeight(int s, int l) {
     double sNorm = s / 255.0;
 
     double dist  = std::abs(l - 128.0) / 128.0;
@@ -27,49 +231,83 @@ static double getWeight(const QColor& color) {
     return sNorm * sNorm * lNorm * lNorm;
 }
 
-static QColor getWeightedDominantColor(const QImage& image) {
-    if (image.isNull()) {
-        WR_WARN("Image is null");
-        return QColor();
-    }
+struct HueBin {
+    double totalWeight = 0.0;
+    double sumR        = 0.0;
+    double sumG        = 0.0;
+    double sumB        = 0.0;
+};
+
+static void accumulate(HueBin& bin, double weight, double r, double g, double b) {
+    bin.totalWeight += weight;
+    bin.sumR += r * weight;
+    bin.sumG += g * weight;
+    bin.sumB += b * weight;
+}
 
+// Pixels the kernel does not cover (other formats, translucent premultiplied pixels) go through QColor
+static void accumulate(std::array<HueBin, ::numBins>& bins, const QColor& color) {
+    int hue = color.hue();
+    if (hue < 0) return;  // Skip grayscale pixels
+
+    int h, s, l;
+    color.getHsl(&h, &s, &l);
+    double weight = getWeight(s, l);
+    // Filter out low-weight pixels to reduce noise
+    if (weight < 0.05) return;
+
+    accumulate(bins[(hue / 10) % ::numBins], weight, color.redF(), color.greenF(), color.blueF());
+}
+
+static QImage scaleDown(const QImage& image) {
     // QImage scaledImg = image.scaled(128, 128, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
-    QImage* scaledImg = nullptr;
     if (image.width() > ::scaleMaxWidth || image.height() > ::scaleMaxHeight) {
-        scaledImg = new QImage(image.scaled(::scaleMaxWidth, ::scaleMaxHeight, Qt::IgnoreAspectRatio, Qt::SmoothTransformation));
-    } else {
-        scaledImg = new QImage(image);
+        return image.scaled(::scaleMaxWidth, ::scaleMaxHeight, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
     }
+    return image;
+}
 
-    struct HueBin {
-        double totalWeight = 0.0;
-        double sumR        = 0.0;
-        double sumG        = 0.0;
-        double sumB        = 0.0;
-    };
-
-    QVector<HueBin> bins(::numBins);
-
-    for (int y = 0; y < scaledImg->height(); ++y) {
-        for (int x = 0; x < scaledImg->width(); ++x) {
-            QColor color = scaledImg->pixelColor(x, y);
+// convertRow is nullptr to convert every pixel through QColor
+static QColor getWeightedDominantColor(const QImage& scaledImg, ConvertRow convertRow) {
+    std::array<HueBin, ::numBins> bins{};
 
-            int hue = color.hue();
-            if (hue < 0) continue;  // Skip grayscale pixels
+    // The formats QImage::pixelColor() reads as plain 8 bit ARGB, translucent premultiplied pixels excepted
+    const QImage::Format format = scaledImg.format();
+    const bool premultiplied    = format == QImage::Format_ARGB32_Premultiplied;
+    const bool readable         = format == QImage::Format_RGB32 || format == QImage::Format_ARGB32 || premultiplied;
 
-            double weight = getWeight(color);
-            // Filter out low-weight pixels to reduce noise
-            if (weight < 0.05) continue;
+    if (!readable || !convertRow) {
+        for (int y = 0; y < scaledImg.height(); ++y) {
+            for (int x = 0; x < scaledImg.width(); ++x) {
+                accumulate(bins, scaledImg.pixelColor(x, y));
+            }
+        }
+    } else {
+        // Only the conversion is vectorized, pixels are summed up in their original order to keep the exact result
+        std::array<int, ::scaleMaxWidth> hue100, saturation, lightness;
+        const int width = std::min(scaledImg.width(), ::scaleMaxWidth);
+        for (int y = 0; y < scaledImg.height(); ++y) {
+            const auto* line = reinterpret_cast<const QRgb*>(scaledImg.constScanLine(y));
+            convertRow(line, width, hue100.data(), saturation.data(), lightness.data());
+            for (int x = 0; x < width; ++x) {
+                if (premultiplied && qAlpha(line[x]) != 255) {
+                    accumulate(bins, scaledImg.pixelColor(x, y));
+                    continue;
+                }
+                if (hue100[x] < 0) continue;  // Skip grayscale pixels
 
-            int binIndex = (hue / 10) % ::numBins;
+                double weight = getWeight(saturation[x], lightness[x]);
+                // Filter out low-weight pixels to reduce noise
+                if (weight < 0.05) continue;
 
-            bins[binIndex].totalWeight += weight;
-            bins[binIndex].sumR += color.redF() * weight;
-            bins[binIndex].sumG += color.greenF() * weight;
-            bins[binIndex].sumB += color.blueF() * weight;
+                accumulate(bins[(hue100[x] / 100 / 10) % ::numBins],
+                           weight,
+                           ::channelF[qRed(line[x])],
+                           ::channelF[qGreen(line[x])],
+                           ::channelF[qBlue(line[x])]);
+            }
         }
     }
-    delete scaledImg;
 
     // Find the bin with the highest total weight
     int maxBinIndex  = -1;
@@ -96,6 +334,133 @@ static QColor getWeightedDominantColor(const QImage& image) {
     return QColor(finalR, finalG, finalB);
 }
 
+// Median cut, translucent pixels do not count
+static QList<QColor> getMedianCutPalette(const QImage& scaledImg, int count) {
+    if (count <= 0) {
+        return {};
+    }
+
+    const QImage argb = scaledImg.convertToFormat(QImage::Format_ARGB32);
+    QList<QRgb> pixels;
+    pixels.reserve(qsizetype(argb.width()) * argb.height());
+    for (int y = 0; y < argb.height(); ++y) {
+        const auto* line = reinterpret_cast<const QRgb*>(argb.constScanLine(y));
+        for (int x = 0; x < argb.width(); ++x) {
+            if (qAlpha(line[x]) >= 128) pixels.append(line[x]);
+        }
+    }
+    if (pixels.isEmpty()) {
+        return {};
+    }
+
+    // [begin, end) ranges of pixels, each split in place around its median
+    struct Box {
+        qsizetype begin;
+        qsizetype end;
+        int channel = 0;  // 0: red, 1: green, 2: blue
+        int range   = 0;  // of that channel
+    };
+    const auto channelOf = [](QRgb pixel, int channel) {
+        return channel == 0 ? qRed(pixel) : channel == 1 ? qGreen(pixel) : qBlue(pixel);
+    };
+    const auto measure = [&](Box& box) {
+        int lo[3] = {255, 255, 255}, hi[3] = {0, 0, 0};
+        for (qsizetype i = box.begin; i < box.end; ++i) {
+            for (int c = 0; c < 3; ++c) {
+                lo[c] = std::min(lo[c], channelOf(pixels[i], c));
+                hi[c] = std::max(hi[c], channelOf(pixels[i], c));
+            }
+        }
+        box.channel = 0;
+        box.range   = hi[0] - lo[0];
+        for (int c = 1; c < 3; ++c) {
+            if (hi[c] - lo[c] > box.range) {
+                box.channel = c;
+                box.range   = hi[c] - lo[c];
+            }
+        }
+    };
+
+    QList<Box> boxes{{0, pixels.size()}};
+    measure(boxes.first());
+    while (boxes.size() < count) {
+        // The widest box is split next, single colored boxes cannot be split at all
+        qsizetype widest = -1;
+        for (qsizetype i = 0; i < boxes.size(); ++i) {
+            if (boxes[i].range > 0 && (widest < 0 || boxes[i].range > boxes[widest].range)) widest = i;
+        }
+        if (widest < 0) break;
+
+        Box box              = boxes[widest];
+        const qsizetype mid  = box.begin + (box.end - box.begin) / 2;
+        const auto byChannel = [&](QRgb a, QRgb b) { return channelOf(a, box.channel) < channelOf(b, box.channel); };
+        std::nth_element(pixels.begin() + box.begin, pixels.begin() + mid, pixels.begin() + box.end, byChannel);
+
+        Box upper{mid, box.end};
+        box.end = mid;
+        measure(box);
+        measure(upper);
+        boxes[widest] = box;
+        boxes.append(upper);
+    }
+
+    // Most frequent first
+    std::stable_sort(boxes.begin(), boxes.end(), [](const Box& a, const Box& b) {
+        return a.end - a.begin > b.end - b.begin;
+    });
+
+    QList<QColor> palette;
+    palette.reserve(boxes.size());
+    for (const Box& box : std::as_const(boxes)) {
+        qint64 sum[3] = {0, 0, 0};
+        for (qsizetype i = box.begin; i < box.end; ++i) {
+            for (int c = 0; c < 3; ++c) sum[c] += channelOf(pixels[i], c);
+        }
+        const qint64 n = box.end - box.begin;
+        palette.append(QColor(int((sum[0] + n / 2) / n), int((sum[1] + n / 2) / n), int((sum[2] + n / 2) / n)));
+    }
+    return palette;
+}
+
+// Selected once, the CPU does not change
+static ConvertRow defaultConvertRow() {
+    static const ConvertRow convertRow = ::convertRowOf(WallReel::Core::Palette::Kernel::Auto);
+    return convertRow;
+}
+
 QColor WallReel::Core::Palette::getDominantColor(const QImage& image) {
-    return ::getWeightedDominantColor(image);
+    if (image.isNull()) {
+        WR_WARN("Image is null");
+        return QColor();
+    }
+    return ::getWeightedDominantColor(::scaleDown(image), ::defaultConvertRow());
+}
+
+QColor WallReel::Core::Palette::getDominantColor(const QImage& image, Kernel kernel) {
+    if (image.isNull()) {
+        WR_WARN("Image is null");
+        return QColor();
+    }
+    const ConvertRow convertRow = kernel == Kernel::Auto ? ::defaultConvertRow() : ::convertRowOf(kernel);
+    if (!convertRow && kernel != Kernel::Reference) {
+        return QColor();
+    }
+    return ::getWeightedDominantColor(::scaleDown(image), convertRow);
+}
+
+QList<QColor> WallReel::Core::Palette::getPalette(const QImage& image, int count) {
+    if (image.isNull()) {
+        WR_WARN("Image is null");
+        return {};
+    }
+    return ::getMedianCutPalette(::scaleDown(image), count);
+}
+
+WallReel::Core::Palette::Colors WallReel::Core::Palette::getColors(const QImage& image, int paletteSize) {
+    if (image.isNull()) {
+        WR_WARN("Image is null");
+        return {};
+    }
+    const QImage scaledImg = ::scaleDown(image);
+    return {::getWeightedDominantColor(scaledImg, ::defaultConvertRow()), ::getMedianCutPalette(scaledImg, paletteSize)};
 }
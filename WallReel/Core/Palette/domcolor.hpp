@@ -1,7 +1,9 @@
 #ifndef WALLREEL_PALETTE_DOMCOLOR_HPP
 #define WALLREEL_PALETTE_DOMCOLOR_HPP
 
+#include <QColor>
 #include <QImage>
+#include <QList>
 
 namespace WallReel::Core::Palette {
 
@@ -13,6 +15,52 @@ namespace WallReel::Core::Palette {
  */
 QColor getDominantColor(const QImage& image);
 
+/**
+ * @brief How getDominantColor() converts pixels to hue, saturation and lightness.
+ *        Every kernel yields the same result bit for bit as the original QColor based code, see misc/Bench/domcolor_bench.cpp.
+ */
+enum class Kernel {
+    Auto,       ///< The fastest one the CPU supports, what getDominantColor(const QImage&) uses
+    Reference,  ///< A QColor per pixel
+    Scalar,
+    Sse41,
+    Avx2,
+};
+
+/**
+ * @brief getDominantColor() with the given kernel, for comparing and timing them.
+ *
+ * @return QColor An empty QColor() if the CPU does not support the kernel
+ */
+QColor getDominantColor(const QImage& image, Kernel kernel);
+
+/**
+ * @brief Number of representative colors extracted per image, exposed to actions as {{ color0 }} etc.
+ */
+inline constexpr int s_paletteSize = 8;
+
+/**
+ * @brief Get representative colors of the given image, most frequent first.
+ *
+ * @details The downscaled image is split by median cut: the box of pixels with the widest channel range
+ *          is halved at the median of that channel until there are count boxes, each yielding its average.
+ *
+ * @param image The input image
+ * @param count Maximum number of colors, fewer for images with fewer distinct colors
+ * @return QList<QColor> Empty if an error occurs
+ */
+QList<QColor> getPalette(const QImage& image, int count = s_paletteSize);
+
+/**
+ * @brief Dominant color and representative colors of an image, computed from the same downscaled image.
+ */
+struct Colors {
+    QColor dominant;        ///< See getDominantColor()
+    QList<QColor> palette;  ///< See getPalette()
+};
+
+Colors getColors(const QImage& image, int paletteSize = s_paletteSize);
+
 }  // namespace WallReel::Core::Palette
 
 #endif  // WALLREEL_PALETTE_DOMCOLOR_HPP
@@ -1,16 +1,30 @@
 #include "manager.hpp"
 
-#include "Palette/matchcolor.hpp"
+#include <QtConcurrent>
+
+#include "Utils/hash.hpp"
 #include "Utils/misc.hpp"
 #include "logger.hpp"
 #include "predefined.hpp"
 
 WALLREEL_DECLARE_SENDER("PaletteManager")
 
+// Stored matches stay valid as long as the palette has the same colors under the same names and the metric is the same
+static quint64 paletteHash(const WallReel::Core::Palette::PaletteItem& palette, WallReel::Core::Palette::Metric metric) {
+    quint64 hash = static_cast<quint64>(metric);
+    for (const auto& item : palette.colors) {
+        const QByteArray name = item.name.toUtf8();
+        hash                  = WallReel::Core::Utils::hashBytes(name.constData(), name.size(), hash);
+        hash                  = WallReel::Core::Utils::hash64({item.color.rgba()}, hash);
+    }
+    return hash;
+}
+
 WallReel::Core::Palette::Manager::Manager(
     const Config::ThemeConfigItems& config,
     Image::Manager& imageManager,
-    QObject* parent) : QObject(parent), m_imageManager(imageManager) {
+    Cache::Manager& cacheManager,
+    QObject* parent) : QObject(parent), m_imageManager(imageManager), m_cacheManager(cacheManager), m_metric(stringToMetric(config.colorMetric)) {
     // The new ones overrides the old ones, use a hashtable to track
     // the latest index of each palette name, then only insert the
     // ones whose index matches the latest index in the hashtable
@@ -47,9 +61,102 @@ WallReel::Core::Palette::Manager::Manager(
             m_palettes.append(newP);
         }
     }
+
+    connect(
+        &m_matchWatcher,
+        &QFutureWatcher<Matches>::finished,
+        this,
+        &Manager::_onMatchFinished);
+    // Images loaded after the palette was selected have not been matched yet
+    connect(
+        &m_imageManager,
+        &Image::Manager::isLoadingChanged,
+        this,
+        [this]() {
+            if (!m_imageManager.isLoading()) {
+                _matchAll();
+            }
+        });
+}
+
+WallReel::Core::Palette::Manager::~Manager() {
+    // The batch writes to the cache manager, which may be deleted right after this
+    m_matchWatcher.waitForFinished();
+}
+
+void WallReel::Core::Palette::Manager::_matchAll() {
+    m_matches    = {};
+    m_isMatching = false;
+    m_matcher = Matcher(m_selectedPalette ? m_selectedPalette->colors : QList<ColorItem>(), m_metric);
+    if (m_matcher.candidates().isEmpty()) {
+        return;
+    }
+    m_matches.paletteHash = paletteHash(*m_selectedPalette, m_metric);
+
+    // Copied here, the images may be deleted by a reload while the batch runs
+    QList<Cache::Key> keys;
+    QList<QColor> colors;
+    for (const Image::Data* data : m_imageManager.images()) {
+        if (data->isValid()) {
+            keys.append(data->getColorKey());
+            colors.append(data->getDominantColor());
+        }
+    }
+    if (keys.isEmpty()) {
+        return;
+    }
+
+    const quint64 hash       = m_matches.paletteHash;
+    const Matcher matcher    = m_matcher;
+    Cache::Manager* cacheMgr = &m_cacheManager;
+    m_isMatching             = true;
+    m_matchWatcher.setFuture(QtConcurrent::run([hash, matcher, keys, colors, cacheMgr]() {
+        Matches matches{hash, cacheMgr->paletteMatches(hash)};
+
+        QList<Cache::Key> missingKeys;
+        QList<QColor> missingColors;
+        for (qsizetype i = 0; i < keys.size(); ++i) {
+            if (!matches.colorNames.contains(keys[i])) {
+                missingKeys.append(keys[i]);
+                missingColors.append(colors[i]);
+            }
+        }
+        // All of them in one pass over the palette
+        const QList<qsizetype> indices = matcher.match(missingColors);
+
+        QHash<Cache::Key, QString> computed;
+        for (qsizetype i = 0; i < missingKeys.size(); ++i) {
+            if (indices[i] >= 0) {
+                computed.insert(missingKeys[i], matcher.candidates()[indices[i]].name);
+            }
+        }
+        cacheMgr->storePaletteMatches(hash, computed);
+        matches.colorNames.insert(computed);
+        WR_DEBUG(QString("Matched %1 color(s) against the palette (%2), %3 from the cache")
+                     .arg(keys.size())
+                     .arg(metricToString(matcher.metric()))
+                     .arg(keys.size() - missingKeys.size()));
+        return matches;
+    }));
+}
+
+void WallReel::Core::Palette::Manager::_onMatchFinished() {
+    const Matches result = m_matchWatcher.result();
+    // The selection has changed while the batch was running
+    if (result.paletteHash != m_matches.paletteHash) {
+        return;
+    }
+    m_matches.colorNames.insert(result.colorNames);
+    m_isMatching = false;
+    // The focused image had no match yet when it was shown
+    if (!m_pendingImageId.isEmpty()) {
+        updateColor(m_pendingImageId);
+    }
+    emit matchingFinished();
 }
 
 void WallReel::Core::Palette::Manager::updateColor(const QString& imageId) {
+    m_pendingImageId.clear();
     bool hasResult = false;
     Utils::Defer defer([&]() {
         if (!hasResult) {
@@ -73,8 +180,9 @@ void WallReel::Core::Palette::Manager::updateColor(const QString& imageId) {
     }
     // Only palette selected, use the colosest color in the palette
     if (!m_selectedColor.has_value()) {
-        auto cached = imageData->getCachedColor(m_selectedPalette->name);
-        if (cached.has_value()) {
+        const Cache::Key colorKey = imageData->getColorKey();
+        auto cached               = m_matches.colorNames.constFind(colorKey);
+        if (cached != m_matches.colorNames.cend()) {
             auto found = m_selectedPalette.value().getColorItem(cached.value());
             if (found.isValid()) {
                 WR_DEBUG("Using cached color match for image " + imageData->getFileName() +
@@ -85,23 +193,17 @@ void WallReel::Core::Palette::Manager::updateColor(const QString& imageId) {
                 return;
             }
         }
-        auto matched = bestMatch(
-            imageData->getDominantColor(),
-            m_selectedPalette.value().colors);
-        // Use dominant color if no valid match found (possibly empty palette)
-        if (!matched.isValid()) {
+        // Not reached by the batch yet, shown without a match until _onMatchFinished() updates it.
+        // Otherwise there is no valid match (possibly empty palette), use the dominant color
+        if (m_isMatching) {
+            WR_DEBUG("No color match for image " + imageData->getFileName() + " yet, waiting for the batch");
+            m_pendingImageId = imageId;
+        } else {
             WR_DEBUG("No valid color match found for image " + imageData->getFileName() +
                      ", using dominant color: " + imageData->getDominantColor().name());
-            m_displayColor     = imageData->getDominantColor();
-            m_displayColorName = "";
-            hasResult          = true;
-            return;
         }
-        WR_DEBUG("Computed color match for image " + imageData->getFileName() + ": " +
-                 matched.name);
-        imageData->cacheColor(m_selectedPalette->name, matched.name);
-        m_displayColor     = matched.color;
-        m_displayColorName = matched.name;
+        m_displayColor     = imageData->getDominantColor();
+        m_displayColorName = "";
         hasResult          = true;
         return;
     }
@@ -1,9 +1,13 @@
 #ifndef WALLREEL_PALETTE_MANAGER_HPP
 #define WALLREEL_PALETTE_MANAGER_HPP
 
+#include <QFutureWatcher>
+
+#include "Cache/manager.hpp"
 #include "Config/data.hpp"
 #include "Image/manager.hpp"
 #include "data.hpp"
+#include "matchcolor.hpp"
 
 namespace WallReel::Core::Palette {
 
@@ -13,8 +17,11 @@ class Manager : public QObject {
   public:
     Manager(const Config::ThemeConfigItems& config,
             Image::Manager& imageManager,
+            Cache::Manager& cacheManager,
             QObject* parent = nullptr);
 
+    ~Manager();
+
     // Properties
 
     const QList<PaletteItem>& availablePalettes() const { return m_palettes; }
@@ -59,6 +66,7 @@ class Manager : public QObject {
             m_selectedPalette = std::nullopt;
         }
         m_selectedColor = std::nullopt;
+        _matchAll();
         emit selectedPaletteChanged();
         emit selectedColorChanged();
     }
@@ -104,6 +112,12 @@ class Manager : public QObject {
                    : QString();
     }
 
+    /**
+     * @brief Whether the loaded images are being matched against the selected palette in the background.
+     *        Images the batch has not reached have no match until matchingFinished() is emitted.
+     */
+    bool isMatching() const { return m_isMatching; }
+
   public slots:
     void updateColor(const QString& imageId);
 
@@ -112,9 +126,27 @@ class Manager : public QObject {
     void selectedColorChanged();
     void colorChanged();
     void colorNameChanged();
+    void matchingFinished();
+
+  private:
+    /**
+     * @brief Match the dominant colors of all loaded images against the selected palette in the background,
+     *        reusing and extending the matches stored in the cache.
+     */
+    void _matchAll();
+
+  private slots:
+    void _onMatchFinished();
 
   private:
+    // Closest palette color of each dominant color
+    struct Matches {
+        quint64 paletteHash = 0;
+        QHash<Cache::Key, QString> colorNames;  ///< By color key
+    };
+
     Image::Manager& m_imageManager;
+    Cache::Manager& m_cacheManager;
 
     QList<PaletteItem> m_palettes;
     // Null means auto
@@ -123,6 +155,13 @@ class Manager : public QObject {
 
     QColor m_displayColor;
     QString m_displayColorName;
+
+    Metric m_metric;
+    Matcher m_matcher;  ///< The selected palette converted for m_metric, empty if there is none
+    Matches m_matches;  ///< Against the selected palette, filled by _matchAll()
+    QFutureWatcher<Matches> m_matchWatcher;
+    bool m_isMatching = false;
+    QString m_pendingImageId;  ///< Shown by updateColor() before the batch reached it
 };
 
 }  // namespace WallReel::Core::Palette
@@ -1,75 +1,181 @@
 #include "matchcolor.hpp"
 
 #include <QDebug>
+#include <algorithm>
 #include <cmath>
+#include <cstdlib>
 #include <limits>
 
+#include "colorspace.hpp"
 #include "logger.hpp"
 
 WALLREEL_DECLARE_SENDER("PaletteMatchColor")
 
 namespace WallReel::Core::Palette {
 
-ColorItem bestMatch(const QColor& target, const QList<ColorItem>& candidates) {
-    if (candidates.isEmpty() || !target.isValid()) {
-        WR_WARN("No candidates or invalid target color for palette matching");
-        static ColorItem emptyItem;
-        return emptyItem;
+// Coordinates of a color as stored by Matcher
+static void convert(const QColor& color, Metric metric, double& x, double& y, double& z) {
+    Lab lab;
+    switch (metric) {
+        case Metric::Legacy:
+            x = color.red();
+            y = color.green();
+            z = color.blue();
+            return;
+        case Metric::OkLab:
+            lab = toOkLab(color);
+            break;
+        default:
+            lab = toCieLab(color);
+            break;
     }
+    x = lab.l;
+    y = lab.a;
+    z = lab.b;
+}
+
+// The distance bestMatch() has always used, with the same operations in the same order so that the results
+// are identical, the hue penalty is selected instead of branched on
+static void legacyDistances(qsizetype count,
+                            const double* __restrict r,
+                            const double* __restrict g,
+                            const double* __restrict b,
+                            const int* __restrict hue,
+                            const double* __restrict hueWeight,
+                            double pr,
+                            double pg,
+                            double pb,
+                            int pHue,
+                            double* __restrict distances) {
+    for (qsizetype i = 0; i < count; ++i) {
+        // RGB distance with weighting
+        const double rmean = (r[i] + pr) / 2.0;
+        const double dr    = r[i] - pr;
+        const double dg    = g[i] - pg;
+        const double db    = b[i] - pb;
 
-    int target_r = target.red();
-    int target_g = target.green();
-    int target_b = target.blue();
+        const double rgbDistance = std::sqrt((2.0 + rmean / 256.0) * dr * dr + 4.0 * dg * dg +
+                                             (2.0 + (255.0 - rmean) / 256.0) * db * db);
 
-    int target_h    = target.hsvHue();
-    double target_s = target.hsvSaturationF();
+        // Hue difference (with wrapping), the shorter way round is 360 - diff exactly when diff > 180
+        const double hueDiff     = std::abs(hue[i] - pHue);
+        const double wrappedDiff = std::min(hueDiff, 360.0 - hueDiff);
+        const double hueTerm     = (hue[i] != -1) & (pHue != -1) ? wrappedDiff : 0.0;
 
-    const ColorItem* closest_flavor = nullptr;
-    double min_distance             = std::numeric_limits<double>::max();
+        distances[i] = rgbDistance + (hueTerm * hueWeight[i] * 3.0);
+    }
+}
 
-    for (const auto& candidate : candidates) {
-        QColor p_color = candidate.color;
-        int p_r        = p_color.red();
-        int p_g        = p_color.green();
-        int p_b        = p_color.blue();
+// Squared, which orders the same as the distance itself
+static void euclideanDistances(qsizetype count,
+                               const double* __restrict x,
+                               const double* __restrict y,
+                               const double* __restrict z,
+                               double px,
+                               double py,
+                               double pz,
+                               double* __restrict distances) {
+    for (qsizetype i = 0; i < count; ++i) {
+        const double dx = x[i] - px;
+        const double dy = y[i] - py;
+        const double dz = z[i] - pz;
+        distances[i]    = dx * dx + dy * dy + dz * dz;
+    }
+}
 
-        int p_h = p_color.hsvHue();
+// Too many transcendental functions to be vectorized, still saves converting the colors again and again
+static void deltaE2000Distances(qsizetype count,
+                                const double* __restrict x,
+                                const double* __restrict y,
+                                const double* __restrict z,
+                                const Lab& candidate,
+                                double* __restrict distances) {
+    for (qsizetype i = 0; i < count; ++i) {
+        distances[i] = deltaE2000({x[i], y[i], z[i]}, candidate);
+    }
+}
 
-        // RGB distance with weighting
-        double rmean = (target_r + p_r) / 2.0;
-        double dr    = target_r - p_r;
-        double dg    = target_g - p_g;
-        double db    = target_b - p_b;
-
-        double rgb_distance = std::sqrt((2.0 + rmean / 256.0) * dr * dr + 4.0 * dg * dg +
-                                        (2.0 + (255.0 - rmean) / 256.0) * db * db);
-
-        // Hue difference (with wrapping)
-        double hue_diff = 0.0;
-        if (target_h != -1 && p_h != -1) {
-            hue_diff = std::abs(target_h - p_h);
-            if (hue_diff > 180.0) {
-                hue_diff = 360.0 - hue_diff;
-            }
+Matcher::Matcher(const QList<ColorItem>& candidates, Metric metric)
+    : m_metric(metric), m_candidates(candidates) {
+    const qsizetype count = candidates.size();
+    m_x.resize(count);
+    m_y.resize(count);
+    m_z.resize(count);
+    if (metric == Metric::Legacy) {
+        m_hue.resize(count);
+    }
+    for (qsizetype i = 0; i < count; ++i) {
+        convert(candidates[i].color, metric, m_x[i], m_y[i], m_z[i]);
+        if (metric == Metric::Legacy) {
+            m_hue[i] = candidates[i].color.hsvHue();
         }
+    }
+}
 
-        // Increase hue weight when saturation is high
-        double hue_weight = (target_s > 0.20) ? 2.0 : 0.5;
+ColorItem Matcher::match(const QColor& target) const {
+    const qsizetype index = match(QList<QColor>{target}).first();
+    return index >= 0 ? m_candidates[index] : ColorItem();
+}
 
-        double total_distance = rgb_distance + (hue_diff * hue_weight * 3.0);
+QList<qsizetype> Matcher::match(const QList<QColor>& targets) const {
+    const qsizetype count = targets.size();
+    QList<qsizetype> result(count, -1);
+    if (m_candidates.isEmpty() || count == 0) {
+        return result;
+    }
 
-        if (total_distance < min_distance) {
-            min_distance   = total_distance;
-            closest_flavor = &candidate;
+    std::vector<double> x(count), y(count), z(count), hueWeight;
+    std::vector<int> hue;
+    if (m_metric == Metric::Legacy) {
+        hue.resize(count);
+        hueWeight.resize(count);
+    }
+    for (qsizetype i = 0; i < count; ++i) {
+        convert(targets[i], m_metric, x[i], y[i], z[i]);
+        if (m_metric == Metric::Legacy) {
+            hue[i] = targets[i].hsvHue();
+            // Increase hue weight when saturation is high
+            hueWeight[i] = (targets[i].hsvSaturationF() > 0.20) ? 2.0 : 0.5;
         }
     }
 
-    if (closest_flavor) {
-        return *closest_flavor;
+    // Strictly closer only, so that the earliest of equally close candidates wins
+    std::vector<double> distances(count);
+    std::vector<double> minDistances(count, std::numeric_limits<double>::max());
+    std::vector<qsizetype> closest(count, -1);
+    for (qsizetype c = 0; c < m_candidates.size(); ++c) {
+        switch (m_metric) {
+            case Metric::Legacy:
+                legacyDistances(count, x.data(), y.data(), z.data(), hue.data(), hueWeight.data(), m_x[c], m_y[c], m_z[c], m_hue[c], distances.data());
+                break;
+            case Metric::DeltaE2000:
+                deltaE2000Distances(count, x.data(), y.data(), z.data(), {m_x[c], m_y[c], m_z[c]}, distances.data());
+                break;
+            default:
+                euclideanDistances(count, x.data(), y.data(), z.data(), m_x[c], m_y[c], m_z[c], distances.data());
+                break;
+        }
+        for (qsizetype i = 0; i < count; ++i) {
+            closest[i]      = distances[i] < minDistances[i] ? c : closest[i];
+            minDistances[i] = std::min(distances[i], minDistances[i]);
+        }
     }
 
-    static ColorItem emptyItem;
-    return emptyItem;
+    for (qsizetype i = 0; i < count; ++i) {
+        if (targets[i].isValid()) {
+            result[i] = closest[i];
+        }
+    }
+    return result;
+}
+
+ColorItem bestMatch(const QColor& target, const QList<ColorItem>& candidates, Metric metric) {
+    if (candidates.isEmpty() || !target.isValid()) {
+        WR_WARN("No candidates or invalid target color for palette matching");
+        static ColorItem emptyItem;
+        return emptyItem;
+    }
+    return Matcher(candidates, metric).match(target);
 }
 
 }  // namespace WallReel::Core::Palette
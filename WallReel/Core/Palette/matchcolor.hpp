@@ -1,18 +1,97 @@
 #ifndef WALLREEL_PALETTE_MATCHCOLOR_HPP
 #define WALLREEL_PALETTE_MATCHCOLOR_HPP
 
+#include <QStringList>
+#include <vector>
+
 #include "data.hpp"
 
 namespace WallReel::Core::Palette {
 
+/**
+ * @brief How the distance between a color and the colors of a palette is measured.
+ */
+enum class Metric : int {
+    Legacy,      // "legacy", redmean weighted RGB distance plus a hue penalty
+    DeltaE76,    // "cie76", euclidean distance in CIELAB
+    DeltaE2000,  // "ciede2000", CIEDE2000 in CIELAB, the most accurate and the slowest
+    OkLab,       // "oklab", euclidean distance in OKLab
+};
+
+inline const QStringList s_availableMetrics = {"legacy", "cie76", "ciede2000", "oklab"};
+
+inline QString metricToString(Metric metric) {
+    switch (metric) {
+        case Metric::DeltaE76:
+            return "cie76";
+        case Metric::DeltaE2000:
+            return "ciede2000";
+        case Metric::OkLab:
+            return "oklab";
+        default:
+            return "legacy";
+    }
+}
+
+inline Metric stringToMetric(const QString& str) {
+    if (str.compare("cie76", Qt::CaseInsensitive) == 0) {
+        return Metric::DeltaE76;
+    } else if (str.compare("ciede2000", Qt::CaseInsensitive) == 0) {
+        return Metric::DeltaE2000;
+    } else if (str.compare("oklab", Qt::CaseInsensitive) == 0) {
+        return Metric::OkLab;
+    } else {
+        return Metric::Legacy;  // default
+    }
+}
+
+/**
+ * @brief A palette converted once into the coordinates of a metric, to match any number of colors against it.
+ */
+class Matcher {
+  public:
+    Matcher() = default;
+    Matcher(const QList<ColorItem>& candidates, Metric metric = Metric::Legacy);
+
+    Metric metric() const { return m_metric; }
+
+    const QList<ColorItem>& candidates() const { return m_candidates; }
+
+    /**
+     * @brief Find the closest candidate of a target color.
+     *
+     * @param target
+     * @return ColorItem The closest candidate, or an empty ColorItem if there are none or the target is invalid
+     */
+    ColorItem match(const QColor& target) const;
+
+    /**
+     * @brief Find the closest candidate of each target color. Each candidate is compared against all targets
+     *        in one branchless loop the compiler vectorizes, ties go to the earlier candidate.
+     *
+     * @param targets
+     * @return QList<qsizetype> Index into candidates() for each target, -1 for invalid targets or if there are no candidates
+     */
+    QList<qsizetype> match(const QList<QColor>& targets) const;
+
+  private:
+    Metric m_metric = Metric::Legacy;
+    QList<ColorItem> m_candidates;
+    // Candidates as structure of arrays: red, green and blue for Metric::Legacy, L, a and b otherwise
+    std::vector<double> m_x, m_y, m_z;
+    std::vector<int> m_hue;  ///< Metric::Legacy only, QColor::hsvHue(), -1 for achromatic colors
+};
+
 /**
  * @brief Find the best matching color from the candidates for the given target color.
+ *        Converts the candidates on every call, use a Matcher to match several colors.
  *
  * @param target
  * @param candidates
+ * @param metric
  * @return ColorItem The best matching color item, or an empty ColorItem if no candidates are provided
  */
-ColorItem bestMatch(const QColor& target, const QList<ColorItem>& candidates);
+ColorItem bestMatch(const QColor& target, const QList<ColorItem>& candidates, Metric metric = Metric::Legacy);
 
 }  // namespace WallReel::Core::Palette
 
@@ -1,8 +1,13 @@
 #ifndef WALLREEL_PROVIDER_BOOTSTRAP_HPP
 #define WALLREEL_PROVIDER_BOOTSTRAP_HPP
 
+#include <QElapsedTimer>
+#include <QGuiApplication>
+#include <QJsonDocument>
 #include <QQmlEngine>
+#include <QTextStream>
 
+#include "Cache/imageprovider.hpp"
 #include "Cache/manager.hpp"
 #include "Config/manager.hpp"
 #include "Image/manager.hpp"
@@ -26,23 +31,55 @@ class Bootstrap {
             options.configPath,
             options.disableActions);
 
-        cacheMgr = new Cache::Manager(
-            Utils::getCacheDir(),
-            configMgr->getCacheConfig().maxImageEntries);
+        const auto& cacheConfig = configMgr->getCacheConfig();
+        Cache::Options cacheOptions;
+        cacheOptions.maxEntries      = cacheConfig.maxImageEntries;
+        cacheOptions.maxBytes        = cacheConfig.maxBytes;
+        cacheOptions.packThumbnails  = cacheConfig.packThumbnails;
+        cacheOptions.codec           = Cache::stringToThumbnailCodec(cacheConfig.thumbnailCodec);
+        cacheOptions.fullContentHash = cacheConfig.fullContentHash;
+        cacheOptions.durability      = Cache::stringToDurability(cacheConfig.durability);
+        // --cache-info only runs if no other cache operation comes first, see main()
+        const bool inspectOnly = options.cacheInfo && !options.clearCache && !options.warmCache;
+        cacheOptions.readOnly  = inspectOnly;
+
+        if (options.sharedCache) {
+            // Populated by an administrator, read by everyone else through cacheOptions.sharedDir
+            const QString sharedDir = Utils::expandPath(cacheConfig.sharedDir);
+            if (!QDir().mkpath(sharedDir) || !QFileInfo(sharedDir).isWritable()) {
+                Logger::critical("Bootstrap", QString("Shared cache directory %1 is not writable").arg(sharedDir));
+                sharedDirWritable = false;
+            }
+            cacheOptions.shareable = true;
+            cacheMgr               = new Cache::Manager(QDir(sharedDir), cacheOptions);
+        } else {
+            cacheOptions.sharedDir = Utils::expandPath(cacheConfig.sharedDir);
+            cacheMgr               = new Cache::Manager(Utils::getCacheDir(), cacheOptions);
+        }
 
         if (options.clearCache) {
             cacheMgr->clearCache();
             return;
         }
 
+        // Nothing but the cache and the wallpaper list is needed, and nothing may write to the cache
+        if (inspectOnly) {
+            return;
+        }
+
+        if (options.retryFailed) {
+            cacheMgr->clearCache(Cache::Type::Failure);
+        }
+
         imageMgr = new Image::Manager(
             *configMgr,
             *cacheMgr,
-            configMgr->getFocusImageSize());
+            thumbnailSizes());
 
         paletteMgr = new Palette::Manager(
             configMgr->getThemeConfig(),
-            *imageMgr);
+            *imageMgr,
+            *cacheMgr);
         qRegisterMetaType<Palette::PaletteItem>("PaletteItem");
         qRegisterMetaType<Palette::ColorItem>("ColorItem");
 
@@ -53,6 +90,25 @@ class Bootstrap {
             options.disableActions);
     }
 
+    /**
+     * @brief Sizes thumbnails are generated at. Headless modes have no screen to ask for its density,
+     *        they cover every one of --dpr or cache.scaleFactors instead.
+     */
+    QList<QSize> thumbnailSizes() const {
+        if (qGuiApp) {
+            return configMgr->getThumbnailSizes(qGuiApp->devicePixelRatio());
+        }
+        return configMgr->getThumbnailSizes(
+            options.scaleFactors.isEmpty() ? configMgr->getCacheConfig().scaleFactors : options.scaleFactors);
+    }
+
+    /**
+     * @brief Register the image providers the models' urls may point to. The engine takes ownership.
+     */
+    void setupEngine(QQmlEngine& engine) {
+        engine.addImageProvider(Cache::ImageProvider::s_ProviderId, new Cache::ImageProvider(*cacheMgr));
+    }
+
     void start() {
         cacheMgr->evictOldEntries();
         configMgr->captureState();
@@ -97,6 +153,12 @@ class Bootstrap {
                         Image::Model::IdRole);
                     if (idVar.isValid()) {
                         auto id = idVar.toString();
+                        // The command gets the matched palette color, which is computed in the background
+                        if (paletteMgr->isMatching()) {
+                            QEventLoop matching;
+                            QObject::connect(paletteMgr, &Palette::Manager::matchingFinished, &matching, &QEventLoop::quit);
+                            matching.exec();
+                        }
                         paletteMgr->updateColor(id);
                         QObject::connect(
                             serviceMgr,
@@ -120,6 +182,102 @@ class Bootstrap {
         return successFlag;
     }
 
+    /**
+     * @brief Run the image pipeline over all wallpapers without any UI, so that their thumbnails and
+     *        colors end up in the cache, and print the throughput over the images that were missing.
+     *
+     * @return bool False if the shared cache cannot be written, finding no wallpaper is not an error
+     */
+    bool warmCache() {
+        // Scripts run by an administrator have to notice that nothing was shared
+        if (options.sharedCache && !sharedDirWritable) {
+            return false;
+        }
+
+        QEventLoop loop;
+        QObject::connect(
+            imageMgr,
+            &Image::Manager::isLoadingChanged,
+            &loop,
+            [&]() {
+                if (!imageMgr->isLoading()) {
+                    loop.quit();
+                }
+            });
+
+        QElapsedTimer timer;
+        timer.start();
+        imageMgr->loadAndProcess();
+        if (imageMgr->isLoading()) {
+            loop.exec();
+        }
+        const double seconds = std::max<qint64>(timer.elapsed(), 1) / 1000.0;
+
+        // An empty directory is already warm, e.g. on a machine set up before any wallpaper is added
+        if (imageMgr->totalCount() == 0) {
+            Logger::info("Bootstrap", "No wallpapers found, nothing to warm");
+            return true;
+        }
+
+        // Only images whose thumbnails were generated, cache hits and skipped failures cost next to nothing
+        const int generated    = imageMgr->generatedCount();
+        const double megabytes = imageMgr->generatedBytes() / 1e6;
+
+        QTextStream out(stdout);
+        out << QString("Generated %1 of %2 image(s), %3 MB in %4 s: %5 images/s, %6 MB/s")
+                   .arg(generated)
+                   .arg(imageMgr->totalCount())
+                   .arg(megabytes, 0, 'f', 1)
+                   .arg(seconds, 0, 'f', 2)
+                   .arg(generated / seconds, 0, 'f', 1)
+                   .arg(megabytes / seconds, 0, 'f', 1)
+            << Qt::endl;
+        return true;
+    }
+
+    /**
+     * @brief Print statistics about the cache, the hit ratio is estimated against the current wallpapers.
+     *
+     * @param json Print a JSON document instead of a human readable report
+     * @return bool Whether the cache could be read
+     */
+    bool cacheInfo(bool json) {
+        configMgr->scanWallpapers();
+        const QStringList& paths = configMgr->getWallpapers();
+        // The largest size, the others are derived from it on a miss
+        const QSize size = thumbnailSizes().first();
+
+        QList<Cache::Source> sources;
+        sources.reserve(paths.size());
+        for (const QString& path : paths) {
+            sources.append(Cache::Manager::identify(QFileInfo(path), size));
+        }
+
+        const Cache::Info info = cacheMgr->info(sources);
+        QTextStream out(stdout);
+        if (json) {
+            out << QJsonDocument(info.toJson()).toJson(QJsonDocument::Indented);
+        } else {
+            out << info.toText();
+        }
+        out.flush();
+        return QFileInfo::exists(QDir(info.directory).filePath("cache.db"));
+    }
+
+    /**
+     * @brief Export the cache to a portable archive, see Cache::Manager::exportCache().
+     */
+    bool exportCache(const QString& path) {
+        return cacheMgr->exportCache(path) >= 0;
+    }
+
+    /**
+     * @brief Import a portable cache archive, see Cache::Manager::importCache().
+     */
+    bool importCache(const QString& path) {
+        return cacheMgr->importCache(path) >= 0;
+    }
+
     ~Bootstrap() {
         delete serviceMgr;
         delete paletteMgr;
@@ -135,6 +293,7 @@ class Bootstrap {
     Image::Manager* imageMgr{};
     Palette::Manager* paletteMgr{};
     Service::Manager* serviceMgr{};
+    bool sharedDirWritable = true;
 };
 
 }  // namespace WallReel::Core::Provider
@@ -1,5 +1,6 @@
 #include "manager.hpp"
 
+#include "Palette/domcolor.hpp"
 #include "Utils/misc.hpp"
 #include "Utils/texttemplate.hpp"
 #include "logger.hpp"
@@ -189,6 +190,13 @@ QHash<QString, QString> Manager::_generateVariables(const Image::Data& imageData
         {"colorHex", hex},
         {"domColorHex", imageData.getDominantColor().name()},
     };
+    // Representative colors, most frequent first, resolved along with the image.
+    // All of them are always defined colors, the last one repeated if there are fewer, the dominant color if there are none
+    const auto& colors = imageData.getPalette();
+    for (int i = 0; i < Palette::s_paletteSize; ++i) {
+        const QColor fallback = colors.isEmpty() ? imageData.getDominantColor() : colors.last();
+        ret.insert(QString("color%1").arg(i), (i < colors.size() ? colors[i] : fallback).name());
+    }
 
     ret.insert(m_actionConfig.savedState);
     return ret;
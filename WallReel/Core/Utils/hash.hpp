@@ -0,0 +1,118 @@
+#ifndef WALLREEL_UTILS_HASH_HPP
+#define WALLREEL_UTILS_HASH_HPP
+
+#include <QtEndian>
+#include <QtGlobal>
+#include <bit>
+#include <cstring>
+#include <initializer_list>
+
+namespace WallReel::Core::Utils {
+
+/**
+ * @brief Finalizer of splitmix64, spreads every input bit over the whole output.
+ *
+ * @param x
+ * @return quint64
+ */
+inline constexpr quint64 mix64(quint64 x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x;
+}
+
+/**
+ * @brief Fast non-cryptographic 64-bit hash of a few integers, not suitable for anything security related.
+ *
+ * @param values Values to hash, order matters
+ * @param seed
+ * @return quint64
+ */
+inline constexpr quint64 hash64(std::initializer_list<quint64> values, quint64 seed = 0) {
+    quint64 h = mix64(seed ^ 0x9e3779b97f4a7c15ull);
+    for (const quint64 v : values) {
+        h = mix64(h ^ (v + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2)));
+    }
+    return h;
+}
+
+/**
+ * @brief XXH64 of a block of memory, fast non-cryptographic 64-bit hash.
+ *
+ * @param data
+ * @param len Number of bytes
+ * @param seed Chain hashes of several blocks by passing the previous result
+ * @return quint64
+ */
+inline quint64 hashBytes(const void* data, qsizetype len, quint64 seed = 0) {
+    constexpr quint64 P1 = 11400714785074694791ull;
+    constexpr quint64 P2 = 14029467366897019727ull;
+    constexpr quint64 P3 = 1609587929392839161ull;
+    constexpr quint64 P4 = 9650029242287828579ull;
+    constexpr quint64 P5 = 2870177450012600261ull;
+
+    const auto read64 = [](const uchar* p) {
+        quint64 v;
+        std::memcpy(&v, p, sizeof(v));
+        return qFromLittleEndian(v);
+    };
+    const auto read32 = [](const uchar* p) {
+        quint32 v;
+        std::memcpy(&v, p, sizeof(v));
+        return qFromLittleEndian(v);
+    };
+    const auto round = [](quint64 acc, quint64 input) {
+        return std::rotl(acc + input * P2, 31) * P1;
+    };
+    const auto merge = [&](quint64 acc, quint64 val) {
+        return (acc ^ round(0, val)) * P1 + P4;
+    };
+
+    const uchar* p   = static_cast<const uchar*>(data);
+    const uchar* end = p + len;
+    quint64 h;
+
+    if (len >= 32) {
+        quint64 v1 = seed + P1 + P2;
+        quint64 v2 = seed + P2;
+        quint64 v3 = seed;
+        quint64 v4 = seed - P1;
+        for (; end - p >= 32; p += 32) {
+            v1 = round(v1, read64(p));
+            v2 = round(v2, read64(p + 8));
+            v3 = round(v3, read64(p + 16));
+            v4 = round(v4, read64(p + 24));
+        }
+        h = std::rotl(v1, 1) + std::rotl(v2, 7) + std::rotl(v3, 12) + std::rotl(v4, 18);
+        h = merge(h, v1);
+        h = merge(h, v2);
+        h = merge(h, v3);
+        h = merge(h, v4);
+    } else {
+        h = seed + P5;
+    }
+    h += quint64(len);
+
+    for (; end - p >= 8; p += 8)
+        h = std::rotl(h ^ round(0, read64(p)), 27) * P1 + P4;
+    if (end - p >= 4) {
+        h = std::rotl(h ^ (quint64(read32(p)) * P1), 23) * P2 + P3;
+        p += 4;
+    }
+    for (; p < end; ++p)
+        h = std::rotl(h ^ (*p * P5), 11) * P1;
+
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+}
+
+}  // namespace WallReel::Core::Utils
+
+#endif  // WALLREEL_UTILS_HASH_HPP
@@ -1,7 +1,7 @@
 #include "appoptions.hpp"
 
-#include <QApplication>
 #include <QCommandLineOption>
+#include <QCoreApplication>
 #include <QTextStream>
 
 #include "Utils/misc.hpp"
@@ -44,35 +44,47 @@ void AppOptions::printError() {
     doReturn = true;
 }
 
-AppOptions::AppOptions() = default;
-
-void AppOptions::parseArgs(QApplication& app) {
+AppOptions::AppOptions() {
     parser.setApplicationDescription("A small wallpaper utility made with Qt");
 
-    const QCommandLineOption helpOption    = parser.addHelpOption();
-    const QCommandLineOption versionOption = parser.addVersionOption();
-
-    QCommandLineOption verboseOption(QStringList() << "V" << "verbose", "Set log level to DEBUG (default is INFO)");
     parser.addOption(verboseOption);
-
-    QCommandLineOption clearCacheOption(QStringList() << "C" << "clear-cache", "Clear the image cache and exit");
     parser.addOption(clearCacheOption);
-
-    QCommandLineOption quietOption(QStringList() << "q" << "quiet", "Suppress all log output");
     parser.addOption(quietOption);
-
-    QCommandLineOption appendDirOption(QStringList() << "d" << "append-dir", "Append an additional wallpaper search directory", "dir");
     parser.addOption(appendDirOption);
-
-    QCommandLineOption configFileOption(QStringList() << "c" << "config-file", "Specify a custom configuration file", "file");
     parser.addOption(configFileOption);
-
-    QCommandLineOption disableActionsOption(QStringList() << "D" << "disable-actions", "Disable actions set in configuration file");
     parser.addOption(disableActionsOption);
-
-    QCommandLineOption applyOption(QStringList() << "a" << "apply", "Apply the specified image as wallpaper and exit", "file");
     parser.addOption(applyOption);
+    parser.addOption(retryFailedOption);
+    parser.addOption(warmCacheOption);
+    parser.addOption(warmSharedCacheOption);
+    parser.addOption(cacheInfoOption);
+    parser.addOption(jsonOption);
+    parser.addOption(exportCacheOption);
+    parser.addOption(importCacheOption);
+    parser.addOption(dprOption);
+}
 
+bool AppOptions::isHeadless(int argc, char* argv[]) {
+    QStringList args;
+    for (int i = 0; i < argc; ++i) {
+        args.append(QString::fromLocal8Bit(argv[i]));
+    }
+
+    // Parsed with the same options as parseArgs(), so that the value of another option,
+    // e.g. a directory named "-W" passed to --append-dir, is not taken for a headless flag
+    AppOptions options;
+    // Invalid arguments are reported by parseArgs() later on
+    if (!options.parser.parse(args)) {
+        return false;
+    }
+    return options.parser.isSet(options.warmCacheOption) ||
+           options.parser.isSet(options.warmSharedCacheOption) ||
+           options.parser.isSet(options.cacheInfoOption) ||
+           options.parser.isSet(options.exportCacheOption) ||
+           options.parser.isSet(options.importCacheOption);
+}
+
+void AppOptions::parseArgs(QCoreApplication& app) {
     // Not parser.process(a->arguments()) because we want to handle exit logics ourselves.
     // parser.process(...) will do something like exit(...) that will terminate
     // the application brutally and produce unwanted warnings.
@@ -131,6 +143,52 @@ void AppOptions::parseArgs(QApplication& app) {
         disableActions = true;
     }
 
+    if (parser.isSet(retryFailedOption)) {
+        retryFailed = true;
+    }
+
+    if (parser.isSet(warmCacheOption)) {
+        warmCache = true;
+    }
+
+    if (parser.isSet(warmSharedCacheOption)) {
+        warmCache   = true;
+        sharedCache = true;
+    }
+
+    if (parser.isSet(cacheInfoOption)) {
+        cacheInfo = true;
+        json      = parser.isSet(jsonOption);
+    }
+
+    if (parser.isSet(exportCacheOption)) {
+        exportPath = Utils::expandPath(parser.value(exportCacheOption));
+    }
+
+    if (parser.isSet(importCacheOption)) {
+        QString path = Utils::expandPath(parser.value(importCacheOption));
+        if (Utils::checkFile(path)) {
+            importPath = path;
+        } else {
+            errorText = QString("Error: Cache archive does not exist or is not accessible: %1").arg(path);
+            printError();
+            return;
+        }
+    }
+
+    if (parser.isSet(dprOption)) {
+        for (const QString& factor : parser.value(dprOption).split(',', Qt::SkipEmptyParts)) {
+            bool ok            = false;
+            const qreal parsed = factor.trimmed().toDouble(&ok);
+            if (!ok || parsed <= 0) {
+                errorText = QString("Error: Invalid device pixel ratio: %1").arg(factor);
+                printError();
+                return;
+            }
+            scaleFactors.append(parsed);
+        }
+    }
+
     if (parser.isSet(applyOption)) {
         QString path = Utils::expandPath(parser.value(applyOption));
         if (Utils::checkImageFile(path)) {
@@ -1,10 +1,11 @@
 #ifndef WALLREEL_CORE_APPOPTIONS_HPP
 #define WALLREEL_CORE_APPOPTIONS_HPP
 
+#include <QCommandLineOption>
 #include <QCommandLineParser>
 #include <QStringList>
 
-class QApplication;
+class QCoreApplication;
 
 namespace WallReel::Core {
 
@@ -14,6 +15,25 @@ namespace WallReel::Core {
 class AppOptions {
     QCommandLineParser parser;
 
+    // Shared by parseArgs() and isHeadless(), help and version are registered right here, the rest in the constructor
+    QCommandLineOption helpOption    = parser.addHelpOption();
+    QCommandLineOption versionOption = parser.addVersionOption();
+    QCommandLineOption verboseOption{{"V", "verbose"}, "Set log level to DEBUG (default is INFO)"};
+    QCommandLineOption clearCacheOption{{"C", "clear-cache"}, "Clear the image cache and exit"};
+    QCommandLineOption quietOption{{"q", "quiet"}, "Suppress all log output"};
+    QCommandLineOption appendDirOption{{"d", "append-dir"}, "Append an additional wallpaper search directory", "dir"};
+    QCommandLineOption configFileOption{{"c", "config-file"}, "Specify a custom configuration file", "file"};
+    QCommandLineOption disableActionsOption{{"D", "disable-actions"}, "Disable actions set in configuration file"};
+    QCommandLineOption applyOption{{"a", "apply"}, "Apply the specified image as wallpaper and exit", "file"};
+    QCommandLineOption retryFailedOption{{"R", "retry-failed"}, "Retry images that failed to load in previous runs"};
+    QCommandLineOption warmCacheOption{{"W", "warm-cache"}, "Generate missing thumbnails without showing any UI and exit"};
+    QCommandLineOption warmSharedCacheOption{{"S", "warm-shared-cache"}, "Generate missing thumbnails in the shared cache read by all users and exit"};
+    QCommandLineOption cacheInfoOption{{"I", "cache-info"}, "Print statistics about the cache and exit"};
+    QCommandLineOption jsonOption{{"J", "json"}, "Print --cache-info as JSON"};
+    QCommandLineOption exportCacheOption{{"e", "export-cache"}, "Export the cache to a portable archive and exit", "file"};
+    QCommandLineOption importCacheOption{{"i", "import-cache"}, "Import a cache archive and exit", "file"};
+    QCommandLineOption dprOption{{"r", "dpr"}, "Device pixel ratios headless modes generate thumbnails for, comma separated", "factors"};
+
     // -v --version
     void printVersion();
 
@@ -28,12 +48,26 @@ class AppOptions {
     QStringList appendDirs;
     QString errorText;
     QString applyPath;            // -a --apply
+    QString exportPath;           // -e --export-cache
+    QString importPath;           // -i --import-cache
+    QList<qreal> scaleFactors;    // -r --dpr, overrides cache.scaleFactors
     bool clearCache     = false;  // -C --clear-cache
     bool disableActions = false;  // -D --disable-actions
+    bool retryFailed    = false;  // -R --retry-failed
+    bool warmCache      = false;  // -W --warm-cache
+    bool sharedCache    = false;  // -S --warm-shared-cache
+    bool cacheInfo      = false;  // -I --cache-info
+    bool json           = false;  // -J --json
     bool doReturn       = false;  ///< Indicates whether the application should exit after parsing arguments.
 
     AppOptions();
-    void parseArgs(QApplication& app);
+    void parseArgs(QCoreApplication& app);
+
+    /**
+     * @brief Whether the arguments ask for a mode that runs without any UI,
+     *        checked before the application object is created.
+     */
+    static bool isHeadless(int argc, char* argv[]);
 };
 
 }  // namespace WallReel::Core
@@ -66,11 +66,22 @@ Item {
                 height: delegateItem.isFocused ? root.focusedItemHeight : root.itemHeight
                 color: "transparent"
 
+                // Thumbnails exist at the focused and the unfocused size,
+                // the larger one is laid over the smaller once it is loaded so that focusing never flickers
                 Image {
                     id: img
 
                     anchors.fill: parent
-                    source: model.imgUrl
+                    source: model.imgThumbUrl
+                    fillMode: Image.PreserveAspectFit
+                    asynchronous: true
+                    cache: true
+                }
+
+                Image {
+                    anchors.fill: parent
+                    source: delegateItem.isFocused ? model.imgUrl : ""
+                    visible: status === Image.Ready
                     fillMode: Image.PreserveAspectFit
                     asynchronous: true
                     cache: true
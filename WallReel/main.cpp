@@ -4,6 +4,7 @@
 #include <QQmlContext>
 #include <QQuickStyle>
 #include <QSocketNotifier>
+#include <memory>
 
 extern "C" {
 #include <signal.h>
@@ -47,7 +48,7 @@ int main(int argc, char* argv[]) {
     // 2. provider (manages states and connections)
     // 3. bootstrap (manages lifecycle of all managers)
     // 4. QSocketNotifier (receives signals for graceful shutdown)
-    // 5. QApplication
+    // 5. QApplication (QCoreApplication in headless modes)
 
     // Mask signals for graceful shutdown
     sigset_t mask;
@@ -63,17 +64,23 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    QApplication a(argc, argv);
-    a.setApplicationName(APP_NAME);
-    a.setApplicationVersion(APP_VERSION);
-    {
+    // Headless modes must not need a display
+    std::unique_ptr<QCoreApplication> app;
+    if (AppOptions::isHeadless(argc, argv)) {
+        app = std::make_unique<QCoreApplication>(argc, argv);
+    } else {
+        auto gui = std::make_unique<QApplication>(argc, argv);
 #if QT_VERSION >= QT_VERSION_CHECK(6, 4, 0)
         using namespace Qt::StringLiterals;
-        a.setWindowIcon(QIcon(u":/icon.svg"_s));
+        gui->setWindowIcon(QIcon(u":/icon.svg"_s));
 #else
-        a.setWindowIcon(QIcon(u":/icon.svg"_qs));
+        gui->setWindowIcon(QIcon(u":/icon.svg"_qs));
 #endif
+        app = std::move(gui);
     }
+    QCoreApplication& a = *app;
+    a.setApplicationName(APP_NAME);
+    a.setApplicationVersion(APP_VERSION);
 
     {
         Logger::init();
@@ -112,6 +119,22 @@ int main(int argc, char* argv[]) {
             return 0;
         }
 
+        if (options.warmCache) {
+            return bootstrap.warmCache() ? 0 : 1;
+        }
+
+        if (options.cacheInfo) {
+            return bootstrap.cacheInfo(options.json) ? 0 : 1;
+        }
+
+        if (!options.exportPath.isEmpty()) {
+            return bootstrap.exportCache(options.exportPath) ? 0 : 1;
+        }
+
+        if (!options.importPath.isEmpty()) {
+            return bootstrap.importCache(options.importPath) ? 0 : 1;
+        }
+
         if (!options.applyPath.isEmpty()) {
             return bootstrap.apply(options.applyPath) ? 0 : 1;
         }
@@ -126,6 +149,7 @@ int main(int argc, char* argv[]) {
                 &provider);
             {
                 QQmlApplicationEngine engine;
+                bootstrap.setupEngine(engine);
 
                 if (const QString s = pickControlsStyle(engine); !s.isEmpty()) {
                     QQuickStyle::setStyle(s);
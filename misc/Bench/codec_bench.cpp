@@ -0,0 +1,210 @@
+// Compares the thumbnail codecs: how long encoding takes, how much disk space the thumbnails take up,
+// and how long loading them takes when scrolling through the carousel. All figures are per thumbnail.
+//
+// Usage: codec_bench [--dir DIR] [--size WxH] [--count N] [--passes N]
+//   --dir     Make thumbnails of the images in DIR instead of generated ones
+//   --size    Thumbnail size, 320x180 by default (style.image_width and style.image_height)
+//   --count   Number of thumbnails, 200 by default
+//   --passes  Times every thumbnail is loaded, 5 by default
+//
+// Loading is measured with the files in the page cache, as when scrolling back and forth through a
+// directory that has been shown before. The pixels are touched afterwards, as uploading them would.
+
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QImage>
+#include <QImageReader>
+#include <QRandomGenerator>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+
+#include "Cache/codec.hpp"
+
+using namespace WallReel::Core::Cache;
+
+namespace {
+
+struct CodecInfo {
+    ThumbnailCodec codec;
+    const char* name;
+};
+
+constexpr CodecInfo s_codecs[] = {
+    {ThumbnailCodec::Jpeg, "jpeg"},
+    {ThumbnailCodec::Raw, "raw"},
+    {ThumbnailCodec::Qoi, "qoi"},
+};
+
+QTextStream& out() {
+    static QTextStream stream(stdout);
+    return stream;
+}
+
+/// Smooth gradients with some noise on top, compressing roughly like a downscaled photo.
+QImage generatedImage(QRandomGenerator& rng, const QSize& size) {
+    QImage image(size, QImage::Format_ARGB32_Premultiplied);
+    const int r0 = rng.bounded(256), g0 = rng.bounded(256), b0 = rng.bounded(256);
+    const int r1 = rng.bounded(256), g1 = rng.bounded(256), b1 = rng.bounded(256);
+    for (int y = 0; y < size.height(); ++y) {
+        auto* line = reinterpret_cast<QRgb*>(image.scanLine(y));
+        for (int x = 0; x < size.width(); ++x) {
+            const int t     = (x * 255 / std::max(1, size.width() - 1) + y * 255 / std::max(1, size.height() - 1)) / 2;
+            const int noise = rng.bounded(17) - 8;
+            line[x]         = qRgb(std::clamp(r0 + (r1 - r0) * t / 255 + noise, 0, 255),
+                                   std::clamp(g0 + (g1 - g0) * t / 255 + noise, 0, 255),
+                                   std::clamp(b0 + (b1 - b0) * t / 255 + noise, 0, 255));
+        }
+    }
+    return image;
+}
+
+/// Scaled and cropped like Image::Data::computeThumbnail() does.
+QImage thumbnailOf(const QString& path, const QSize& size) {
+    QImageReader reader(path);
+    QImage image;
+    if (!reader.read(&image)) {
+        return QImage();
+    }
+    image = image.scaled(size, Qt::KeepAspectRatioByExpanding, Qt::SmoothTransformation);
+    image = image.copy((image.width() - size.width()) / 2, (image.height() - size.height()) / 2, size.width(), size.height());
+    return image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+}
+
+/// Reads one word of every cache line, so that mapped pages are faulted in as an upload would.
+quint32 touch(const QImage& image) {
+    quint32 sum = 0;
+    for (int y = 0; y < image.height(); ++y) {
+        const auto* line = reinterpret_cast<const quint32*>(image.constScanLine(y));
+        for (int x = 0; x < image.width(); x += 16) {
+            sum += line[x];
+        }
+    }
+    return sum;
+}
+
+/// Blocks allocated to a file, which is what it takes up on disk.
+qint64 allocatedBytes(const QString& path) {
+    struct stat st;
+    return ::stat(QFile::encodeName(path).constData(), &st) == 0 ? qint64(st.st_blocks) * 512 : 0;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    QString dir;
+    QSize size(320, 180);
+    int count  = 200;
+    int passes = 5;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--dir") == 0 && i + 1 < argc) {
+            dir = QString::fromLocal8Bit(argv[++i]);
+        } else if (std::strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            const QStringList parts = QString::fromLatin1(argv[++i]).split('x');
+            size                    = parts.size() == 2 ? QSize(parts[0].toInt(), parts[1].toInt()) : QSize();
+        } else if (std::strcmp(argv[i], "--count") == 0 && i + 1 < argc) {
+            count = std::max(1, std::atoi(argv[++i]));
+        } else if (std::strcmp(argv[i], "--passes") == 0 && i + 1 < argc) {
+            passes = std::max(1, std::atoi(argv[++i]));
+        } else {
+            size = QSize();
+            break;
+        }
+    }
+    if (size.isEmpty()) {
+        QTextStream(stderr) << "Usage: " << argv[0] << " [--dir DIR] [--size WxH] [--count N] [--passes N]" << Qt::endl;
+        return 2;
+    }
+
+    QList<QImage> images;
+    if (!dir.isEmpty()) {
+        QDirIterator it(dir, QDir::Files, QDirIterator::Subdirectories);
+        while (it.hasNext() && images.size() < count) {
+            const QImage image = thumbnailOf(it.next(), size);
+            if (!image.isNull()) {
+                images.append(image);
+            }
+        }
+    } else {
+        // Fixed seed, so that runs can be compared
+        QRandomGenerator rng(0x57524344);
+        for (int i = 0; i < count; ++i) {
+            images.append(generatedImage(rng, size));
+        }
+    }
+    if (images.isEmpty()) {
+        QTextStream(stderr) << "No images could be read from " << dir << Qt::endl;
+        return 1;
+    }
+
+    QTemporaryDir tempDir;
+    if (!tempDir.isValid()) {
+        QTextStream(stderr) << "Cannot create a temporary directory: " << tempDir.errorString() << Qt::endl;
+        return 1;
+    }
+
+    out() << QString("%1 thumbnail(s) of %2x%3, loaded %4 time(s) each").arg(images.size()).arg(size.width()).arg(size.height()).arg(passes)
+          << Qt::endl;
+    out() << QString("%1 %2 %3 %4 %5")
+                 .arg(QString("codec"), -6)
+                 .arg(QString("encode us"), 10)
+                 .arg(QString("file KiB"), 10)
+                 .arg(QString("disk KiB"), 10)
+                 .arg(QString("load us"), 10)
+          << Qt::endl;
+
+    // Results are summed up, so that no call can be optimized away
+    quint32 sink = 0;
+    for (const auto& [codec, name] : s_codecs) {
+        QList<QByteArray> encoded;
+        QElapsedTimer timer;
+        timer.start();
+        for (const QImage& image : images) {
+            encoded.append(encodeThumbnail(image, codec));
+        }
+        const double encodeNanos = double(timer.nsecsElapsed()) / images.size();
+
+        QStringList paths;
+        qint64 fileBytes = 0, diskBytes = 0;
+        for (qsizetype i = 0; i < encoded.size(); ++i) {
+            const QString path = tempDir.filePath(QString("%1-%2.%3").arg(QString::fromLatin1(name)).arg(i).arg(thumbnailSuffix(codec)));
+            QFile file(path);
+            if (encoded[i].isEmpty() || !file.open(QIODevice::WriteOnly) || file.write(encoded[i]) != encoded[i].size()) {
+                QTextStream(stderr) << "Cannot write " << path << Qt::endl;
+                return 1;
+            }
+            file.close();
+            paths.append(path);
+            fileBytes += encoded[i].size();
+            diskBytes += allocatedBytes(path);
+        }
+
+        // One pass beforehand, so that every pass finds the files in the page cache
+        for (const QString& path : paths) {
+            sink += touch(loadThumbnail(path));
+        }
+        timer.restart();
+        for (int pass = 0; pass < passes; ++pass) {
+            for (const QString& path : paths) {
+                sink += touch(loadThumbnail(path));
+            }
+        }
+        const double loadNanos = double(timer.nsecsElapsed()) / (qint64(passes) * paths.size());
+
+        out() << QString("%1 %2 %3 %4 %5")
+                     .arg(QString::fromLatin1(name), -6)
+                     .arg(encodeNanos / 1000, 10, 'f', 1)
+                     .arg(fileBytes / 1024.0 / paths.size(), 10, 'f', 1)
+                     .arg(diskBytes / 1024.0 / paths.size(), 10, 'f', 1)
+                     .arg(loadNanos / 1000, 10, 'f', 1)
+              << Qt::endl;
+    }
+    out() << QString("(checksum %1)").arg(sink, 8, 16, QChar('0')) << Qt::endl;
+
+    return 0;
+}
@@ -0,0 +1,269 @@
+// Checks that every dominant color kernel yields the same color, bit for bit, as a frozen copy of
+// getDominantColor() from before the kernels were added, then times each of them on thumbnails the
+// size getDominantColor() works on.
+//
+// Usage: domcolor_bench [--exhaustive] [--iterations N]
+//   --exhaustive  Also compare all 2^24 opaque colors, 16384 distinct ones per image
+//   --iterations  Images converted per kernel when timing, 2000 by default
+//
+// Exits with 1 if any kernel differs from the baseline.
+
+#include <QElapsedTimer>
+#include <QImage>
+#include <QRandomGenerator>
+#include <QTextStream>
+#include <QVector>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include "Palette/domcolor.hpp"
+
+using WallReel::Core::Palette::Kernel;
+using WallReel::Core::Palette::getDominantColor;
+
+namespace {
+
+struct KernelInfo {
+    Kernel kernel;
+    const char* name;
+};
+
+constexpr KernelInfo s_kernels[] = {
+    {Kernel::Reference, "QColor"},
+    {Kernel::Scalar, "scalar"},
+    {Kernel::Sse41, "SSE4.1"},
+    {Kernel::Avx2, "AVX2"},
+    {Kernel::Auto, "auto"},
+};
+
+// The size getDominantColor() scales images down to
+constexpr int s_thumbnailSize = 128;
+
+// getDominantColor() as it was before the kernels were added, kept verbatim as the reference to compare against.
+// Do not change it along with the library.
+namespace baseline {
+
+constexpr int scaleMaxWidth  = 128;
+constexpr int scaleMaxHeight = 128;
+constexpr int numBins        = 36;
+
+double getWeight(const QColor& color) {
+    int h, s, l;
+    color.getHsl(&h, &s, &l);
+    if (h < 0) return 0.0;
+
+    double sNorm = s / 255.0;
+
+    double dist  = std::abs(l - 128.0) / 128.0;
+    double lNorm = 1.0 - dist;
+
+    return sNorm * sNorm * lNorm * lNorm;
+}
+
+QColor getDominantColor(const QImage& image) {
+    if (image.isNull()) {
+        return QColor();
+    }
+
+    QImage* scaledImg = nullptr;
+    if (image.width() > scaleMaxWidth || image.height() > scaleMaxHeight) {
+        scaledImg = new QImage(image.scaled(scaleMaxWidth, scaleMaxHeight, Qt::IgnoreAspectRatio, Qt::SmoothTransformation));
+    } else {
+        scaledImg = new QImage(image);
+    }
+
+    struct HueBin {
+        double totalWeight = 0.0;
+        double sumR        = 0.0;
+        double sumG        = 0.0;
+        double sumB        = 0.0;
+    };
+
+    QVector<HueBin> bins(numBins);
+
+    for (int y = 0; y < scaledImg->height(); ++y) {
+        for (int x = 0; x < scaledImg->width(); ++x) {
+            QColor color = scaledImg->pixelColor(x, y);
+
+            int hue = color.hue();
+            if (hue < 0) continue;
+
+            double weight = getWeight(color);
+            if (weight < 0.05) continue;
+
+            int binIndex = (hue / 10) % numBins;
+
+            bins[binIndex].totalWeight += weight;
+            bins[binIndex].sumR += color.redF() * weight;
+            bins[binIndex].sumG += color.greenF() * weight;
+            bins[binIndex].sumB += color.blueF() * weight;
+        }
+    }
+    delete scaledImg;
+
+    int maxBinIndex  = -1;
+    double maxWeight = 0.0;
+    for (int i = 0; i < numBins; ++i) {
+        if (bins[i].totalWeight > maxWeight) {
+            maxWeight   = bins[i].totalWeight;
+            maxBinIndex = i;
+        }
+    }
+
+    if (maxBinIndex == -1 || maxWeight <= 0.0) {
+        return QColor(Qt::gray);
+    }
+
+    const HueBin& winningBin = bins[maxBinIndex];
+
+    int finalR = std::round((winningBin.sumR / winningBin.totalWeight) * 255.0);
+    int finalG = std::round((winningBin.sumG / winningBin.totalWeight) * 255.0);
+    int finalB = std::round((winningBin.sumB / winningBin.totalWeight) * 255.0);
+
+    return QColor(finalR, finalG, finalB);
+}
+
+}  // namespace baseline
+
+QTextStream& out() {
+    static QTextStream stream(stdout);
+    return stream;
+}
+
+/// Random pixels, a few of them translucent, converted to format.
+QImage randomImage(QRandomGenerator& rng, const QSize& size, QImage::Format format) {
+    QImage image(size, QImage::Format_ARGB32);
+    for (int y = 0; y < size.height(); ++y) {
+        auto* line = reinterpret_cast<QRgb*>(image.scanLine(y));
+        for (int x = 0; x < size.width(); ++x) {
+            const int alpha = rng.bounded(8) == 0 ? rng.bounded(256) : 255;
+            line[x]         = qRgba(rng.bounded(256), rng.bounded(256), rng.bounded(256), alpha);
+        }
+    }
+    return image.convertToFormat(format);
+}
+
+/// Images whose pixels are the opaque colors [index * 16384, (index + 1) * 16384).
+QImage colorRangeImage(int index) {
+    QImage image(s_thumbnailSize, s_thumbnailSize, QImage::Format_RGB32);
+    for (int y = 0; y < s_thumbnailSize; ++y) {
+        auto* line = reinterpret_cast<QRgb*>(image.scanLine(y));
+        for (int x = 0; x < s_thumbnailSize; ++x) {
+            line[x] = 0xff000000u | quint32(index * s_thumbnailSize * s_thumbnailSize + y * s_thumbnailSize + x);
+        }
+    }
+    return image;
+}
+
+/// Compares every supported kernel against the baseline, returns the number of mismatches.
+int compare(const QImage& image, const QString& label) {
+    const QColor expected = baseline::getDominantColor(image);
+    int mismatches        = 0;
+    for (const auto& [kernel, name] : s_kernels) {
+        const QColor actual = getDominantColor(image, kernel);
+        // Not supported by this CPU
+        if (!actual.isValid()) {
+            continue;
+        }
+        if (actual.rgba() != expected.rgba()) {
+            out() << QString("MISMATCH %1 on %2: %3, expected %4")
+                         .arg(QString::fromLatin1(name), label, actual.name(QColor::HexArgb), expected.name(QColor::HexArgb))
+                  << Qt::endl;
+            ++mismatches;
+        }
+    }
+    return mismatches;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    bool exhaustive = false;
+    int iterations  = 2000;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--exhaustive") == 0) {
+            exhaustive = true;
+        } else if (std::strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+            iterations = std::max(1, std::atoi(argv[++i]));
+        } else {
+            QTextStream(stderr) << "Usage: " << argv[0] << " [--exhaustive] [--iterations N]" << Qt::endl;
+            return 2;
+        }
+    }
+
+    out() << "Supported kernels:";
+    const QImage probe(1, 1, QImage::Format_RGB32);
+    for (const auto& [kernel, name] : s_kernels) {
+        if (getDominantColor(probe, kernel).isValid()) {
+            out() << ' ' << name;
+        }
+    }
+    out() << Qt::endl;
+
+    // Fixed seed, so that a mismatch can be reproduced
+    QRandomGenerator rng(0x57524443);
+    // Widths that are not a multiple of the vector width exercise the scalar tails,
+    // larger images go through the same scaling as in the application
+    const QList<QSize> sizes = {{128, 128}, {127, 93}, {7, 5}, {1, 64}, {1920, 1080}, {400, 3000}};
+    const QList<QPair<QImage::Format, QString>> formats = {
+        {QImage::Format_RGB32, "RGB32"},
+        {QImage::Format_ARGB32, "ARGB32"},
+        {QImage::Format_ARGB32_Premultiplied, "ARGB32_Premultiplied"},
+        {QImage::Format_RGB888, "RGB888"},
+    };
+
+    int mismatches = 0, compared = 0;
+    for (int round = 0; round < 16; ++round) {
+        for (const QSize& size : sizes) {
+            for (const auto& [format, formatName] : formats) {
+                const QImage image = randomImage(rng, size, format);
+                mismatches += compare(image, QString("%1x%2 %3 #%4").arg(size.width()).arg(size.height()).arg(formatName).arg(round));
+                ++compared;
+            }
+        }
+    }
+    if (exhaustive) {
+        for (int index = 0; index < (1 << 24) / (s_thumbnailSize * s_thumbnailSize); ++index) {
+            mismatches += compare(colorRangeImage(index), QString("color range #%1").arg(index));
+            ++compared;
+        }
+    }
+    out() << QString("Compared %1 image(s): %2 mismatch(es)").arg(compared).arg(mismatches) << Qt::endl;
+
+    // Timed on images that need no scaling, so that only the conversion and accumulation are measured
+    QList<QImage> images;
+    for (int i = 0; i < 16; ++i) {
+        images.append(randomImage(rng, {s_thumbnailSize, s_thumbnailSize}, QImage::Format_ARGB32_Premultiplied));
+    }
+    // Results are summed up, so that no call can be optimized away
+    quint32 sink         = 0;
+    double baselineNanos = 0;
+    const auto time      = [&](const char* name, const auto& dominantColor) {
+        QElapsedTimer timer;
+        timer.start();
+        for (int i = 0; i < iterations; ++i) {
+            sink += dominantColor(images[i % images.size()]).rgba();
+        }
+        const double nanos = std::max<qint64>(timer.nsecsElapsed(), 1) / double(iterations);
+        if (baselineNanos == 0) {
+            baselineNanos = nanos;
+        }
+        out() << QString("%1: %2 us/image, %3 Mpixel/s, %4x")
+                     .arg(QString::fromLatin1(name), -8)
+                     .arg(nanos / 1000, 8, 'f', 1)
+                     .arg(s_thumbnailSize * s_thumbnailSize * 1000.0 / nanos, 7, 'f', 1)
+                     .arg(baselineNanos / nanos, 0, 'f', 2)
+              << Qt::endl;
+    };
+    time("baseline", [](const QImage& image) { return baseline::getDominantColor(image); });
+    for (const auto& [kernel, name] : s_kernels) {
+        if (getDominantColor(images.first(), kernel).isValid()) {
+            time(name, [kernel = kernel](const QImage& image) { return getDominantColor(image, kernel); });
+        }
+    }
+    out() << QString("(checksum %1)").arg(sink, 8, 16, QChar('0')) << Qt::endl;
+
+    return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,284 @@
+// Compares decoding the preview cameras embed in their JPEGs with decoding the main image at a reduced
+// size through QImageReader::setScaledSize(), for thumbnails the size Image::Data::computeThumbnail() makes.
+//
+// Usage: embeddedpreview_bench [--dir DIR] [--camera WxH] [--preview WxH] [--size WxH] [--count N] [--passes N]
+//   --dir      Use the JPEGs in DIR instead of generated ones
+//   --camera   Size of the generated main images, 6000x4000 (24 megapixels) by default
+//   --preview  Size of the preview embedded in them as a Multi-Picture Format image, 1620x1080 by default
+//   --size     Thumbnail size, 320x180 by default (style.image_width and style.image_height)
+//   --count    Number of generated images, 3 by default
+//   --passes   Times every image is decoded each way, 5 by default
+//
+// Files are decoded from the page cache. Both ways end with the same smooth scaling, and the mean
+// difference of their results is reported, so that a preview too small or too blurry to use shows up.
+
+#include <QBuffer>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QImageReader>
+#include <QRandomGenerator>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QtEndian>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "Image/embeddedpreview.hpp"
+
+using WallReel::Core::Image::readEmbeddedPreview;
+
+namespace {
+
+// Offset of the TIFF header in an APP2 segment: marker, length and the "MPF\0" identifier
+constexpr qsizetype s_MpfHeaderOffset = 8;
+
+QTextStream& out() {
+    static QTextStream stream(stdout);
+    return stream;
+}
+
+QSize parseSize(const char* arg) {
+    const QStringList parts = QString::fromLatin1(arg).split('x');
+    return parts.size() == 2 ? QSize(parts[0].toInt(), parts[1].toInt()) : QSize();
+}
+
+/// Smooth gradients with some noise on top, so that the encoder has about as much to do as with a photo.
+QImage generatedImage(QRandomGenerator& rng, const QSize& size) {
+    QImage image(size, QImage::Format_RGB32);
+    const int r0 = rng.bounded(256), g0 = rng.bounded(256), b0 = rng.bounded(256);
+    const int r1 = rng.bounded(256), g1 = rng.bounded(256), b1 = rng.bounded(256);
+    for (int y = 0; y < size.height(); ++y) {
+        auto* line = reinterpret_cast<QRgb*>(image.scanLine(y));
+        for (int x = 0; x < size.width(); ++x) {
+            const int t     = int((qint64(x) * 255 / size.width() + qint64(y) * 255 / size.height()) / 2);
+            const int noise = rng.bounded(17) - 8;
+            line[x]         = qRgb(std::clamp(r0 + (r1 - r0) * t / 255 + noise, 0, 255),
+                                   std::clamp(g0 + (g1 - g0) * t / 255 + noise, 0, 255),
+                                   std::clamp(b0 + (b1 - b0) * t / 255 + noise, 0, 255));
+        }
+    }
+    return image;
+}
+
+QByteArray encodeJpeg(const QImage& image) {
+    QByteArray bytes;
+    QBuffer buffer(&bytes);
+    buffer.open(QIODevice::WriteOnly);
+    image.save(&buffer, "jpeg", 90);
+    return bytes;
+}
+
+/**
+ * A JPEG as cameras write it: the main image, with an APP2 segment right after SOI whose Multi-Picture
+ * Format index refers to the preview appended after the main image's EOI.
+ */
+QByteArray cameraJpeg(const QByteArray& main, const QByteArray& preview) {
+    // Big endian TIFF header, one IFD with a single MP Entry tag, then two MP entries of 16 bytes
+    QByteArray tiff(8 + 2 + 12 + 4 + 2 * 16, '\0');
+    auto* t = reinterpret_cast<uchar*>(tiff.data());
+    std::memcpy(t, "MM\0*", 4);
+    qToBigEndian<quint32>(8, t + 4);
+    qToBigEndian<quint16>(1, t + 8);
+    qToBigEndian<quint16>(0xB002, t + 10);  // MP Entry
+    qToBigEndian<quint16>(7, t + 12);       // UNDEFINED
+    qToBigEndian<quint32>(2 * 16, t + 14);
+    qToBigEndian<quint32>(8 + 2 + 12 + 4, t + 18);
+
+    QByteArray segment = QByteArray("\xFF\xE2", 2);
+    segment.append(char(0)).append(char(0)).append("MPF", 4);  // length patched below, "MPF\0"
+    const qsizetype segmentLength = segment.size() - 2 + tiff.size();
+    segment[2]                    = char(segmentLength >> 8);
+    segment[3]                    = char(segmentLength & 0xFF);
+
+    // The main image keeps offset 0, the preview's offset is relative to the TIFF header
+    const qsizetype tiffStart     = 2 + s_MpfHeaderOffset;
+    const qsizetype previewOffset = 2 + segment.size() + tiff.size() + (main.size() - 2) - tiffStart;
+    uchar* entries                = t + 8 + 2 + 12 + 4;
+    qToBigEndian<quint32>(0x00030000, entries);  // Baseline primary image
+    qToBigEndian<quint32>(quint32(main.size() + segment.size() + tiff.size()), entries + 4);
+    qToBigEndian<quint32>(0, entries + 8);
+    qToBigEndian<quint32>(0x00010001, entries + 16);  // Large thumbnail
+    qToBigEndian<quint32>(quint32(preview.size()), entries + 20);
+    qToBigEndian<quint32>(quint32(previewOffset), entries + 24);
+
+    return main.first(2) + segment + tiff + main.sliced(2) + preview;
+}
+
+/// Size the source is scaled to before cropping, as in Image::Data::computeThumbnail().
+QSize processSizeOf(const QSize& originalSize, const QSize& targetSize) {
+    const double scale = std::max(double(targetSize.width()) / originalSize.width(), double(targetSize.height()) / originalSize.height());
+    return originalSize * scale;
+}
+
+QImage finish(QImage image, const QSize& processSize) {
+    if (image.size() != processSize) {
+        image = image.scaled(processSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    }
+    return image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+}
+
+QImage decodeScaled(const QString& path, const QSize& processSize) {
+    QImageReader reader(path);
+    reader.setScaledSize(processSize);
+    return finish(reader.read(), processSize);
+}
+
+QImage decodePreview(const QString& path, const QSize& originalSize, const QSize& processSize) {
+    return finish(readEmbeddedPreview(path, originalSize, processSize), processSize);
+}
+
+/// Mean absolute difference per channel, -1 if the images cannot be compared.
+double meanDifference(const QImage& a, const QImage& b) {
+    if (a.isNull() || a.size() != b.size()) {
+        return -1;
+    }
+    qint64 sum = 0;
+    for (int y = 0; y < a.height(); ++y) {
+        const auto* la = reinterpret_cast<const QRgb*>(a.constScanLine(y));
+        const auto* lb = reinterpret_cast<const QRgb*>(b.constScanLine(y));
+        for (int x = 0; x < a.width(); ++x) {
+            sum += qAbs(qRed(la[x]) - qRed(lb[x])) + qAbs(qGreen(la[x]) - qGreen(lb[x])) + qAbs(qBlue(la[x]) - qBlue(lb[x]));
+        }
+    }
+    return double(sum) / (qint64(a.width()) * a.height() * 3);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    QString dir;
+    QSize camera(6000, 4000), preview(1620, 1080), size(320, 180);
+    int count  = 3;
+    int passes = 5;
+    bool valid = true;
+    for (int i = 1; i < argc && valid; ++i) {
+        if (std::strcmp(argv[i], "--dir") == 0 && i + 1 < argc) {
+            dir = QString::fromLocal8Bit(argv[++i]);
+        } else if (std::strcmp(argv[i], "--camera") == 0 && i + 1 < argc) {
+            camera = parseSize(argv[++i]);
+        } else if (std::strcmp(argv[i], "--preview") == 0 && i + 1 < argc) {
+            preview = parseSize(argv[++i]);
+        } else if (std::strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            size = parseSize(argv[++i]);
+        } else if (std::strcmp(argv[i], "--count") == 0 && i + 1 < argc) {
+            count = std::max(1, std::atoi(argv[++i]));
+        } else if (std::strcmp(argv[i], "--passes") == 0 && i + 1 < argc) {
+            passes = std::max(1, std::atoi(argv[++i]));
+        } else {
+            valid = false;
+        }
+    }
+    if (!valid || camera.isEmpty() || preview.isEmpty() || size.isEmpty()) {
+        QTextStream(stderr) << "Usage: " << argv[0]
+                            << " [--dir DIR] [--camera WxH] [--preview WxH] [--size WxH] [--count N] [--passes N]" << Qt::endl;
+        return 2;
+    }
+
+    QTemporaryDir tempDir;
+    QStringList paths;
+    if (!dir.isEmpty()) {
+        QDirIterator it(dir, {"*.jpg", "*.jpeg", "*.JPG", "*.JPEG"}, QDir::Files, QDirIterator::Subdirectories);
+        while (it.hasNext()) {
+            paths.append(it.next());
+        }
+    } else {
+        if (!tempDir.isValid()) {
+            QTextStream(stderr) << "Cannot create a temporary directory: " << tempDir.errorString() << Qt::endl;
+            return 1;
+        }
+        out() << QString("Generating %1 %2x%3 JPEG(s) with a %4x%5 preview...")
+                     .arg(count)
+                     .arg(camera.width())
+                     .arg(camera.height())
+                     .arg(preview.width())
+                     .arg(preview.height())
+              << Qt::endl;
+        // Fixed seed, so that runs can be compared
+        QRandomGenerator rng(0x57524550);
+        for (int i = 0; i < count; ++i) {
+            const QImage image = generatedImage(rng, camera);
+            const QString path = tempDir.filePath(QString("camera-%1.jpg").arg(i));
+            QFile file(path);
+            if (!file.open(QIODevice::WriteOnly) ||
+                file.write(cameraJpeg(encodeJpeg(image), encodeJpeg(image.scaled(preview, Qt::IgnoreAspectRatio, Qt::SmoothTransformation)))) < 0) {
+                QTextStream(stderr) << "Cannot write " << path << Qt::endl;
+                return 1;
+            }
+            paths.append(path);
+        }
+    }
+    if (paths.isEmpty()) {
+        QTextStream(stderr) << "No JPEGs found in " << dir << Qt::endl;
+        return 1;
+    }
+
+    out() << QString("%1 %2 %3 %4 %5")
+                 .arg(QString("image"), -24)
+                 .arg(QString("size"), 11)
+                 .arg(QString("scaled ms"), 10)
+                 .arg(QString("preview ms"), 10)
+                 .arg(QString("diff"), 6)
+          << Qt::endl;
+
+    // Results are summed up, so that no call can be optimized away
+    qint64 sink   = 0;
+    double scaled = 0, fromPreview = 0;
+    int withPreview = 0;
+    for (const QString& path : std::as_const(paths)) {
+        const QSize originalSize = QImageReader(path).size();
+        if (originalSize.isEmpty()) {
+            continue;
+        }
+        const QSize processSize = processSizeOf(originalSize, size);
+
+        // Once beforehand, so that every pass finds the file in the page cache
+        const QImage reference = decodeScaled(path, processSize);
+        const QImage candidate = decodePreview(path, originalSize, processSize);
+
+        QElapsedTimer timer;
+        timer.start();
+        for (int pass = 0; pass < passes; ++pass) {
+            sink += decodeScaled(path, processSize).pixel(0, 0);
+        }
+        const double scaledMillis = timer.nsecsElapsed() / 1e6 / passes;
+
+        double previewMillis = -1;
+        if (!candidate.isNull()) {
+            timer.restart();
+            for (int pass = 0; pass < passes; ++pass) {
+                sink += decodePreview(path, originalSize, processSize).pixel(0, 0);
+            }
+            previewMillis = timer.nsecsElapsed() / 1e6 / passes;
+            scaled += scaledMillis;
+            fromPreview += previewMillis;
+            ++withPreview;
+        }
+
+        out() << QString("%1 %2 %3 %4 %5")
+                     .arg(QFileInfo(path).fileName().right(24), -24)
+                     .arg(QString("%1x%2").arg(originalSize.width()).arg(originalSize.height()), 11)
+                     .arg(scaledMillis, 10, 'f', 2)
+                     .arg(previewMillis < 0 ? QString("-") : QString::number(previewMillis, 'f', 2), 10)
+                     .arg(candidate.isNull() ? QString("-") : QString::number(meanDifference(candidate, reference), 'f', 2), 6)
+              << Qt::endl;
+    }
+
+    if (withPreview > 0) {
+        out() << QString("%1 image(s) with a usable preview: %2 ms scaled, %3 ms from the preview, %4x")
+                     .arg(withPreview)
+                     .arg(scaled / withPreview, 0, 'f', 2)
+                     .arg(fromPreview / withPreview, 0, 'f', 2)
+                     .arg(scaled / std::max(fromPreview, 1e-9), 0, 'f', 2)
+              << Qt::endl;
+    } else {
+        out() << "No image has a usable preview" << Qt::endl;
+    }
+    out() << QString("(checksum %1)").arg(sink) << Qt::endl;
+
+    return 0;
+}
@@ -0,0 +1,233 @@
+// Checks that Matcher with Metric::Legacy picks the same palette color as a frozen copy of bestMatch()
+// from before Matcher was added, for random colors against random palettes, then times both.
+//
+// Usage: matchcolor_bench [--palettes N] [--targets N]
+//   --palettes  Random palettes compared, 2000 by default
+//   --targets   Colors matched against each of them, 256 by default
+//
+// Exits with 1 if any match differs from the baseline.
+
+#include <QColor>
+#include <QElapsedTimer>
+#include <QList>
+#include <QRandomGenerator>
+#include <QTextStream>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <limits>
+
+#include "Palette/matchcolor.hpp"
+
+using WallReel::Core::Palette::ColorItem;
+using WallReel::Core::Palette::Matcher;
+using WallReel::Core::Palette::Metric;
+
+namespace {
+
+// bestMatch() as it was before Matcher was added, kept verbatim as the reference to compare against,
+// except for the warning it logs on empty input. Do not change it along with the library.
+namespace baseline {
+
+ColorItem bestMatch(const QColor& target, const QList<ColorItem>& candidates) {
+    if (candidates.isEmpty() || !target.isValid()) {
+        static ColorItem emptyItem;
+        return emptyItem;
+    }
+
+    int target_r = target.red();
+    int target_g = target.green();
+    int target_b = target.blue();
+
+    int target_h    = target.hsvHue();
+    double target_s = target.hsvSaturationF();
+
+    const ColorItem* closest_flavor = nullptr;
+    double min_distance             = std::numeric_limits<double>::max();
+
+    for (const auto& candidate : candidates) {
+        QColor p_color = candidate.color;
+        int p_r        = p_color.red();
+        int p_g        = p_color.green();
+        int p_b        = p_color.blue();
+
+        int p_h = p_color.hsvHue();
+
+        // RGB distance with weighting
+        double rmean = (target_r + p_r) / 2.0;
+        double dr    = target_r - p_r;
+        double dg    = target_g - p_g;
+        double db    = target_b - p_b;
+
+        double rgb_distance = std::sqrt((2.0 + rmean / 256.0) * dr * dr + 4.0 * dg * dg +
+                                        (2.0 + (255.0 - rmean) / 256.0) * db * db);
+
+        // Hue difference (with wrapping)
+        double hue_diff = 0.0;
+        if (target_h != -1 && p_h != -1) {
+            hue_diff = std::abs(target_h - p_h);
+            if (hue_diff > 180.0) {
+                hue_diff = 360.0 - hue_diff;
+            }
+        }
+
+        // Increase hue weight when saturation is high
+        double hue_weight = (target_s > 0.20) ? 2.0 : 0.5;
+
+        double total_distance = rgb_distance + (hue_diff * hue_weight * 3.0);
+
+        if (total_distance < min_distance) {
+            min_distance   = total_distance;
+            closest_flavor = &candidate;
+        }
+    }
+
+    if (closest_flavor) {
+        return *closest_flavor;
+    }
+
+    static ColorItem emptyItem;
+    return emptyItem;
+}
+
+}  // namespace baseline
+
+QTextStream& out() {
+    static QTextStream stream(stdout);
+    return stream;
+}
+
+/// Mostly random colors, with grays (no hue), barely saturated colors around the 0.20 threshold
+/// and colors taken from the palette, so that every branch of the metric and exact ties are hit.
+QColor randomColor(QRandomGenerator& rng, const QList<ColorItem>& palette) {
+    switch (rng.bounded(8)) {
+        case 0: {
+            const int v = rng.bounded(256);
+            return QColor(v, v, v);
+        }
+        case 1:
+            return QColor::fromHsv(rng.bounded(360), 46 + rng.bounded(14), rng.bounded(256));
+        case 2:
+            if (!palette.isEmpty()) {
+                return palette[rng.bounded(int(palette.size()))].color;
+            }
+            break;
+        default:
+            break;
+    }
+    return QColor(rng.bounded(256), rng.bounded(256), rng.bounded(256));
+}
+
+/// Named after their index, so that a tie broken differently shows up as a different name.
+/// A few colors are repeated, as in palettes that list a color under two names.
+QList<ColorItem> randomPalette(QRandomGenerator& rng) {
+    static const int s_sizes[] = {1, 2, 5, 8, 14, 26, 64};
+    const int size             = s_sizes[rng.bounded(int(std::size(s_sizes)))];
+    QList<ColorItem> palette;
+    for (int i = 0; i < size; ++i) {
+        const QColor color = i > 0 && rng.bounded(8) == 0 ? palette[rng.bounded(i)].color : randomColor(rng, palette);
+        palette.append({QString("c%1").arg(i), color});
+    }
+    return palette;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    int paletteCount = 2000;
+    int targetCount  = 256;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--palettes") == 0 && i + 1 < argc) {
+            paletteCount = std::max(1, std::atoi(argv[++i]));
+        } else if (std::strcmp(argv[i], "--targets") == 0 && i + 1 < argc) {
+            targetCount = std::max(1, std::atoi(argv[++i]));
+        } else {
+            QTextStream(stderr) << "Usage: " << argv[0] << " [--palettes N] [--targets N]" << Qt::endl;
+            return 2;
+        }
+    }
+
+    // Fixed seed, so that a mismatch can be reproduced
+    QRandomGenerator rng(0x57524d43);
+    QList<QList<ColorItem>> palettes;
+    QList<QList<QColor>> targets;
+    for (int p = 0; p < paletteCount; ++p) {
+        palettes.append(randomPalette(rng));
+        QList<QColor> colors;
+        for (int t = 0; t < targetCount; ++t) {
+            colors.append(randomColor(rng, palettes.last()));
+        }
+        targets.append(colors);
+    }
+
+    // Both the single and the batched match, the application uses either
+    qint64 compared = 0, mismatches = 0;
+    for (qsizetype p = 0; p < palettes.size(); ++p) {
+        const Matcher matcher(palettes[p], Metric::Legacy);
+        const QList<qsizetype> batched = matcher.match(targets[p]);
+        for (qsizetype t = 0; t < targets[p].size(); ++t) {
+            const QString expected = baseline::bestMatch(targets[p][t], palettes[p]).name;
+            const QString single   = matcher.match(targets[p][t]).name;
+            const QString batch    = batched[t] >= 0 ? palettes[p][batched[t]].name : QString();
+            ++compared;
+            if (single != expected || batch != expected) {
+                if (++mismatches <= 20) {
+                    out() << QString("MISMATCH on %1 against palette #%2 of %3: single %4, batched %5, expected %6")
+                                 .arg(targets[p][t].name())
+                                 .arg(p)
+                                 .arg(palettes[p].size())
+                                 .arg(single, batch, expected)
+                          << Qt::endl;
+                }
+            }
+        }
+    }
+    out() << QString("Compared %1 match(es): %2 mismatch(es)").arg(compared).arg(mismatches) << Qt::endl;
+
+    // Results are summed up, so that no call can be optimized away
+    qsizetype sink       = 0;
+    double baselineNanos = 0;
+    const auto time      = [&](const char* name, const auto& matchAll) {
+        QElapsedTimer timer;
+        timer.start();
+        for (qsizetype p = 0; p < palettes.size(); ++p) {
+            sink += matchAll(palettes[p], targets[p]);
+        }
+        const double nanos = std::max<qint64>(timer.nsecsElapsed(), 1) / double(compared);
+        if (baselineNanos == 0) {
+            baselineNanos = nanos;
+        }
+        out() << QString("%1: %2 ns/match, %3x")
+                     .arg(QString::fromLatin1(name), -8)
+                     .arg(nanos, 8, 'f', 1)
+                     .arg(baselineNanos / nanos, 0, 'f', 2)
+              << Qt::endl;
+    };
+    time("baseline", [](const QList<ColorItem>& palette, const QList<QColor>& colors) {
+        qsizetype sum = 0;
+        for (const QColor& color : colors) {
+            sum += baseline::bestMatch(color, palette).name.size();
+        }
+        return sum;
+    });
+    time("single", [](const QList<ColorItem>& palette, const QList<QColor>& colors) {
+        const Matcher matcher(palette, Metric::Legacy);
+        qsizetype sum = 0;
+        for (const QColor& color : colors) {
+            sum += matcher.match(color).name.size();
+        }
+        return sum;
+    });
+    time("batched", [](const QList<ColorItem>& palette, const QList<QColor>& colors) {
+        qsizetype sum = 0;
+        for (const qsizetype index : Matcher(palette, Metric::Legacy).match(colors)) {
+            sum += index;
+        }
+        return sum;
+    });
+    out() << QString("(checksum %1)").arg(sink) << Qt::endl;
+
+    return mismatches == 0 ? 0 : 1;
+}